@@ -1 +1,2 @@
 g++ -std=gnu++23 -o autograd ./src/main.cpp
+g++ -std=gnu++23 -O2 -march=native -o benchmark ./src/benchmark.cpp
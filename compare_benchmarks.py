@@ -0,0 +1,40 @@
+import json
+import sys
+
+
+# Compares two result files of `./benchmark --json <file>`, e.g. of the last
+# release and the current build, and lists every result that changed by more
+# than the threshold (default 10%).
+#
+# Usage: python compare_benchmarks.py <baseline.json> <current.json> [threshold]
+
+# units for which larger values are better
+HIGHER_IS_BETTER = {"x", "GFLOP/s", "Melem/s"}
+
+
+def load(path: str) -> dict:
+    with open(path) as file:
+        results = json.load(file)["results"]
+    return {(result["section"], result["name"]): result for result in results}
+
+
+if __name__ == "__main__":
+    if len(sys.argv) < 3:
+        print("usage: compare_benchmarks.py <baseline.json> <current.json> [threshold]")
+        sys.exit(1)
+    baseline, current = load(sys.argv[1]), load(sys.argv[2])
+    threshold = float(sys.argv[3]) if len(sys.argv) > 3 else 0.1
+
+    regressions = 0
+    for key, result in current.items():
+        if key not in baseline or baseline[key]["value"] == 0:
+            continue
+        change = result["value"] / baseline[key]["value"] - 1
+        if abs(change) < threshold:
+            continue
+        better = (change > 0) == (result["unit"] in HIGHER_IS_BETTER)
+        regressions += not better
+        print(f"{'improved' if better else 'REGRESSED':>9} {change:+7.1%}  {key[0]} / {key[1]}: "
+              f"{baseline[key]['value']:.1f} -> {result['value']:.1f} {result['unit']}")
+
+    sys.exit(1 if regressions else 0)
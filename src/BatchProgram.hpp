@@ -0,0 +1,195 @@
+#pragma once
+#include <array>
+#include <span>
+#include <tuple>
+#include <vector>
+#include <cassert>
+#include <cstddef>
+#include <compare>
+#include <algorithm>
+#include <type_traits>
+
+#include "Tape.hpp"
+#include "Kernels.hpp"
+#include "OperatorRegistry.hpp"
+
+
+
+// A BatchProgram evaluates a scalar function and its gradient at many points
+// at once. The function is recorded only once, at a single point, on the Tape,
+// which yields a static list of operations. Replaying this list over a batch
+// of points in structure-of-arrays layout, i.e. the values of a record at all
+// points are contiguous, runs every operation as one tight loop over the batch
+// that can be vectorized, instead of building a graph for every single point.
+//
+// The recording is only valid at points at which the function takes the same
+// branches as at the recorded point. Therefore the guards, which the recording
+// pushed whenever it compared a value (see TapeValue), are checked at every
+// point, and `evaluate()` returns all points at which one of them fails. The
+// results at these points must not be used, and the function has to be
+// evaluated there in another way, e.g. by recording it anew.
+//
+// Example:
+//      auto program = BatchProgram<double>::record([](auto x, auto y) { return f(x, y); }, 2.0, 5.0);
+//      std::vector<std::size_t> diverged = program.evaluate(inputs, values, grads);
+template<typename T>
+class BatchProgram {
+public:
+    using OpCode = OperatorRegistry::OpCode;
+    using Index = typename Tape<T>::Index;
+
+    // The batch is processed in chunks of this many points, so that the rows
+    // of all records of a chunk stay in cache.
+    static constexpr std::size_t chunk_size = 256;
+
+    // Records `fn` at `point`, i.e. `fn` is called with one TapeVariable per
+    // coordinate of the point. The tape of the current thread is reset before
+    // and after recording.
+    template<typename Fn, typename... Args>
+    static BatchProgram<T> record(Fn&& fn, const Args&... point) {
+        Tape<T>& tape = Tape<T>::get();
+        tape.reset();
+        // the inputs are the first records of the tape
+        std::array<TapeVariable<T>, sizeof...(Args)> inputs{TapeVariable<T>(static_cast<T>(point))...};
+        TapeVariable<T> output = std::apply(fn, inputs);
+        BatchProgram<T> program(tape, inputs.size(), output.index());
+        tape.reset();
+        return program;
+    }
+
+    std::size_t num_inputs() const { return _num_inputs; }
+    std::size_t size() const { return _steps.size(); }
+    std::size_t num_guards() const { return _guards.size(); }
+
+    // Evaluates the function at `values.size()` points. The coordinates of
+    // the points are passed in structure-of-arrays layout, i.e. input `i` of
+    // point `p` is `inputs[i * values.size() + p]`. The gradients w.r.t. the
+    // inputs are written to `grads` in the same layout, unless it is empty.
+    // Returns the points at which the control flow differs from the recording
+    // in ascending order.
+    std::vector<std::size_t> evaluate(std::span<const T> inputs, std::span<T> values, std::span<T> grads = {}) {
+        const std::size_t size = values.size();
+        assert(inputs.size() == _num_inputs * size && "inputs do not match the number of points");
+        assert((grads.empty() || grads.size() == inputs.size()) && "gradients do not match the inputs");
+
+        std::vector<std::size_t> diverged;
+        for (std::size_t begin = 0; begin < size; begin += chunk_size) {
+            const std::size_t width = std::min(chunk_size, size - begin);
+            for (std::size_t i = 0; i < _num_inputs; ++i)
+                std::copy_n(inputs.data() + i * size + begin, width, value_row(i));
+
+            forward(width);
+            check_guards(width, begin, diverged);
+            std::copy_n(value_row(_output), width, values.data() + begin);
+
+            if (!grads.empty()) {
+                backward(width);
+                for (std::size_t i = 0; i < _num_inputs; ++i)
+                    std::copy_n(grad_row(i), width, grads.data() + i * size + begin);
+            }
+        }
+        return diverged;
+    }
+
+private:
+    struct Step {
+        OpCode op;
+        Index lhs;
+        Index rhs;
+        std::array<T, 2> constants;
+    };
+
+    BatchProgram(const Tape<T>& tape, std::size_t num_inputs, Index output)
+        : _num_inputs(num_inputs), _output(output), _guards(tape.guards()) {
+        _steps.reserve(tape.size());
+        for (const auto& record : tape.records())
+            _steps.push_back({record.op, record.lhs, record.rhs, tape.constants(record)});
+        _values.resize(_steps.size() * chunk_size);
+        _grads.resize(_steps.size() * chunk_size);
+
+        // leaves that are not inputs are constants
+        for (std::size_t i = _num_inputs; i < _steps.size(); ++i)
+            if (_steps[i].op == OpCode::Leaf)
+                std::fill_n(value_row(i), chunk_size, tape.value(static_cast<Index>(i)));
+    }
+
+    T* value_row(std::size_t index) { return _values.data() + index * chunk_size; }
+    T* grad_row(std::size_t index) { return _grads.data() + index * chunk_size; }
+
+    void forward(std::size_t width) {
+        for (std::size_t i = 0; i < _steps.size(); ++i) {
+            const Step& step = _steps[i];
+            if (step.op == OpCode::Leaf)
+                continue;
+
+            T* out = value_row(i);
+            OperatorRegistry::visit(step.op, step.constants, [&](const auto& op) {
+                if constexpr (std::decay_t<decltype(op)>::arity == 2)
+                    Kernels::zip(value_row(step.lhs), value_row(step.rhs), out, width, [&](T lhs, T rhs) { return op(lhs, rhs); });
+                else if constexpr (requires { op.forward_array(value_row(step.lhs), out, width); })
+                    op.forward_array(value_row(step.lhs), out, width);
+                else
+                    Kernels::map(value_row(step.lhs), out, width, [&](T val) { return op(val); });
+            });
+        }
+    }
+
+    void check_guards(std::size_t width, std::size_t begin, std::vector<std::size_t>& diverged) {
+        std::array<bool, chunk_size> failed{};
+        for (const auto& guard : _guards) {
+            const T* row = value_row(guard.index);
+            for (std::size_t p = 0; p < width; ++p)
+                failed[p] |= (row[p] <=> guard.rhs) != guard.ordering;
+        }
+        for (std::size_t p = 0; p < width; ++p)
+            if (failed[p])
+                diverged.push_back(begin + p);
+    }
+
+    // Reverse sweep like `Tape::backward()`, but over rows of gradients.
+    void backward(std::size_t width) {
+        std::fill_n(_grads.begin(), (_output + 1) * chunk_size, T(0));
+        std::fill_n(grad_row(_output), width, T(1));
+
+        for (std::size_t i = _output + 1; i-- > 0;) {
+            const Step& step = _steps[i];
+            if (step.op == OpCode::Leaf)
+                continue;
+
+            const T* grad = grad_row(i);
+            OperatorRegistry::visit(step.op, step.constants, [&](const auto& op) {
+                if constexpr (std::decay_t<decltype(op)>::arity == 2) {
+                    if (step.lhs == step.rhs) {
+                        // both gradients are accumulated into the same row
+                        Kernels::map_accumulate(value_row(step.lhs), grad, grad_row(step.lhs), width, [&](T val, T grad) {
+                            auto [lhs_grad, rhs_grad] = op.backward_value(val, val, grad);
+                            return lhs_grad + rhs_grad;
+                        });
+                    } else {
+                        Kernels::zip_accumulate(value_row(step.lhs), value_row(step.rhs), grad, grad_row(step.lhs), grad_row(step.rhs), width,
+                            [&](T lhs, T rhs, T grad) { return op.backward_value(lhs, rhs, grad); });
+                    }
+                } else if constexpr (requires { op.backward_output(T{}, T{}); }) {
+                    // the derivative follows from the output row of the step
+                    Kernels::map_accumulate(value_row(i), grad, grad_row(step.lhs), width, [&](T out, T grad) { return op.backward_output(out, grad); });
+                } else if constexpr (requires { op.save_array(value_row(step.lhs), grad_row(i), width); }) {
+                    // the values a node would have saved, for the whole row at once
+                    std::array<T, chunk_size> saved;
+                    op.save_array(value_row(step.lhs), saved.data(), width);
+                    Kernels::map_accumulate(saved.data(), grad, grad_row(step.lhs), width,
+                        [&](T value, T grad) { return op.backward_saved(std::array<T, 2>{value, T{}}, grad); });
+                } else {
+                    Kernels::map_accumulate(value_row(step.lhs), grad, grad_row(step.lhs), width, [&](T val, T grad) { return op.backward_value(val, grad); });
+                }
+            });
+        }
+    }
+
+    std::size_t _num_inputs;
+    Index _output;
+    std::vector<Step> _steps;
+    std::vector<typename Tape<T>::Guard> _guards;
+    // rows of `chunk_size` values and gradients, one per step
+    std::vector<T> _values;
+    std::vector<T> _grads;
+};
@@ -0,0 +1,138 @@
+#pragma once
+#include <span>
+#include <array>
+#include <cmath>
+#include <memory>
+#include <cassert>
+#include <optional>
+#include <cstddef>
+#include <utility>
+#include <algorithm>
+#include <unordered_set>
+
+#include "Variable.hpp"
+
+
+
+// Gradient checkpointing trades recomputation for memory: instead of keeping
+// all intermediate nodes of a region of the graph alive until the backward
+// pass, `checkpoint(fn, inputs...)` evaluates `fn` without keeping its graph
+// and returns a single node connected to the inputs. When the backward pass
+// reaches this node, it calls `fn` again on the values of the inputs, runs a
+// nested backward pass through the recomputed graph and releases it, thus
+// only the graph of one region exists at a time.
+//
+// Regions have one or two inputs. Besides its inputs, `fn` may only use
+// constants and leaves (e.g. parameters), whose gradients are accumulated by
+// the nested backward pass, but no other intermediate Variables, since those
+// are still waiting for their gradients in the outer backward pass. `fn` must
+// be deterministic, i.e. compute the same function when it is called again.
+// Checkpoints only support first-order gradients (`create_graph=false`) and
+// cannot be compiled into a CompiledFunction. With `backward_parallel()`,
+// regions must not use leaves that are used elsewhere in the graph, since
+// their gradients are accumulated while other threads may do the same.
+//
+// Example:
+//      // keeps O(sqrt(n)) nodes instead of O(n)
+//      auto out = checkpoint_sequential([&](auto state, std::size_t i) { return (state * x).sin(); }, x, n);
+//      out.backward();
+template<typename T, typename Fn, typename... Vars>
+Variable<T> checkpoint(Fn fn, const Variable<T>& input, const Vars&... inputs) {
+    constexpr std::size_t num_inputs = 1 + sizeof...(Vars);
+    static_assert(num_inputs <= 2, "checkpoints have at most two inputs");
+    const std::array<Variable<T>, num_inputs> args{input, inputs...};
+
+    // The forward pass treats the inputs as constants, so that the region
+    // does not create nodes except for operations on leaves it captures,
+    // which are released right away.
+    std::array<Variable<T>, num_inputs> constants;
+    for (std::size_t i = 0; i < num_inputs; ++i)
+        constants[i] = Variable<T>(args[i].value());
+    GraphCapture<T> capture;
+    Variable<T> result;
+    {
+        typename GraphCapture<T>::Scope scope(capture);
+        result = std::apply(fn, constants);
+    }
+
+#ifndef NDEBUG
+    std::unordered_set<const VariableImpl<T>*> captured;
+    for (const auto& node : capture.nodes)
+        captured.insert(node.get());
+    for (const auto& node : capture.nodes)
+        for (const auto& parent : node->parents())
+            assert((captured.contains(parent.get()) || (parent->is_leaf() && parent->parents().empty())) &&
+                "checkpointed functions may only use their inputs, constants and leaves");
+#endif
+
+    bool requires_grad = result.requires_grad();
+    for (const auto& arg : args)
+        requires_grad |= arg.requires_grad() && !NoGrad::active();
+    Variable<T> out(result.value(), requires_grad, false);
+    if (!requires_grad)
+        return out;
+
+    // The custom backward function holds `fn`, but neither the values nor
+    // the graph of the region.
+    out.variable()->set_custom_backward([fn](std::span<const std::shared_ptr<VariableImpl<T>>> parents, const T& grad) {
+        std::array<Variable<T>, num_inputs> detached;
+        for (std::size_t i = 0; i < num_inputs; ++i)
+            detached[i] = Variable<T>(parents[i]->value(), parents[i]->requires_grad());
+
+        // The inputs and all captured leaves accumulate their gradients in a
+        // buffer of the nested backward pass, from which the gradients of
+        // the inputs are returned to the outer one, while those of captured
+        // leaves are passed on.
+        GradientBuffer<T>* outer = GradientBuffer<T>::active();
+        GradientBuffer<T> buffer;
+        {
+            // the region is recomputed with its graph, even if the outer
+            // backward pass runs in a NoGrad scope
+            NoGrad enable_grad(false);
+            typename GradientBuffer<T>::Scope scope(buffer);
+            Variable<T> recomputed = std::apply(fn, detached);
+            recomputed.backward(grad);
+        }
+
+        std::array<T, 2> in_grads{};
+        for (std::size_t i = 0; i < num_inputs; ++i)
+            if (std::optional<T> input_grad = detached[i].grad_value())
+                in_grads[i] = *input_grad;
+        for (const auto& [leaf, leaf_grad] : buffer.entries()) {
+            auto it = std::ranges::find_if(detached, [&](const Variable<T>& var) { return var.variable() == leaf; });
+            if (it != detached.end())
+                in_grads[it - detached.begin()] += leaf_grad;
+            else if (outer)
+                outer->add(leaf, leaf_grad);
+            else
+                leaf->add_grad(leaf_grad);
+        }
+        return in_grads;
+    });
+    for (const auto& arg : args) {
+        out.variable()->add_parent(arg.variable());
+        arg.variable()->add_child(out.variable());
+    }
+    return out;
+}
+
+
+// Applies `step(state, i)` for `i = 0, ..., num_steps - 1`, e.g. the body of
+// a long unrolled loop, and checkpoints every segment of `segment_size` steps.
+// By default, segments have sqrt(num_steps) steps, so that the graph that is
+// kept until the backward pass and the graph of a recomputed segment both
+// have O(sqrt(num_steps)) nodes.
+template<typename T, typename Step>
+Variable<T> checkpoint_sequential(Step step, Variable<T> state, std::size_t num_steps, std::size_t segment_size = 0) {
+    if (segment_size == 0)
+        segment_size = std::max<std::size_t>(1, static_cast<std::size_t>(std::sqrt(static_cast<double>(num_steps))));
+    for (std::size_t begin = 0; begin < num_steps; begin += segment_size) {
+        const std::size_t end = std::min(num_steps, begin + segment_size);
+        state = checkpoint([step, begin, end](Variable<T> segment_state) {
+            for (std::size_t i = begin; i < end; ++i)
+                segment_state = step(segment_state, i);
+            return segment_state;
+        }, state);
+    }
+    return state;
+}
@@ -0,0 +1,189 @@
+#pragma once
+#include <array>
+#include <span>
+#include <vector>
+#include <memory>
+#include <cassert>
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+#include <type_traits>
+#include <tuple>
+#include <utility>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "Variable.hpp"
+#include "OperatorRegistry.hpp"
+#include "GraphOptimization.hpp"
+
+
+
+// A CompiledFunction captures the computational graph that a callable builds
+// from Variables once, and freezes its topology into flat arrays: one step
+// {op code, input indices, constants} per node in topological order, and one
+// value, the values saved by its operation and one gradient per node. Calling
+// it again with new input values replays the forward pass over the value
+// buffer and the backward pass over the gradient buffer, without creating any
+// nodes. For scalar value types neither of them allocates memory.
+//
+// The captured graph is optimized before it is frozen (see
+// GraphOptimization.hpp), e.g. repeated subexpressions are computed once.
+//
+// Only the values of the inputs can change between calls. Everything else
+// the callable used is frozen at the time of the capture: Variables that do
+// not require a gradient are folded into the operations as constants, and
+// other leaves are treated as constants with their captured value. Also, the
+// topology is captured for one particular execution, thus the callable must
+// not branch on values of Variables.
+//
+// Example:
+//      auto compiled = CompiledFunction<double>::compile([](auto x, auto y) { return f(x, y); }, 2.0, 5.0);
+//      double value = compiled.forward(3.0, 4.0);
+//      compiled.backward();
+//      double df_dx = compiled.grad(0);
+template<typename T>
+class CompiledFunction {
+public:
+    using OpCode = OperatorRegistry::OpCode;
+    using Index = std::uint32_t;
+
+    // Calls `fn` with one Variable per input that requires a gradient and
+    // captures all operations that the returned Variable depends on.
+    template<typename Fn, typename... Args>
+    static CompiledFunction<T> compile(Fn&& fn, const Args&... inputs) {
+        std::array<Variable<T>, sizeof...(Args)> variables{Variable<T>(static_cast<T>(inputs), true)...};
+
+        GraphCapture<T> capture;
+        Variable<T> output;
+        {
+            typename GraphCapture<T>::Scope scope(capture);
+            output = std::apply(fn, variables);
+        }
+
+        // Only the captured nodes that the output depends on are kept. Merged
+        // nodes may have been replaced by an equal node that was captured
+        // after their children, thus they are sorted topologically again.
+        optimize_graph(output);
+        std::unordered_set<const VariableImpl<T>*> captured;
+        for (const auto& node : capture.nodes)
+            captured.insert(node.get());
+        std::vector<std::shared_ptr<VariableImpl<T>>> nodes;
+        for (auto& node : output.variable()->topological_order())
+            if (captured.contains(node.get()) && node->op() != OpCode::Leaf)
+                nodes.push_back(std::move(node));
+
+        return CompiledFunction<T>(variables, nodes, output);
+    }
+
+    std::size_t num_inputs() const { return _num_inputs; }
+    std::size_t size() const { return _steps.size(); }
+
+    // Evaluates the captured graph at new input values and returns the output.
+    T forward(std::span<const T> inputs) {
+        assert(inputs.size() == _num_inputs && "wrong number of inputs");
+        std::copy(inputs.begin(), inputs.end(), _values.begin());
+
+        for (std::size_t i = _num_inputs; i < _steps.size(); ++i) {
+            const Step& step = _steps[i];
+            if (step.op == OpCode::Leaf)
+                continue;
+            _values[i] = OperatorRegistry::visit(step.op, step.constants, [&](const auto& op) -> T {
+                if constexpr (std::decay_t<decltype(op)>::arity == 2) {
+                    return op(_values[step.lhs], _values[step.rhs]);
+                } else {
+                    T out = op(_values[step.lhs]);
+                    if constexpr (requires { op.save(out, out); })
+                        _saved[i] = op.save(_values[step.lhs], out);
+                    return out;
+                }
+            });
+        }
+        return _values[_output];
+    }
+
+    template<typename... Args>
+    T forward(const Args&... inputs) {
+        const std::array<T, sizeof...(Args)> values{static_cast<T>(inputs)...};
+        return forward(std::span<const T>(values));
+    }
+
+    // Computes the gradients of the output of the last forward pass w.r.t.
+    // the inputs. Gradients of a previous backward call are overwritten.
+    void backward(T prev_grad = 1) {
+        std::fill(_grads.begin(), _grads.end(), T(0));
+        _grads[_output] = prev_grad;
+
+        for (std::size_t i = _output + 1; i-- > _num_inputs;) {
+            const Step& step = _steps[i];
+            if (step.op == OpCode::Leaf)
+                continue;
+            OperatorRegistry::visit(step.op, step.constants, [&](const auto& op) {
+                if constexpr (std::decay_t<decltype(op)>::arity == 2) {
+                    auto [lhs_grad, rhs_grad] = op.backward_value(_values[step.lhs], _values[step.rhs], _grads[i]);
+                    _grads[step.lhs] += lhs_grad;
+                    _grads[step.rhs] += rhs_grad;
+                } else {
+                    _grads[step.lhs] += OperatorRegistry::unary_backward_value(op, _values[step.lhs], _values[i], &_saved[i], _grads[i]);
+                }
+            });
+        }
+    }
+
+    T value() const { return _values[_output]; }
+    T grad(std::size_t input) const { return _grads[input]; }
+    std::span<const T> grads() const { return {_grads.data(), _num_inputs}; }
+
+private:
+    struct Step {
+        OpCode op;
+        Index lhs;
+        Index rhs;
+        std::array<T, 2> constants;
+    };
+
+    template<std::size_t N>
+    CompiledFunction(const std::array<Variable<T>, N>& inputs, const std::vector<std::shared_ptr<VariableImpl<T>>>& nodes, const Variable<T>& output)
+        : _num_inputs(N) {
+        std::unordered_map<const VariableImpl<T>*, Index> indices;
+        auto add = [&](const VariableImpl<T>* node, Step step) {
+            indices[node] = static_cast<Index>(_steps.size());
+            _steps.push_back(step);
+            _values.push_back(node->value());
+            _saved.push_back(step.constants);
+        };
+        // Parents that are neither inputs nor captured nodes are constants.
+        auto index_of = [&](const std::shared_ptr<VariableImpl<T>>& node) {
+            if (!indices.contains(node.get()))
+                add(node.get(), {OpCode::Leaf, 0, 0, {}});
+            return indices[node.get()];
+        };
+
+        for (const auto& input : inputs)
+            add(input.variable().get(), {OpCode::Leaf, 0, 0, {}});
+        for (const auto& node : nodes) {
+            if (indices.contains(node.get()))
+                continue;
+            assert(node->op() != OpCode::Custom && "custom operations such as checkpoints cannot be compiled");
+            auto parents = node->parents();
+            Step step{node->op(), 0, 0, node->constants()};
+            step.lhs = index_of(parents[0]);
+            if (parents.size() > 1)
+                step.rhs = index_of(parents[1]);
+            add(node.get(), step);
+        }
+
+        assert(indices.contains(output.variable().get()) && "the output does not depend on the inputs");
+        _output = indices[output.variable().get()];
+        _grads.resize(_values.size());
+    }
+
+    std::size_t _num_inputs;
+    Index _output = 0;
+    std::vector<Step> _steps;
+    std::vector<T> _values;
+    // values saved by the last forward pass (see `OperatorRegistry::stored_of()`),
+    // initially those of the captured nodes
+    std::vector<std::array<T, 2>> _saved;
+    std::vector<T> _grads;
+};
@@ -0,0 +1,49 @@
+#pragma once
+#include <span>
+#include <atomic>
+#include <vector>
+#include <cstddef>
+
+#include "Variable.hpp"
+#include "ThreadPool.hpp"
+
+
+
+// Data-parallel training runs the forward and backward passes of several
+// shards of a minibatch concurrently against the same leaf parameters. Every
+// shard collects the gradients of the leaves in its own GradientBuffer, and
+// the buffers are all-reduced into the leaves afterwards. Since the buffers
+// belong to shards instead of threads and are reduced in the order of the
+// shards, the resulting gradients do not depend on the number of threads.
+//
+// Example:
+//      data_parallel<double>(ThreadPool::global(), num_shards, [&](std::size_t shard) {
+//          loss(params, shard).backward();
+//      });
+//      // the gradients of all shards are now accumulated in `params`
+
+
+// Accumulates the gradients of all `buffers` into their leaves, buffer by
+// buffer, and clears the buffers.
+template<typename T>
+void all_reduce(std::span<GradientBuffer<T>> buffers) {
+    for (GradientBuffer<T>& buffer : buffers)
+        buffer.reduce();
+}
+
+// Calls `fn(shard)` for every shard in [0, num_shards) on the threads of
+// `pool`, each with its own GradientBuffer active, and all-reduces the
+// gradients into the leaves once all shards are done. `fn` must not use
+// `backward_parallel()` on the same pool.
+template<typename T, typename Fn>
+void data_parallel(ThreadPool& pool, std::size_t num_shards, Fn&& fn) {
+    std::vector<GradientBuffer<T>> buffers(num_shards);
+    std::atomic<std::size_t> next_shard = 0;
+    pool.broadcast([&](std::size_t) {
+        for (std::size_t shard; (shard = next_shard.fetch_add(1, std::memory_order_relaxed)) < num_shards;) {
+            typename GradientBuffer<T>::Scope scope(buffers[shard]);
+            fn(shard);
+        }
+    });
+    all_reduce(std::span<GradientBuffer<T>>(buffers));
+}
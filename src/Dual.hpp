@@ -2,220 +2,369 @@
 #include <iostream>
 #include <type_traits>
 #include <cmath>
+#include <array>
+#include <vector>
+#include <span>
+#include <cassert>
+#include <algorithm>
+#include <compare>
 
+#include "VectorMath.hpp"
 
 
-template<typename T>
+// Number of tangents of a Dual whose size is only known at runtime.
+inline constexpr std::size_t Dynamic = std::dynamic_extent;
+
+
+// A Dual carries N tangents, i.e. the directional derivatives w.r.t. N
+// inputs, so that a single forward evaluation yields the whole gradient of
+// a function with N inputs. The tangents are stored contiguously and all
+// operations update them with tight elementwise loops, which the compiler
+// vectorizes. `Dual<T>` has a single tangent, while `Dual<T, Dynamic>` has
+// as many tangents as it is seeded with at runtime (an empty tangent vector
+// represents a constant).
+template<typename T, std::size_t N = 1>
 class Dual {
+public:
+    using Tangent = std::conditional_t<N == Dynamic, std::vector<T>, std::array<T, N>>;
+
 private:
-    T _primal, _tangent;
+    T _primal;
+    Tangent _tangent;
 
 public:
-    Dual(T primal, T tangent = 0) : _primal(primal), _tangent(tangent) {};
+    Dual(T primal = 0) : _primal(primal), _tangent() {};
+
+    Dual(T primal, T tangent) requires (N == 1) : _primal(primal), _tangent{tangent} {};
+
+    Dual(T primal, Tangent tangent) : _primal(primal), _tangent(std::move(tangent)) {};
+
+    // Returns a Dual whose tangent w.r.t. the input `index` is 1, i.e. the
+    // `index`-th input of a function out of `size` inputs.
+    static Dual<T, N> variable(T primal, std::size_t index, std::size_t size = N) {
+        Dual<T, N> dual(primal);
+        if constexpr (N == Dynamic)
+            dual._tangent.assign(size, T(0));
+        assert(index < dual._tangent.size());
+        dual._tangent[index] = 1;
+        return dual;
+    }
 
     T primal() const { return _primal; }
-    T tangent() const { return _tangent; }
     T value() const { return primal(); }
-    T grad() const { return tangent(); }
+
+    // The tangent of a Dual with a single tangent is returned as a scalar.
+    decltype(auto) tangent() const {
+        if constexpr (N == 1)
+            return _tangent[0];
+        else
+            return static_cast<const Tangent&>(_tangent);
+    }
+    decltype(auto) grad() const { return tangent(); }
+
+    T tangent(std::size_t index) const { return index < _tangent.size() ? _tangent[index] : T(0); }
+    const Tangent& tangents() const { return _tangent; }
+    std::size_t size() const { return _tangent.size(); }
+
+
+    ///////////////////////////////////////////////////////////////////////////
+    ///                         TANGENT OPERATIONS                          ///
+    ///////////////////////////////////////////////////////////////////////////
+
+    // Applies `fn` elementwise to the tangents `t` of an operand.
+    template<typename A, typename Fn>
+    static Tangent map(const A& t, Fn fn) {
+        Tangent out;
+        if constexpr (N == Dynamic)
+            out.resize(t.size());
+        const std::size_t size = out.size();
+        for (std::size_t i = 0; i < size; ++i)
+            out[i] = fn(t[i]);
+        return out;
+    }
+
+    // Applies `fn` elementwise to the tangents `lhs` and `rhs` of two operands.
+    // Dynamic tangents of a constant are empty and treated as zeros.
+    template<typename A, typename B, typename Fn>
+    static Tangent zip(const A& lhs, const B& rhs, Fn fn) {
+        if constexpr (N == Dynamic) {
+            using LhsType = typename A::value_type;
+            using RhsType = typename B::value_type;
+            if (rhs.empty())
+                return map(lhs, [&](LhsType l) { return fn(l, RhsType(0)); });
+            if (lhs.empty())
+                return map(rhs, [&](RhsType r) { return fn(LhsType(0), r); });
+            assert(lhs.size() == rhs.size() && "Duals have a different number of tangents");
+        }
+        Tangent out;
+        if constexpr (N == Dynamic)
+            out.resize(lhs.size());
+        const std::size_t size = out.size();
+        for (std::size_t i = 0; i < size; ++i)
+            out[i] = fn(lhs[i], rhs[i]);
+        return out;
+    }
+
+
+    // Accumulates in place, e.g. gradients of a `Variable<Dual<T>>`.
+    Dual& operator+=(const Dual& other) {
+        _primal += other._primal;
+        if constexpr (N == Dynamic) {
+            if (other._tangent.empty())
+                return *this;
+            if (_tangent.empty())
+                _tangent.assign(other._tangent.size(), T(0));
+            assert(_tangent.size() == other._tangent.size() && "Duals have a different number of tangents");
+        }
+        for (std::size_t i = 0; i < _tangent.size(); ++i)
+            _tangent[i] += other._tangent[i];
+        return *this;
+    }
 
 
     ///////////////////////////////////////////////////////////////////////////
     ///                          UNARY OPERATIONS                           ///
     ///////////////////////////////////////////////////////////////////////////
 
-    Dual<typename std::common_type<T, decltype(-std::declval<T>())>::type> negate() const {
+    Dual<typename std::common_type<T, decltype(-std::declval<T>())>::type, N> negate() const {
         using PromotedType = typename std::common_type<T, decltype(-std::declval<T>())>::type;
         PromotedType p = static_cast<PromotedType>(_primal);
-        PromotedType t = static_cast<PromotedType>(_tangent);
 
-        return Dual<PromotedType>(-p, -t);
+        return Dual<PromotedType, N>(-p, Dual<PromotedType, N>::map(_tangent, [](T t) { return -static_cast<PromotedType>(t); }));
     }
 
-    Dual<typename std::common_type<T, decltype(-1. / std::declval<T>())>::type> reciprocal() const {
+    Dual<typename std::common_type<T, decltype(-1. / std::declval<T>())>::type, N> reciprocal() const {
         using PromotedType = typename std::common_type<T, decltype(-1. / std::declval<T>())>::type;
         PromotedType p = static_cast<PromotedType>(_primal);
-        PromotedType t = static_cast<PromotedType>(_tangent);
 
-        return Dual<PromotedType>(1 / p, -1 / (p * p) * t);
+        PromotedType d = -1 / (p * p);
+        return Dual<PromotedType, N>(1 / p, Dual<PromotedType, N>::map(_tangent, [d](T t) { return d * static_cast<PromotedType>(t); }));
     }
 
-    Dual<typename std::common_type<T, decltype(-std::declval<T>())>::type> abs() const {
+    Dual<typename std::common_type<T, decltype(-std::declval<T>())>::type, N> abs() const {
         using PromotedType = typename std::common_type<T, decltype(-std::declval<T>())>::type;
         PromotedType p = static_cast<PromotedType>(_primal);
-        PromotedType t = static_cast<PromotedType>(_tangent);
 
         PromotedType sign = p > 0 ? 1 : p < 0 ? -1 : 0;
-        return Dual<PromotedType>(std::abs(p), t * sign);
+        return Dual<PromotedType, N>(std::abs(p), Dual<PromotedType, N>::map(_tangent, [sign](T t) { return static_cast<PromotedType>(t) * sign; }));
     }
 
-    Dual<T> log() const {
-        return Dual<T>(std::log(_primal), 1 / _primal * _tangent);
+    Dual<T, N> log() const {
+        T d = 1 / _primal;
+        return Dual<T, N>(std::log(_primal), map(_tangent, [d](T t) { return d * t; }));
     }
 
-    Dual<T> exp() const {
-        return Dual<T>(std::exp(_primal), std::exp(_primal) * _tangent);
+    Dual<T, N> exp() const {
+        T d = std::exp(_primal);
+        return Dual<T, N>(d, map(_tangent, [d](T t) { return d * t; }));
     }
 
-    Dual<T> sin() const {
-        return Dual<T>(std::sin(_primal), std::cos(_primal) * _tangent);
+    // sin and cos share one range reduction
+    Dual<T, N> sin() const {
+        const auto [s, c] = VectorMath::sincos(_primal);
+        T d = c;
+        return Dual<T, N>(s, map(_tangent, [d](T t) { return d * t; }));
     }
 
-    Dual<T> cos() const {
-        return Dual<T>(std::cos(_primal), -std::sin(_primal) * _tangent);
+    Dual<T, N> cos() const {
+        const auto [s, c] = VectorMath::sincos(_primal);
+        T d = -s;
+        return Dual<T, N>(c, map(_tangent, [d](T t) { return d * t; }));
     }
 
-    Dual<T> tan() const {
-        return Dual<T>(std::tan(_primal), 1/(std::cos(_primal) * std::cos(_primal))  * _tangent);
+    // d(tan(x))/dx = 1 + tan(x)^2, which needs no cos(x)
+    Dual<T, N> tan() const {
+        T primal = std::tan(_primal);
+        T d = 1 + primal * primal;
+        return Dual<T, N>(primal, map(_tangent, [d](T t) { return d * t; }));
     }
-
-    template<typename A>
-    friend Dual<A> operator-(const Dual<A>& val);
-
-    template<typename U>
-    friend std::ostream& operator<<(std::ostream& ios, const Dual<U>& dual);
-
-
-    ///////////////////////////////////////////////////////////////////////////
-    ///                          BINARY OPERATIONS                          ///
-    ///////////////////////////////////////////////////////////////////////////
-
-    template<typename A, class B>
-    friend Dual<typename std::common_type<A, B>::type> operator+(const Dual<A>& lhs, const Dual<B>& rhs);
-    template<typename A, class B>
-    friend Dual<typename std::common_type<A, B>::type> operator+(const Dual<A>& lhs, const B& rhs);
-    template<typename A, class B>
-    friend Dual<typename std::common_type<A, B>::type> operator+(const A& lhs, const Dual<B>& rhs);
-
-    template<typename A, class B>
-    friend Dual<typename std::common_type<A, B>::type> operator-(const Dual<A>& lhs, const Dual<B>& rhs);
-    template<typename A, class B>
-    friend Dual<typename std::common_type<A, B>::type> operator-(const Dual<A>& lhs, const B& rhs);
-    template<typename A, class B>
-    friend Dual<typename std::common_type<A, B>::type> operator-(const A& lhs, const Dual<B>& rhs);
-
-    template<typename A, class B>
-    friend Dual<typename std::common_type<A, B>::type> operator*(const Dual<A>& lhs, const Dual<B>& rhs);
-    template<typename A, class B>
-    friend Dual<typename std::common_type<A, B>::type> operator*(const Dual<A>& lhs, const B& rhs);
-    template<typename A, class B>
-    friend Dual<typename std::common_type<A, B>::type> operator*(const A& lhs, const Dual<B>& rhs);
-
-    template<typename A, class B>
-    friend Dual<typename std::common_type<A, B>::type> operator/(const Dual<A>& lhs, const Dual<B>& rhs);
-    template<typename A, class B>
-    friend Dual<typename std::common_type<A, B>::type> operator/(const Dual<A>& lhs, const B& rhs);
-    template<typename A, class B>
-    friend Dual<typename std::common_type<A, B>::type> operator/(const A& lhs, const Dual<B>& rhs);
-
 };
 
 
 
-template<typename A>
-Dual<A> operator-(const Dual<A>& val) {
-    return Dual<A>(-val._primal, -val._tangent);
+template<typename A, std::size_t N>
+Dual<A, N> operator-(const Dual<A, N>& val) {
+    return Dual<A, N>(-val.primal(), Dual<A, N>::map(val.tangents(), [](A t) { return -t; }));
 }
 
 
 
-template<typename A, class B>
-Dual<typename std::common_type<A, B>::type> operator+(const Dual<A>& lhs, const Dual<B>& rhs) {
+///////////////////////////////////////////////////////////////////////////
+///                          BINARY OPERATIONS                          ///
+///////////////////////////////////////////////////////////////////////////
+
+// The overloads with a scalar operand only accept scalars convertible to the
+// primal type and never materialise the scalar as a Dual, since its tangents
+// are zero.
+
+template<typename A, class B, std::size_t N>
+Dual<typename std::common_type<A, B>::type, N> operator+(const Dual<A, N>& lhs, const Dual<B, N>& rhs) {
     using X = typename std::common_type<A, B>::type;
-    return Dual<X>(lhs._primal + rhs._primal, 1 * lhs._tangent + 1 * rhs._tangent);
+    return Dual<X, N>(lhs.primal() + rhs.primal(), Dual<X, N>::zip(lhs.tangents(), rhs.tangents(), [](A l, B r) { return 1 * l + 1 * r; }));
 }
 
-template<typename A, class B>
-Dual<typename std::common_type<A, B>::type> operator+(const Dual<A>& lhs, const B& rhs) {
-    return lhs + Dual<B>(rhs, 0);
+template<typename A, class B, std::size_t N> requires std::is_convertible_v<B, A>
+Dual<typename std::common_type<A, B>::type, N> operator+(const Dual<A, N>& lhs, const B& rhs) {
+    using X = typename std::common_type<A, B>::type;
+    return Dual<X, N>(lhs.primal() + rhs, Dual<X, N>::map(lhs.tangents(), [](A l) { return static_cast<X>(l); }));
 }
 
-template<typename A, class B>
-Dual<typename std::common_type<A, B>::type> operator+(const A& lhs, const Dual<B>& rhs) {
-    return Dual<A>(lhs, 0) + rhs;
+template<typename A, class B, std::size_t N> requires std::is_convertible_v<A, B>
+Dual<typename std::common_type<A, B>::type, N> operator+(const A& lhs, const Dual<B, N>& rhs) {
+    return rhs + lhs;
 }
 
 
 
-template<typename A, class B>
-Dual<typename std::common_type<A, B>::type> operator-(const Dual<A>& lhs, const Dual<B>& rhs) {
+template<typename A, class B, std::size_t N>
+Dual<typename std::common_type<A, B>::type, N> operator-(const Dual<A, N>& lhs, const Dual<B, N>& rhs) {
     return lhs + rhs.negate();
 }
 
-template<typename A, class B>
-Dual<typename std::common_type<A, B>::type> operator-(const Dual<A>& lhs, const B& rhs) {
-    return lhs - Dual<B>(rhs, 0);
+template<typename A, class B, std::size_t N> requires std::is_convertible_v<B, A>
+Dual<typename std::common_type<A, B>::type, N> operator-(const Dual<A, N>& lhs, const B& rhs) {
+    return lhs + (-rhs);
 }
 
-template<typename A, class B>
-Dual<typename std::common_type<A, B>::type> operator-(const A& lhs, const Dual<B>& rhs) {
-    return Dual<A>(lhs, 0) - rhs;
+template<typename A, class B, std::size_t N> requires std::is_convertible_v<A, B>
+Dual<typename std::common_type<A, B>::type, N> operator-(const A& lhs, const Dual<B, N>& rhs) {
+    return rhs.negate() + lhs;
 }
 
 
 
-template<typename A, class B>
-Dual<typename std::common_type<A, B>::type> operator*(const Dual<A>& lhs, const Dual<B>& rhs) {
+template<typename A, class B, std::size_t N>
+Dual<typename std::common_type<A, B>::type, N> operator*(const Dual<A, N>& lhs, const Dual<B, N>& rhs) {
     using X = typename std::common_type<A, B>::type;
     // Dual(a * b, da/dx * b + a * db/dx)
-    return Dual<X>(lhs._primal * rhs._primal, lhs._tangent * rhs._primal + lhs._primal * rhs._tangent);
+    X lp = lhs.primal(), rp = rhs.primal();
+    return Dual<X, N>(lp * rp, Dual<X, N>::zip(lhs.tangents(), rhs.tangents(), [lp, rp](A l, B r) { return l * rp + lp * r; }));
 }
 
-template<typename A, class B>
-Dual<typename std::common_type<A, B>::type> operator*(const Dual<A>& lhs, const B& rhs) {
-    return lhs * Dual<B>(rhs, 0);
+template<typename A, class B, std::size_t N> requires std::is_convertible_v<B, A>
+Dual<typename std::common_type<A, B>::type, N> operator*(const Dual<A, N>& lhs, const B& rhs) {
+    using X = typename std::common_type<A, B>::type;
+    X r = rhs;
+    return Dual<X, N>(lhs.primal() * r, Dual<X, N>::map(lhs.tangents(), [r](A l) { return l * r; }));
 }
 
-template<typename A, class B>
-Dual<typename std::common_type<A, B>::type> operator*(const A& lhs, const Dual<B>& rhs) {
-    return Dual<A>(lhs, 0) * rhs;
+template<typename A, class B, std::size_t N> requires std::is_convertible_v<A, B>
+Dual<typename std::common_type<A, B>::type, N> operator*(const A& lhs, const Dual<B, N>& rhs) {
+    using X = typename std::common_type<A, B>::type;
+    X l = lhs;
+    return Dual<X, N>(l * rhs.primal(), Dual<X, N>::map(rhs.tangents(), [l](B r) { return l * r; }));
 }
 
 
 
-template<typename A, class B>
-Dual<typename std::common_type<A, B>::type> operator/(const Dual<A>& lhs, const Dual<B>& rhs) {
+template<typename A, class B, std::size_t N>
+Dual<typename std::common_type<A, B>::type, N> operator/(const Dual<A, N>& lhs, const Dual<B, N>& rhs) {
     using X = typename std::common_type<A, B>::type;
     // Dual(a / b, (da/dx * b - a * db/dx) / b²)
-    return Dual<X>(lhs._primal / rhs._primal, (lhs._tangent * rhs._primal - lhs._primal * rhs._tangent) / (rhs._primal * rhs._primal));  
+    X lp = lhs.primal(), rp = rhs.primal();
+    X rp2 = rp * rp;
+    return Dual<X, N>(lp / rp, Dual<X, N>::zip(lhs.tangents(), rhs.tangents(), [lp, rp, rp2](A l, B r) { return (l * rp - lp * r) / rp2; }));
     // Dual(a * 1/b, (da/dx * 1/b - a * 1/b² * db/dx))
     // return lhs * rhs.reciprocal();
 }
 
-template<typename A, class B>
-Dual<typename std::common_type<A, B>::type> operator/(const Dual<A>& lhs, const B& rhs) {
-    return lhs / Dual<B>(rhs, 0);
+template<typename A, class B, std::size_t N> requires std::is_convertible_v<B, A>
+Dual<typename std::common_type<A, B>::type, N> operator/(const Dual<A, N>& lhs, const B& rhs) {
+    using X = typename std::common_type<A, B>::type;
+    X r = rhs;
+    return Dual<X, N>(lhs.primal() / r, Dual<X, N>::map(lhs.tangents(), [r](A l) { return l / r; }));
 }
 
-template<typename A, class B>
-Dual<typename std::common_type<A, B>::type> operator/(const A& lhs, const Dual<B>& rhs) {
-    return Dual<A>(lhs, 0) / rhs;
+template<typename A, class B, std::size_t N> requires std::is_convertible_v<A, B>
+Dual<typename std::common_type<A, B>::type, N> operator/(const A& lhs, const Dual<B, N>& rhs) {
+    using X = typename std::common_type<A, B>::type;
+    // Dual(a / b, -a * db/dx / b²)
+    X l = lhs, rp = rhs.primal();
+    X rp2 = rp * rp;
+    return Dual<X, N>(l / rp, Dual<X, N>::map(rhs.tangents(), [l, rp2](B r) { return -l * r / rp2; }));
 }
 
 
 ///////////////////////////////////////////////////////////////////////////
-///                              PRINTING                               ///
+///                             COMPARISONS                             ///
 ///////////////////////////////////////////////////////////////////////////
 
-template<typename T>
-struct std::formatter<Dual<T>> : std::formatter<std::string> {
-    auto format(const Dual<T>& dual, format_context& ctx) const {
+// Duals are ordered by their primals, so that functions which branch on
+// values (e.g. `if (x < 0)`) take the same branch as on plain scalars.
 
-        if constexpr (std::is_floating_point_v<T>) {
-            return formatter<string>::format(
-                std::format("Dual({:.12}, {:.12})", dual.primal(), dual.tangent()), ctx
-            );
-        }
-        else {
-            return formatter<string>::format(
-                std::format("Dual({}, {})", dual.primal(), dual.tangent()), ctx
-            );
+template<typename A, class B, std::size_t N>
+auto operator<=>(const Dual<A, N>& lhs, const Dual<B, N>& rhs) {
+    return lhs.primal() <=> rhs.primal();
+}
+
+template<typename A, class B, std::size_t N> requires std::is_convertible_v<B, A>
+auto operator<=>(const Dual<A, N>& lhs, const B& rhs) {
+    return lhs.primal() <=> static_cast<A>(rhs);
+}
+
+
+///////////////////////////////////////////////////////////////////////////
+///                           VALUE FUNCTIONS                           ///
+///////////////////////////////////////////////////////////////////////////
+
+// The elementwise functions are found via argument dependent lookup, which
+// lets the operations of the OperatorRegistry call e.g. `exp(val)` on Duals,
+// i.e. a `Variable<Dual<T>>` differentiates its own derivatives.
+
+template<typename T, std::size_t N>
+auto abs(const Dual<T, N>& val) { return val.abs(); }
+
+template<typename T, std::size_t N>
+Dual<T, N> sign(const Dual<T, N>& val) { return Dual<T, N>(T((val.primal() > 0) - (val.primal() < 0))); }
+
+template<typename T, std::size_t N>
+Dual<T, N> exp(const Dual<T, N>& val) { return val.exp(); }
+
+template<typename T, std::size_t N>
+Dual<T, N> log(const Dual<T, N>& val) { return val.log(); }
+
+template<typename T, std::size_t N>
+Dual<T, N> sin(const Dual<T, N>& val) { return val.sin(); }
+
+template<typename T, std::size_t N>
+Dual<T, N> cos(const Dual<T, N>& val) { return val.cos(); }
+
+template<typename T, std::size_t N>
+Dual<T, N> tan(const Dual<T, N>& val) { return val.tan(); }
+
+
+///////////////////////////////////////////////////////////////////////////
+///                              PRINTING                               ///
+///////////////////////////////////////////////////////////////////////////
+
+template<typename T, std::size_t N>
+struct std::formatter<Dual<T, N>> : std::formatter<std::string> {
+    auto format(const Dual<T, N>& dual, format_context& ctx) const {
+        std::string tangent;
+        if constexpr (N == 1) {
+            tangent = format_value(dual.tangent());
+        } else {
+            tangent = "[";
+            for (std::size_t i = 0; i < dual.size(); ++i)
+                tangent += (i > 0 ? ", " : "") + format_value(dual.tangent(i));
+            tangent += "]";
         }
 
+        return formatter<string>::format(
+            std::format("Dual({}, {})", format_value(dual.primal()), tangent), ctx
+        );
+    }
+
+    static std::string format_value(const T& value) {
+        if constexpr (std::is_floating_point_v<T>)
+            return std::format("{:.12}", value);
+        else
+            return std::format("{}", value);
     }
 };
 
-template<typename T>
-std::ostream& operator<<(std::ostream& os, const Dual<T>& dual) {
+template<typename T, std::size_t N>
+std::ostream& operator<<(std::ostream& os, const Dual<T, N>& dual) {
     os << std::format("{}", dual);
     return os;
 }
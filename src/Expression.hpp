@@ -0,0 +1,263 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <utility>
+#include <type_traits>
+
+#include "Variable.hpp"
+#include "OperatorRegistry.hpp"
+
+
+
+// Expression templates are a compile-time alternative to the computational
+// graph of Variables: an expression like `a.log() + a * b - b.sin()` is not
+// evaluated right away, but builds a tree of operations whose structure is
+// part of its type, e.g. `BinaryExpression<Sub, BinaryExpression<Add, ...>,
+// UnaryExpression<Sin, Argument<T, 1>>>`. Evaluating the tree computes the
+// value in a forward pass and the gradient in a reverse pass, using the
+// forward and backward rules of the OperatorRegistry. Since both passes are
+// ordinary recursive function calls on the types of the tree, the compiler
+// inlines them into straight-line code, which neither allocates nor
+// dispatches on op codes.
+//
+// Expressions only cover functions whose structure does not depend on values,
+// and subexpressions that are used more than once are evaluated once per use.
+// They are meant for small, hot kernels, that are written as generic lambdas
+// and can be used with Variables as well (see `as_variable()`).
+//
+// Example:
+//      auto [value, grad] = value_and_grad([](auto a, auto b) { return a.log() + a * b - b.sin(); }, 2.0, 5.0);
+
+
+// Base of all expressions, which provides the unary operations.
+template<typename Derived>
+struct Expression {
+    const Derived& derived() const { return static_cast<const Derived&>(*this); }
+
+    template<typename Op>
+    auto apply(const Op& op) const;
+
+    auto reciprocal() const { return apply(OperatorRegistry::Reciprocal{}); }
+    auto abs() const { return apply(OperatorRegistry::Abs{}); }
+    auto exp() const { return apply(OperatorRegistry::Exp{}); }
+    auto log() const { return apply(OperatorRegistry::Log{}); }
+    auto sin() const { return apply(OperatorRegistry::Sin{}); }
+    auto cos() const { return apply(OperatorRegistry::Cos{}); }
+    auto tan() const { return apply(OperatorRegistry::Tan{}); }
+};
+
+template<typename E>
+concept IsExpression = std::is_base_of_v<Expression<std::decay_t<E>>, std::decay_t<E>>;
+
+
+// Every expression caches its value (and the values its operation saves)
+// during `forward()`, which `backward()` uses to propagate the adjoint (i.e.
+// the gradient w.r.t. the expression) to its arguments, whose gradients are
+// accumulated in `grads`.
+
+// The argument `I` of the function that is differentiated.
+template<typename T, std::size_t I>
+struct Argument : Expression<Argument<T, I>> {
+    using value_type = T;
+
+    T value;
+
+    Argument(T value) : value(value) {}
+
+    T forward() { return value; }
+
+    template<std::size_t N>
+    void backward(const T& adjoint, std::array<T, N>& grads) const {
+        grads[I] += adjoint;
+    }
+};
+
+template<typename Op, typename E>
+struct UnaryExpression : Expression<UnaryExpression<Op, E>> {
+    using value_type = typename E::value_type;
+
+    Op op;
+    E expr;
+    value_type value{};
+    std::array<value_type, 2> saved{}; // see `OperatorRegistry::stored_of()`
+
+    UnaryExpression(const Op& op, const E& expr) : op(op), expr(expr) {}
+
+    value_type forward() {
+        const value_type val = expr.forward();
+        value = op(val);
+        if constexpr (requires { op.save(val, value); })
+            saved = op.save(val, value);
+        return value;
+    }
+
+    template<std::size_t N>
+    void backward(const value_type& adjoint, std::array<value_type, N>& grads) const {
+        expr.backward(OperatorRegistry::unary_backward_value(op, expr.value, value, &saved, adjoint), grads);
+    }
+};
+
+template<typename Op, typename L, typename R>
+struct BinaryExpression : Expression<BinaryExpression<Op, L, R>> {
+    using value_type = typename L::value_type;
+    static_assert(std::is_same_v<value_type, typename R::value_type>, "operands have different value types");
+
+    Op op;
+    L lhs;
+    R rhs;
+    value_type value{};
+
+    BinaryExpression(const Op& op, const L& lhs, const R& rhs) : op(op), lhs(lhs), rhs(rhs) {}
+
+    value_type forward() { return value = op(lhs.forward(), rhs.forward()); }
+
+    template<std::size_t N>
+    void backward(const value_type& adjoint, std::array<value_type, N>& grads) const {
+        auto [lhs_grad, rhs_grad] = op.backward_value(lhs.value, rhs.value, adjoint);
+        lhs.backward(lhs_grad, grads);
+        rhs.backward(rhs_grad, grads);
+    }
+};
+
+template<typename Derived>
+template<typename Op>
+auto Expression<Derived>::apply(const Op& op) const {
+    return UnaryExpression<Op, Derived>(op, derived());
+}
+
+
+///////////////////////////////////////////////////////////////////////////
+///                          BINARY OPERATIONS                          ///
+///////////////////////////////////////////////////////////////////////////
+
+// Like for Variables, constants are stored inline in scalar operations.
+
+template<IsExpression E>
+auto operator-(const E& expr) {
+    return expr.apply(OperatorRegistry::Neg{});
+}
+
+template<IsExpression L, IsExpression R>
+auto operator+(const L& lhs, const R& rhs) {
+    return BinaryExpression<OperatorRegistry::Add, L, R>({}, lhs, rhs);
+}
+
+template<IsExpression E>
+auto operator+(const E& lhs, const typename E::value_type& rhs) {
+    return lhs.apply(OperatorRegistry::Shift<typename E::value_type>{rhs});
+}
+
+template<IsExpression E>
+auto operator+(const typename E::value_type& lhs, const E& rhs) {
+    return rhs.apply(OperatorRegistry::Shift<typename E::value_type>{lhs});
+}
+
+
+
+template<IsExpression L, IsExpression R>
+auto operator-(const L& lhs, const R& rhs) {
+    return BinaryExpression<OperatorRegistry::Sub, L, R>({}, lhs, rhs);
+}
+
+template<IsExpression E>
+auto operator-(const E& lhs, const typename E::value_type& rhs) {
+    return lhs.apply(OperatorRegistry::Shift<typename E::value_type>{-rhs});
+}
+
+template<IsExpression E>
+auto operator-(const typename E::value_type& lhs, const E& rhs) {
+    using T = typename E::value_type;
+    return rhs.apply(OperatorRegistry::Affine<T>{static_cast<T>(-1), lhs});
+}
+
+
+
+template<IsExpression L, IsExpression R>
+auto operator*(const L& lhs, const R& rhs) {
+    return BinaryExpression<OperatorRegistry::Mul, L, R>({}, lhs, rhs);
+}
+
+template<IsExpression E>
+auto operator*(const E& lhs, const typename E::value_type& rhs) {
+    return lhs.apply(OperatorRegistry::Scale<typename E::value_type>{rhs});
+}
+
+template<IsExpression E>
+auto operator*(const typename E::value_type& lhs, const E& rhs) {
+    return rhs.apply(OperatorRegistry::Scale<typename E::value_type>{lhs});
+}
+
+
+
+template<IsExpression L, IsExpression R>
+auto operator/(const L& lhs, const R& rhs) {
+    return BinaryExpression<OperatorRegistry::Div, L, R>({}, lhs, rhs);
+}
+
+template<IsExpression E>
+auto operator/(const E& lhs, const typename E::value_type& rhs) {
+    return lhs.apply(OperatorRegistry::DivScalar<typename E::value_type>{rhs});
+}
+
+template<IsExpression E>
+auto operator/(const typename E::value_type& lhs, const E& rhs) {
+    return rhs.apply(OperatorRegistry::RDivScalar<typename E::value_type>{lhs});
+}
+
+
+///////////////////////////////////////////////////////////////////////////
+///                             EVALUATION                              ///
+///////////////////////////////////////////////////////////////////////////
+
+// Calls `fn` with one Argument per value in `args`, and returns the value of
+// the resulting expression together with its gradient w.r.t. all arguments.
+template<typename T, typename Fn, typename... Args>
+std::pair<T, std::array<T, sizeof...(Args)>> value_and_grad(Fn&& fn, const Args&... args) {
+    return [&]<std::size_t... I>(std::index_sequence<I...>) {
+        auto expr = fn(Argument<T, I>(static_cast<T>(args))...);
+        std::array<T, sizeof...(Args)> grads{};
+        T value = expr.forward();
+        expr.backward(static_cast<T>(1), grads);
+        return std::pair{value, grads};
+    }(std::index_sequence_for<Args...>{});
+}
+
+template<typename Fn, typename T, typename... Args>
+    requires std::is_arithmetic_v<T>
+std::pair<T, std::array<T, 1 + sizeof...(Args)>> value_and_grad(Fn&& fn, const T& arg, const Args&... args) {
+    return value_and_grad<T>(std::forward<Fn>(fn), arg, args...);
+}
+
+
+// Evaluates `fn` as an expression at the values of `vars` and returns its
+// value as a Variable, which is connected to those `vars` that require a
+// gradient. For n such arguments, the whole expression only adds n Scale
+// nodes, n - 1 Add nodes and one output node to the computational graph
+// instead of one node per operation. The partial
+// derivatives w.r.t. the arguments are computed right away and stored as
+// constants of these nodes, thus gradients flow back through them, but
+// higher order derivatives (`create_graph=true`) treat them as constants.
+template<typename Fn, typename T, typename... Vars>
+Variable<T> as_variable(Fn&& fn, const Variable<T>& var, const Vars&... vars) {
+    const std::array<Variable<T>, 1 + sizeof...(Vars)> args{var, vars...};
+    auto [value, grads] = value_and_grad<T>(std::forward<Fn>(fn), var.value(), vars.value()...);
+
+    // sum of the arguments weighted by their partial derivatives
+    Variable<T> linear;
+    for (std::size_t i = 0; i < args.size(); ++i) {
+        if (!args[i].requires_grad())
+            continue;
+        Variable<T> term = args[i] * grads[i];
+        linear = linear.variable() ? linear + term : term;
+    }
+    if (!linear.variable())
+        return Variable<T>(value);
+
+    // The value of the linearization differs from the value of the
+    // expression, thus the output shifts it by the difference, so that the
+    // node is `linear + offset` like any other Shift (e.g. for fusion, graph
+    // optimization and CompiledFunction). Its value is kept exact.
+    Variable<T> out = unary_operation(linear, OperatorRegistry::Shift<T>{value - linear.value()});
+    out.variable()->set_value(value);
+    return out;
+}
@@ -0,0 +1,259 @@
+#pragma once
+#include <span>
+#include <array>
+#include <memory>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <utility>
+#include <algorithm>
+#include <type_traits>
+#include <unordered_map>
+#include <functional>
+
+#include "Variable.hpp"
+#include "OperatorRegistry.hpp"
+
+
+
+// Optimization of a retained computational graph in place. Graphs built by
+// real code carry waste, especially the graphs of gradients that are built
+// with `create_graph=true`: products with the gradient seed `1`, repeated
+// subexpressions like the `x.cos()` of the backward functions of two
+// `x.sin()`, or `-(-g)`. `optimize_graph()` visits the nodes of the graph of
+// a root once, parents before children, and rewrites them:
+//
+//  - constant folding: parents that are constants (the seeds of gradients
+//    and nodes whose graph has been released, see `is_constant()`) are folded
+//    into the scalar operations that Variable operators use for constants,
+//    e.g. `x * seed` becomes `Scale(x, 1)`, and nodes whose parents are all
+//    constant become constants themselves
+//  - algebraic simplification: `x * 1`, `x / 1`, `x + 0` and `-(-x)` are
+//    replaced by `x` (identities with constants are only detected for
+//    arithmetic value types)
+//  - common subexpression elimination: nodes with the same operation, the
+//    same parents and the same constants are merged into one
+//  - dead node elimination: replaced nodes are unlinked from their children,
+//    thus the root no longer keeps them alive, and weak pointers to children
+//    that have been destroyed (e.g. unused temporaries) or that have been
+//    rewired are pruned
+//
+// The values of all nodes stay the same, only backward passes over the
+// optimized graph visit fewer nodes. Rewritten nodes that are also held by
+// other Variables still compute the same gradients. The root itself is never
+// replaced. CompiledFunction optimizes the captured graph before freezing it.
+//
+// Example:
+//      y.backward(1, true, true);   // builds the graph of dy/dx
+//      Variable<double> dy_dx = x.grad().value();
+//      GraphOptimizationStats stats = optimize_graph(dy_dx);
+//      x.zero_grad();
+//      dy_dx.backward();
+struct GraphOptimizationStats {
+    std::size_t folded = 0;             // nodes whose constant parents were folded
+    std::size_t simplified = 0;         // identities replaced by their input
+    std::size_t merged = 0;             // common subexpressions merged
+    std::size_t pruned_children = 0;    // weak pointers to destroyed or rewired children
+
+    std::size_t removed() const { return simplified + merged; }
+};
+
+
+namespace GraphOptimization {
+
+    using OpCode = OperatorRegistry::OpCode;
+
+    template<typename T>
+    using NodePtr = std::shared_ptr<VariableImpl<T>>;
+
+    // Nodes whose value is fixed w.r.t. the backward pass: nodes that do not
+    // require a gradient, and non-leaf nodes without an operation, i.e. the
+    // seeds of gradients (`create_graph=true`) and nodes whose graph has been
+    // released by a backward pass.
+    template<typename T>
+    bool is_constant(const VariableImpl<T>& node) {
+        return !node.requires_grad() || (node.op() == OpCode::Leaf && !node.is_leaf());
+    }
+
+    // Folds constant parents into the operation of `node`, like the Variable
+    // operators do for operands that do not require a gradient. Returns
+    // whether `node` has been rewritten.
+    template<typename T>
+    bool fold_constants(VariableImpl<T>& node) {
+        const auto parents = node.parents();
+        const bool lhs_constant = is_constant(*parents[0]);
+        const bool rhs_constant = parents.size() > 1 && is_constant(*parents[1]);
+        if (lhs_constant && (parents.size() == 1 || rhs_constant)) {
+            node.set_parents({});
+            node.set_op(OpCode::Leaf);
+            return true;
+        }
+        if (!lhs_constant && !rhs_constant)
+            return false;
+
+        const NodePtr<T> var = parents[lhs_constant ? 1 : 0];
+        const T constant = parents[lhs_constant ? 0 : 1]->value();
+        switch (node.op()) {
+            case OpCode::Add:
+                node.set_op(OpCode::Shift, {constant});
+                break;
+            case OpCode::Sub:
+                if (lhs_constant)
+                    node.set_op(OpCode::Affine, {static_cast<T>(-1), constant});
+                else
+                    node.set_op(OpCode::Shift, {-constant});
+                break;
+            case OpCode::Mul:
+                node.set_op(OpCode::Scale, {constant});
+                break;
+            case OpCode::Div:
+                node.set_op(lhs_constant ? OpCode::RDivScalar : OpCode::DivScalar, {constant});
+                break;
+            default:
+                return false;
+        }
+        node.set_parents(std::span<const NodePtr<T>>(&var, 1));
+        return true;
+    }
+
+    // Returns the input that `node` is equal to, if its operation is an
+    // identity, otherwise nullptr.
+    template<typename T>
+    const VariableImpl<T>* identity_input(const VariableImpl<T>& node) {
+        const auto parents = node.parents();
+        if (node.op() == OpCode::Neg && parents[0]->op() == OpCode::Neg)
+            return parents[0]->parents()[0].get();
+        if constexpr (std::is_arithmetic_v<T>) {
+            const auto& [a, b] = node.constants();
+            switch (node.op()) {
+                case OpCode::Shift:
+                    return a == T(0) ? parents[0].get() : nullptr;
+                case OpCode::Scale:
+                case OpCode::DivScalar:
+                    return a == T(1) ? parents[0].get() : nullptr;
+                case OpCode::Affine:
+                    return a == T(1) && b == T(0) ? parents[0].get() : nullptr;
+                default:
+                    break;
+            }
+        }
+        return nullptr;
+    }
+
+    // Identifies the expression of a node by its operation, parents and
+    // constants. Constants can only be compared for arithmetic value types.
+    template<typename T>
+    struct Expression {
+        using Constant = std::conditional_t<std::is_arithmetic_v<T>, T, bool>;
+
+        OpCode op;
+        const VariableImpl<T>* lhs;
+        const VariableImpl<T>* rhs;
+        std::array<Constant, 2> constants;
+
+        bool operator==(const Expression&) const = default;
+    };
+
+    template<typename T>
+    struct ExpressionHash {
+        std::size_t operator()(const Expression<T>& expression) const {
+            using Constant = typename Expression<T>::Constant;
+            std::size_t hash = static_cast<std::size_t>(expression.op);
+            auto combine = [&](std::size_t value) { hash ^= value + 0x9e3779b97f4a7c15 + (hash << 6) + (hash >> 2); };
+            combine(std::hash<const VariableImpl<T>*>{}(expression.lhs));
+            combine(std::hash<const VariableImpl<T>*>{}(expression.rhs));
+            combine(std::hash<Constant>{}(expression.constants[0]));
+            combine(std::hash<Constant>{}(expression.constants[1]));
+            return hash;
+        }
+    };
+
+    template<typename T>
+    std::optional<Expression<T>> expression_of(const VariableImpl<T>& node) {
+        if (node.op() == OpCode::Leaf || node.op() == OpCode::Fused || node.op() == OpCode::Custom)
+            return std::nullopt;
+        const auto parents = node.parents();
+        Expression<T> expression{node.op(), parents[0].get(), parents.size() > 1 ? parents[1].get() : nullptr, {}};
+        if (node.op() == OpCode::Add || node.op() == OpCode::Mul)
+            if (expression.rhs < expression.lhs)
+                std::swap(expression.lhs, expression.rhs);
+        if (OperatorRegistry::has_constants(node.op())) {
+            if constexpr (std::is_arithmetic_v<T>)
+                expression.constants = node.constants();
+            else
+                return std::nullopt;
+        }
+        return expression;
+    }
+
+} // namespace GraphOptimization
+
+
+// Optimizes the graph of `root` in place, see above.
+template<typename T>
+GraphOptimizationStats optimize_graph(const Variable<T>& root) {
+    using namespace GraphOptimization;
+    GraphOptimizationStats stats;
+    if (!root.requires_grad())
+        return stats;
+
+    // Nodes are only rewritten after all of their parents, thus the order of
+    // the original graph stays valid while it is rewritten. Nodes are
+    // referred to by their topological index.
+    const std::vector<NodePtr<T>> order = root.variable()->topological_order();
+    constexpr std::uint32_t none = std::numeric_limits<std::uint32_t>::max();
+    // the node that each node has been replaced by
+    std::vector<std::uint32_t> replacements(order.size(), none);
+    // nodes that are no longer the parent of some of their children
+    std::vector<bool> unlinked(order.size(), false);
+    std::unordered_map<GraphOptimization::Expression<T>, std::uint32_t, ExpressionHash<T>> expressions;
+    expressions.reserve(order.size());
+    for (std::uint32_t index = 0; index < order.size(); ++index) {
+        const NodePtr<T>& node = order[index];
+        if (node->parents().empty() || node->op() == OpCode::Custom)
+            continue;
+
+        const std::size_t num_parents = node->parents().size();
+        std::array<std::uint32_t, 2> parents{};
+        bool rewired = false;
+        for (std::size_t i = 0; i < num_parents; ++i) {
+            parents[i] = node->parents()[i]->topological_index();
+            if (replacements[parents[i]] != none) {
+                unlinked[parents[i]] = true;
+                parents[i] = replacements[parents[i]];
+                rewired = true;
+            }
+        }
+        if (rewired) {
+            const std::array<NodePtr<T>, 2> new_parents{order[parents[0]], num_parents > 1 ? order[parents[1]] : nullptr};
+            node->set_parents(std::span<const NodePtr<T>>(new_parents.data(), num_parents));
+            for (std::size_t i = 0; i < num_parents; ++i)
+                if (!new_parents[i]->is_child(node))
+                    new_parents[i]->add_child(node);
+        }
+
+        if (fold_constants(*node)) {
+            ++stats.folded;
+            for (std::size_t i = 0; i < num_parents; ++i)
+                unlinked[parents[i]] = true;
+        }
+        if (index + 1 == order.size() || node->parents().empty())
+            continue;
+        if (const VariableImpl<T>* input = identity_input(*node)) {
+            replacements[index] = input->topological_index();
+            ++stats.simplified;
+        } else if (std::optional<GraphOptimization::Expression<T>> expression = expression_of(*node)) {
+            auto [it, inserted] = expressions.try_emplace(*expression, index);
+            if (!inserted) {
+                replacements[index] = it->second;
+                ++stats.merged;
+            }
+        }
+    }
+
+    for (std::uint32_t index = 0; index < order.size(); ++index)
+        stats.pruned_children += order[index]->prune_children(unlinked[index]);
+    return stats;
+}
@@ -0,0 +1,195 @@
+#pragma once
+#include <memory>
+#include <optional>
+#include <vector>
+#include <format>
+#include <string>
+#include <cstddef>
+#include <ostream>
+#include <algorithm>
+#include <type_traits>
+#include <unordered_map>
+
+#include "Variable.hpp"
+#include "OperatorRegistry.hpp"
+
+
+
+// Memory accounting of a computational graph. The graph of a Variable consists
+// of all nodes that it keeps alive through parent pointers, i.e. exactly the
+// memory that a retained graph (`retain_graph=true`) pins until the Variable
+// goes out of scope.
+//
+// The bytes of a node are estimates of what it holds on the heap:
+//  - the node itself, which is allocated together with the control block of
+//    its shared_ptr (estimated as two pointers), and the operations of fused
+//    nodes or the backward function of custom nodes, which it allocates
+//    separately (the latter without a closure that does not fit into the
+//    std::function itself)
+//  - the vector of weak pointers to its children, by capacity
+//  - heap memory of its value and plain gradient (e.g. Tensor storage, which
+//    is counted for every value that shares it)
+//  - gradients that are part of another graph (`create_graph=true`) are
+//    counted as one node, without the graph behind them
+//
+// Example:
+//      GraphStats stats = graph_stats(loss);
+//      std::println("{}", stats);
+//      std::ofstream dot("graph.dot");
+//      write_dot(dot, loss);   // render with `dot -Tsvg graph.dot -o graph.svg`
+struct GraphStats {
+    std::size_t nodes = 0;
+    std::size_t leaves = 0;
+    std::size_t edges = 0;              // parent pointers
+    std::size_t depth = 0;              // longest path from the root to a leaf
+    std::size_t children = 0;           // weak pointers to children
+    std::size_t expired_children = 0;   // weak pointers to destroyed children
+    std::size_t node_bytes = 0;
+    std::size_t children_bytes = 0;
+    std::size_t value_bytes = 0;
+    std::size_t grad_bytes = 0;
+
+    std::size_t bytes() const { return node_bytes + children_bytes + value_bytes + grad_bytes; }
+};
+
+
+namespace GraphInspection {
+
+    constexpr std::size_t control_block_bytes = 2 * sizeof(void*);
+
+    // Calls `fn(node, height)` for every node of the graph of `root`, parents
+    // before children, where `height` is the length of the longest path from
+    // the node to a leaf.
+    template<typename T, typename Fn>
+    void for_each_node(const std::shared_ptr<VariableImpl<T>>& root, Fn&& fn) {
+        std::unordered_map<const VariableImpl<T>*, std::size_t> heights;
+        // post-order traversal with an explicit stack, where the flag marks
+        // nodes whose parents have already been pushed
+        std::vector<std::pair<const VariableImpl<T>*, bool>> stack{{root.get(), false}};
+        while (!stack.empty()) {
+            auto [node, expanded] = stack.back();
+            stack.pop_back();
+            if (heights.contains(node))
+                continue;
+            if (!expanded) {
+                stack.emplace_back(node, true);
+                for (const auto& parent : node->parents())
+                    if (!heights.contains(parent.get()))
+                        stack.emplace_back(parent.get(), false);
+                continue;
+            }
+            std::size_t height = 0;
+            for (const auto& parent : node->parents())
+                height = std::max(height, heights.at(parent.get()) + 1);
+            heights.emplace(node, height);
+            fn(*node, height);
+        }
+    }
+
+    template<typename T>
+    std::size_t value_bytes(const VariableImpl<T>& node) {
+        using OperatorRegistry::heap_bytes;
+        return heap_bytes(node.value());
+    }
+
+    template<typename T>
+    std::size_t grad_bytes(const VariableImpl<T>& node) {
+        using OperatorRegistry::heap_bytes;
+        std::optional<Variable<T>> grad = node.grad();
+        if (!grad)
+            return 0;
+        std::size_t bytes = heap_bytes(grad->value());
+        if (grad->requires_grad())
+            bytes += sizeof(VariableImpl<T>) + control_block_bytes;
+        return bytes;
+    }
+
+    // the separately allocated operation of a fused or custom node
+    template<typename T>
+    std::size_t operation_bytes(const VariableImpl<T>& node) {
+        using OperatorRegistry::heap_bytes;
+        if (const OperatorRegistry::FusedChain<T>* chain = node.fused_chain()) {
+            std::size_t bytes = sizeof(OperatorRegistry::FusedChain<T>);
+            for (std::size_t i = 0; i < chain->length; ++i)
+                bytes += heap_bytes(chain->steps[i].stored[0]) + heap_bytes(chain->steps[i].stored[1]);
+            return bytes;
+        }
+        if (node.op() == OperatorRegistry::OpCode::Custom)
+            return sizeof(typename VariableImpl<T>::CustomBackward);
+        return 0;
+    }
+
+    template<typename T>
+    std::size_t children_bytes(const VariableImpl<T>& node) {
+        return node.children().capacity() * sizeof(std::weak_ptr<VariableImpl<T>>);
+    }
+
+    template<typename T>
+    std::size_t node_bytes(const VariableImpl<T>& node) {
+        return sizeof(VariableImpl<T>) + control_block_bytes + operation_bytes(node) + children_bytes(node) + value_bytes(node) + grad_bytes(node);
+    }
+
+} // namespace GraphInspection
+
+
+// Walks the graph of `root` and sums up its nodes, edges and memory.
+template<typename T>
+GraphStats graph_stats(const Variable<T>& root) {
+    GraphStats stats;
+    GraphInspection::for_each_node(root.variable(), [&](const VariableImpl<T>& node, std::size_t height) {
+        ++stats.nodes;
+        stats.leaves += node.parents().empty();
+        stats.edges += node.parents().size();
+        stats.depth = std::max(stats.depth, height);
+        for (const auto& child : node.children()) {
+            ++stats.children;
+            stats.expired_children += child.expired();
+        }
+        stats.node_bytes += sizeof(VariableImpl<T>) + GraphInspection::control_block_bytes + GraphInspection::operation_bytes(node);
+        stats.children_bytes += GraphInspection::children_bytes(node);
+        stats.value_bytes += GraphInspection::value_bytes(node);
+        stats.grad_bytes += GraphInspection::grad_bytes(node);
+    });
+    return stats;
+}
+
+
+// Writes the graph of `root` in the Graphviz DOT format. Every node is labeled
+// with its operation, its value (or number of elements) and its bytes, edges
+// point from parents to children, i.e. in the direction of the forward pass.
+// Leaves are drawn as boxes, the root is drawn bold.
+template<typename T>
+void write_dot(std::ostream& out, const Variable<T>& root) {
+    out << "digraph autograd {\n";
+    out << "    node [shape=ellipse, fontname=\"monospace\"];\n";
+    GraphInspection::for_each_node(root.variable(), [&](const VariableImpl<T>& node, std::size_t) {
+        std::string value;
+        if constexpr (std::is_arithmetic_v<T>)
+            value = std::format("{:.6}", node.value());
+        else {
+            using OperatorRegistry::numel;
+            value = std::format("{} elements", numel(node.value()));
+        }
+        std::string style;
+        if (node.parents().empty())
+            style += ", shape=box";
+        if (&node == root.variable().get())
+            style += ", style=bold";
+        out << std::format("    n{} [label=\"{}\\n{}\\n{} B\"{}];\n",
+            static_cast<const void*>(&node), OperatorRegistry::name(node.op()), value, GraphInspection::node_bytes(node), style);
+        for (const auto& parent : node.parents())
+            out << std::format("    n{} -> n{};\n", static_cast<const void*>(parent.get()), static_cast<const void*>(&node));
+    });
+    out << "}\n";
+}
+
+
+template<>
+struct std::formatter<GraphStats> : std::formatter<std::string> {
+    auto format(const GraphStats& stats, format_context& ctx) const {
+        return std::format_to(ctx.out(),
+            "GraphStats(nodes={}, leaves={}, edges={}, depth={}, children={} ({} expired), bytes={} (nodes={}, children={}, values={}, grads={}))",
+            stats.nodes, stats.leaves, stats.edges, stats.depth, stats.children, stats.expired_children,
+            stats.bytes(), stats.node_bytes, stats.children_bytes, stats.value_bytes, stats.grad_bytes);
+    }
+};
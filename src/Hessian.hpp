@@ -0,0 +1,57 @@
+#pragma once
+#include <span>
+#include <vector>
+#include <cassert>
+#include <cstddef>
+#include <utility>
+
+#include "Variable.hpp"
+#include "Dual.hpp"
+
+
+
+// Hessian-vector products by forward-over-reverse differentiation: the inputs
+// are `Variable<Dual<T>>`s whose tangents are the direction `v`, thus every
+// value of the graph carries its directional derivative along `v`, and a
+// single first-order backward pass yields Duals whose primals are the
+// gradient and whose tangents are the directional derivative of the
+// gradient, i.e. the Hessian-vector product H(x) v.
+//
+// Compared to differentiating the graph of a gradient (`create_graph=true`),
+// the backward pass neither builds nor retains a second graph, each node only
+// stores a Dual instead of a plain value and each operation computes its
+// derivative along `v` alongside its value.
+//
+// `fn` is called with a span of Variables and has to return a scalar
+// Variable, e.g. a generic lambda that also works with `Variable<T>`.
+//
+// Example:
+//      auto [grad, hv] = grad_and_hvp([](auto x) { return (x[0] * x[1]).sin(); }, x, v);
+template<typename T, typename Fn>
+std::pair<std::vector<T>, std::vector<T>> grad_and_hvp(Fn&& fn, const std::vector<T>& x, const std::vector<T>& v) {
+    assert(x.size() == v.size() && "x and v have a different size");
+    std::vector<Variable<Dual<T>>> inputs;
+    inputs.reserve(x.size());
+    for (std::size_t i = 0; i < x.size(); ++i)
+        inputs.emplace_back(Dual<T>(x[i], v[i]), true);
+
+    Variable<Dual<T>> out = fn(std::span<const Variable<Dual<T>>>(inputs));
+    out.backward(Dual<T>(1, 0));
+
+    std::pair<std::vector<T>, std::vector<T>> result;
+    result.first.reserve(x.size());
+    result.second.reserve(x.size());
+    for (const auto& input : inputs) {
+        // inputs that `fn` does not use have no gradient
+        const Dual<T> grad = input.grad_value().value_or(Dual<T>(0, 0));
+        result.first.push_back(grad.primal());
+        result.second.push_back(grad.tangent());
+    }
+    return result;
+}
+
+// Returns the Hessian-vector product H(x) v of `fn`, see `grad_and_hvp()`.
+template<typename T, typename Fn>
+std::vector<T> hvp(Fn&& fn, const std::vector<T>& x, const std::vector<T>& v) {
+    return grad_and_hvp(std::forward<Fn>(fn), x, v).second;
+}
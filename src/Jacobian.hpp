@@ -0,0 +1,62 @@
+#pragma once
+#include <span>
+#include <array>
+#include <vector>
+#include <memory>
+#include <cstddef>
+
+#include "Variable.hpp"
+
+
+
+// Vector-Jacobian products of functions with several outputs. Instead of one
+// `backward()` call per output, each of which traverses the whole graph, the
+// vector-seeded backward pass (see `VariableImpl::backward_vector()`)
+// propagates K cotangents per node, thus K rows of the Jacobian are computed
+// in a single traversal. The graph is retained and the gradients of the
+// Variables are left untouched.
+//
+// Example:
+//      // J[i][j] = d outputs[i] / d inputs[j]
+//      std::vector<std::vector<double>> J = jacobian(outputs, inputs);
+
+
+// Returns `sum_j seeds[j][k] * d outputs[j] / d inputs[i]` for every input `i`
+// and every `k < K`.
+template<std::size_t K, typename T>
+std::vector<std::array<T, K>> vjp(std::span<const Variable<T>> outputs, std::span<const std::array<T, K>> seeds, std::span<const Variable<T>> inputs) {
+    std::vector<std::shared_ptr<VariableImpl<T>>> roots, leaves;
+    roots.reserve(outputs.size());
+    for (const auto& output : outputs)
+        roots.push_back(output.variable());
+    leaves.reserve(inputs.size());
+    for (const auto& input : inputs)
+        leaves.push_back(input.variable());
+    return VariableImpl<T>::template backward_vector<K>(roots, seeds, leaves);
+}
+
+
+// Returns the Jacobian `J[i][j] = d outputs[i] / d inputs[j]`. The rows are
+// computed `Width` at a time, i.e. with one traversal of the graph per
+// `Width` outputs instead of one per output.
+template<std::size_t Width = 8, typename T>
+std::vector<std::vector<T>> jacobian(std::span<const Variable<T>> outputs, std::span<const Variable<T>> inputs) {
+    std::vector<std::vector<T>> rows(outputs.size(), std::vector<T>(inputs.size(), T(0)));
+    std::vector<std::array<T, Width>> seeds(outputs.size());
+    for (std::size_t begin = 0; begin < outputs.size(); begin += Width) {
+        // the k-th cotangent selects the output `begin + k`
+        for (std::size_t j = 0; j < outputs.size(); ++j)
+            for (std::size_t k = 0; k < Width; ++k)
+                seeds[j][k] = T(j == begin + k);
+        const std::vector<std::array<T, Width>> products = vjp<Width>(outputs, std::span<const std::array<T, Width>>(seeds), inputs);
+        for (std::size_t k = 0; k < Width && begin + k < outputs.size(); ++k)
+            for (std::size_t j = 0; j < inputs.size(); ++j)
+                rows[begin + k][j] = products[j][k];
+    }
+    return rows;
+}
+
+template<std::size_t Width = 8, typename T>
+std::vector<std::vector<T>> jacobian(const std::vector<Variable<T>>& outputs, const std::vector<Variable<T>>& inputs) {
+    return jacobian<Width>(std::span<const Variable<T>>(outputs), std::span<const Variable<T>>(inputs));
+}
@@ -0,0 +1,347 @@
+#pragma once
+#include <array>
+#include <cmath>
+#include <string>
+#include <format>
+#include <compare>
+#include <utility>
+#include <cstddef>
+#include <ostream>
+#include <type_traits>
+
+
+// A Jet carries the truncated Taylor expansion of a value along one input
+// direction up to order K, i.e. the coefficients c_k = f^(k) / k! for
+// k = 0, ..., K. Every operation propagates all coefficients with the standard
+// recurrences of Taylor arithmetic (e.g. Griewank & Walther, Evaluating
+// Derivatives, chapter 13), which cost O(K²) per operation, thus a single
+// forward evaluation yields all derivatives up to order K, whereas nested
+// `backward(..., create_graph=true)` calls build a larger graph per order.
+// `Jet<T, 1>` computes the same derivatives as `Dual<T>`.
+//
+// Example:
+//      auto x = Jet<double, 3>::variable(2);
+//      auto out = x.log().cos() + x.log().exp();
+//      double d3 = out.derivative(3);
+template<typename T, std::size_t K>
+class Jet {
+public:
+    using Coefficients = std::array<T, K + 1>;
+
+private:
+    Coefficients _c;
+
+public:
+    // a constant, whose higher coefficients are zero
+    Jet(T value = 0) : _c() { _c[0] = value; }
+
+    Jet(const Coefficients& coefficients) : _c(coefficients) {}
+
+    // Returns the Jet of the input itself, i.e. with first derivative 1.
+    static Jet<T, K> variable(T value) {
+        Jet<T, K> jet(value);
+        if constexpr (K > 0)
+            jet._c[1] = 1;
+        return jet;
+    }
+
+    T value() const { return _c[0]; }
+    T primal() const { return value(); }
+    const Coefficients& coefficients() const { return _c; }
+    T coefficient(std::size_t k) const { return _c[k]; }
+
+    // Returns the k-th derivative, i.e. k! c_k.
+    T derivative(std::size_t k) const {
+        T factorial = 1;
+        for (std::size_t i = 2; i <= k; ++i)
+            factorial *= static_cast<T>(i);
+        return _c[k] * factorial;
+    }
+
+    // Accumulates in place, e.g. gradients of a `Variable<Jet<T, K>>`.
+    Jet& operator+=(const Jet& other) {
+        for (std::size_t k = 0; k <= K; ++k)
+            _c[k] += other._c[k];
+        return *this;
+    }
+
+
+    ///////////////////////////////////////////////////////////////////////////
+    ///                         TAYLOR ARITHMETIC                           ///
+    ///////////////////////////////////////////////////////////////////////////
+
+    // c_k = sum_{i=0}^{k} a_i b_{k-i}
+    static Coefficients product(const Coefficients& a, const Coefficients& b) {
+        Coefficients c{};
+        for (std::size_t k = 0; k <= K; ++k)
+            for (std::size_t i = 0; i <= k; ++i)
+                c[k] += a[i] * b[k - i];
+        return c;
+    }
+
+    // q = a / b: q_k = (a_k - sum_{i=1}^{k} b_i q_{k-i}) / b_0
+    static Coefficients quotient(const Coefficients& a, const Coefficients& b) {
+        Coefficients q;
+        for (std::size_t k = 0; k <= K; ++k) {
+            T sum = a[k];
+            for (std::size_t i = 1; i <= k; ++i)
+                sum -= b[i] * q[k - i];
+            q[k] = sum / b[0];
+        }
+        return q;
+    }
+
+    // Solves v' = u' w for v, i.e. v_k = 1/k sum_{j=1}^{k} j u_j w_{k-j},
+    // where `w(k)` returns w_k and may depend on v_0, ..., v_{k-1}.
+    template<typename W>
+    static void integrate(Coefficients& v, const Coefficients& u, W&& w) {
+        for (std::size_t k = 1; k <= K; ++k) {
+            T sum = 0;
+            for (std::size_t j = 1; j <= k; ++j)
+                sum += static_cast<T>(j) * u[j] * w(k - j);
+            v[k] = sum / static_cast<T>(k);
+        }
+    }
+
+
+    ///////////////////////////////////////////////////////////////////////////
+    ///                          UNARY OPERATIONS                           ///
+    ///////////////////////////////////////////////////////////////////////////
+
+    Jet<T, K> negate() const {
+        Coefficients c;
+        for (std::size_t k = 0; k <= K; ++k)
+            c[k] = -_c[k];
+        return Jet<T, K>(c);
+    }
+
+    Jet<T, K> reciprocal() const {
+        return Jet<T, K>(quotient(Jet<T, K>(1)._c, _c));
+    }
+
+    Jet<T, K> abs() const {
+        return _c[0] < 0 ? negate() : *this;
+    }
+
+    // e' = u' e
+    Jet<T, K> exp() const {
+        Coefficients e{};
+        e[0] = std::exp(_c[0]);
+        integrate(e, _c, [&](std::size_t i) { return e[i]; });
+        return Jet<T, K>(e);
+    }
+
+    // u = exp(l): l_k = (u_k - 1/k sum_{j=1}^{k-1} j l_j u_{k-j}) / u_0
+    Jet<T, K> log() const {
+        Coefficients l{};
+        l[0] = std::log(_c[0]);
+        for (std::size_t k = 1; k <= K; ++k) {
+            T sum = 0;
+            for (std::size_t j = 1; j < k; ++j)
+                sum += static_cast<T>(j) * l[j] * _c[k - j];
+            l[k] = (_c[k] - sum / static_cast<T>(k)) / _c[0];
+        }
+        return Jet<T, K>(l);
+    }
+
+    // s' = u' c and c' = -u' s, which are computed together
+    std::pair<Jet<T, K>, Jet<T, K>> sin_cos() const {
+        Coefficients s{}, c{};
+        s[0] = std::sin(_c[0]);
+        c[0] = std::cos(_c[0]);
+        for (std::size_t k = 1; k <= K; ++k) {
+            T sum_s = 0, sum_c = 0;
+            for (std::size_t j = 1; j <= k; ++j) {
+                sum_s += static_cast<T>(j) * _c[j] * c[k - j];
+                sum_c += static_cast<T>(j) * _c[j] * s[k - j];
+            }
+            s[k] = sum_s / static_cast<T>(k);
+            c[k] = -sum_c / static_cast<T>(k);
+        }
+        return {Jet<T, K>(s), Jet<T, K>(c)};
+    }
+
+    Jet<T, K> sin() const { return sin_cos().first; }
+
+    Jet<T, K> cos() const { return sin_cos().second; }
+
+    // t' = u' (1 + t²), where (1 + t²)_i only depends on t_0, ..., t_i
+    Jet<T, K> tan() const {
+        Coefficients t{};
+        t[0] = std::tan(_c[0]);
+        integrate(t, _c, [&](std::size_t i) {
+            T sum = i == 0 ? T(1) : T(0);
+            for (std::size_t j = 0; j <= i; ++j)
+                sum += t[j] * t[i - j];
+            return sum;
+        });
+        return Jet<T, K>(t);
+    }
+};
+
+
+
+template<typename T, std::size_t K>
+Jet<T, K> operator-(const Jet<T, K>& val) {
+    return val.negate();
+}
+
+
+
+///////////////////////////////////////////////////////////////////////////
+///                          BINARY OPERATIONS                          ///
+///////////////////////////////////////////////////////////////////////////
+
+// The overloads with a scalar operand only accept scalars convertible to the
+// value type and only update the coefficients they affect.
+
+template<typename T, std::size_t K>
+Jet<T, K> operator+(const Jet<T, K>& lhs, const Jet<T, K>& rhs) {
+    Jet<T, K> out = lhs;
+    out += rhs;
+    return out;
+}
+
+template<typename T, typename B, std::size_t K> requires std::is_convertible_v<B, T>
+Jet<T, K> operator+(const Jet<T, K>& lhs, const B& rhs) {
+    typename Jet<T, K>::Coefficients c = lhs.coefficients();
+    c[0] += static_cast<T>(rhs);
+    return Jet<T, K>(c);
+}
+
+template<typename T, typename A, std::size_t K> requires std::is_convertible_v<A, T>
+Jet<T, K> operator+(const A& lhs, const Jet<T, K>& rhs) {
+    return rhs + lhs;
+}
+
+
+
+template<typename T, std::size_t K>
+Jet<T, K> operator-(const Jet<T, K>& lhs, const Jet<T, K>& rhs) {
+    return lhs + rhs.negate();
+}
+
+template<typename T, typename B, std::size_t K> requires std::is_convertible_v<B, T>
+Jet<T, K> operator-(const Jet<T, K>& lhs, const B& rhs) {
+    return lhs + (-static_cast<T>(rhs));
+}
+
+template<typename T, typename A, std::size_t K> requires std::is_convertible_v<A, T>
+Jet<T, K> operator-(const A& lhs, const Jet<T, K>& rhs) {
+    return rhs.negate() + lhs;
+}
+
+
+
+template<typename T, std::size_t K>
+Jet<T, K> operator*(const Jet<T, K>& lhs, const Jet<T, K>& rhs) {
+    return Jet<T, K>(Jet<T, K>::product(lhs.coefficients(), rhs.coefficients()));
+}
+
+template<typename T, typename B, std::size_t K> requires std::is_convertible_v<B, T>
+Jet<T, K> operator*(const Jet<T, K>& lhs, const B& rhs) {
+    typename Jet<T, K>::Coefficients c = lhs.coefficients();
+    for (T& coefficient : c)
+        coefficient *= static_cast<T>(rhs);
+    return Jet<T, K>(c);
+}
+
+template<typename T, typename A, std::size_t K> requires std::is_convertible_v<A, T>
+Jet<T, K> operator*(const A& lhs, const Jet<T, K>& rhs) {
+    return rhs * lhs;
+}
+
+
+
+template<typename T, std::size_t K>
+Jet<T, K> operator/(const Jet<T, K>& lhs, const Jet<T, K>& rhs) {
+    return Jet<T, K>(Jet<T, K>::quotient(lhs.coefficients(), rhs.coefficients()));
+}
+
+template<typename T, typename B, std::size_t K> requires std::is_convertible_v<B, T>
+Jet<T, K> operator/(const Jet<T, K>& lhs, const B& rhs) {
+    typename Jet<T, K>::Coefficients c = lhs.coefficients();
+    for (T& coefficient : c)
+        coefficient /= static_cast<T>(rhs);
+    return Jet<T, K>(c);
+}
+
+template<typename T, typename A, std::size_t K> requires std::is_convertible_v<A, T>
+Jet<T, K> operator/(const A& lhs, const Jet<T, K>& rhs) {
+    return Jet<T, K>(static_cast<T>(lhs)) / rhs;
+}
+
+
+///////////////////////////////////////////////////////////////////////////
+///                             COMPARISONS                             ///
+///////////////////////////////////////////////////////////////////////////
+
+// Jets are ordered by their values, like Duals.
+
+template<typename T, std::size_t K>
+auto operator<=>(const Jet<T, K>& lhs, const Jet<T, K>& rhs) {
+    return lhs.value() <=> rhs.value();
+}
+
+template<typename T, typename B, std::size_t K> requires std::is_convertible_v<B, T>
+auto operator<=>(const Jet<T, K>& lhs, const B& rhs) {
+    return lhs.value() <=> static_cast<T>(rhs);
+}
+
+
+///////////////////////////////////////////////////////////////////////////
+///                           VALUE FUNCTIONS                           ///
+///////////////////////////////////////////////////////////////////////////
+
+// Found via argument dependent lookup by the OperatorRegistry, thus Jets can
+// also be the values of Variables.
+
+template<typename T, std::size_t K>
+Jet<T, K> abs(const Jet<T, K>& val) { return val.abs(); }
+
+template<typename T, std::size_t K>
+Jet<T, K> sign(const Jet<T, K>& val) { return Jet<T, K>(T((val.value() > 0) - (val.value() < 0))); }
+
+template<typename T, std::size_t K>
+Jet<T, K> exp(const Jet<T, K>& val) { return val.exp(); }
+
+template<typename T, std::size_t K>
+Jet<T, K> log(const Jet<T, K>& val) { return val.log(); }
+
+template<typename T, std::size_t K>
+Jet<T, K> sin(const Jet<T, K>& val) { return val.sin(); }
+
+template<typename T, std::size_t K>
+Jet<T, K> cos(const Jet<T, K>& val) { return val.cos(); }
+
+template<typename T, std::size_t K>
+Jet<T, K> tan(const Jet<T, K>& val) { return val.tan(); }
+
+
+///////////////////////////////////////////////////////////////////////////
+///                              PRINTING                               ///
+///////////////////////////////////////////////////////////////////////////
+
+// Prints the derivatives, i.e. `Jet(f, f', f'', ...)`.
+template<typename T, std::size_t K>
+struct std::formatter<Jet<T, K>> : std::formatter<std::string> {
+    auto format(const Jet<T, K>& jet, format_context& ctx) const {
+        std::string out = "Jet(";
+        for (std::size_t k = 0; k <= K; ++k) {
+            if (k > 0)
+                out += ", ";
+            if constexpr (std::is_floating_point_v<T>)
+                out += std::format("{:.12}", jet.derivative(k));
+            else
+                out += std::format("{}", jet.derivative(k));
+        }
+        out += ")";
+        return formatter<string>::format(out, ctx);
+    }
+};
+
+template<typename T, std::size_t K>
+std::ostream& operator<<(std::ostream& os, const Jet<T, K>& jet) {
+    os << std::format("{}", jet);
+    return os;
+}
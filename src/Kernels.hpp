@@ -0,0 +1,105 @@
+#pragma once
+#include <array>
+#include <cstddef>
+
+
+
+// Elementwise kernels shared by Tensor and the batched evaluation of a
+// BatchProgram.
+//
+// The kernels operate on raw pointers that do not alias, and process the
+// elements in blocks of a fixed size. Both are required by the compiler to
+// vectorize them without runtime checks (e.g. at -O2), while the remaining
+// elements are processed one by one.
+namespace Kernels {
+
+    inline constexpr std::size_t block = 16;
+
+    template<typename T, typename Fn>
+    void map(const T* __restrict in, T* __restrict out, std::size_t size, Fn fn) {
+        std::size_t i = 0;
+        for (; i + block <= size; i += block)
+            for (std::size_t j = 0; j < block; ++j)
+                out[i + j] = fn(in[i + j]);
+        for (; i < size; ++i)
+            out[i] = fn(in[i]);
+    }
+
+    template<typename T, typename Fn>
+    void zip(const T* __restrict lhs, const T* __restrict rhs, T* __restrict out, std::size_t size, Fn fn) {
+        std::size_t i = 0;
+        for (; i + block <= size; i += block)
+            for (std::size_t j = 0; j < block; ++j)
+                out[i + j] = fn(lhs[i + j], rhs[i + j]);
+        for (; i < size; ++i)
+            out[i] = fn(lhs[i], rhs[i]);
+    }
+
+    // out += in
+    template<typename T>
+    void accumulate(const T* __restrict in, T* __restrict out, std::size_t size) {
+        std::size_t i = 0;
+        for (; i + block <= size; i += block)
+            for (std::size_t j = 0; j < block; ++j)
+                out[i + j] += in[i + j];
+        for (; i < size; ++i)
+            out[i] += in[i];
+    }
+
+    // out += scale * in
+    template<typename T>
+    void axpy(T scale, const T* __restrict in, T* __restrict out, std::size_t size) {
+        std::size_t i = 0;
+        for (; i + block <= size; i += block)
+            for (std::size_t j = 0; j < block; ++j)
+                out[i + j] += scale * in[i + j];
+        for (; i < size; ++i)
+            out[i] += scale * in[i];
+    }
+
+    // Every lane of the block accumulates its own partial sum, thus the sum
+    // vectorizes without reassociating floating point additions.
+    template<typename T>
+    T sum(const T* __restrict in, std::size_t size) {
+        std::array<T, block> partial{};
+        std::size_t i = 0;
+        for (; i + block <= size; i += block)
+            for (std::size_t j = 0; j < block; ++j)
+                partial[j] += in[i + j];
+        T sum = 0;
+        for (; i < size; ++i)
+            sum += in[i];
+        for (std::size_t j = 0; j < block; ++j)
+            sum += partial[j];
+        return sum;
+    }
+
+    // out += fn(in, grad), i.e. the backward pass of a unary operation
+    template<typename T, typename Fn>
+    void map_accumulate(const T* __restrict in, const T* __restrict grad, T* __restrict out, std::size_t size, Fn fn) {
+        std::size_t i = 0;
+        for (; i + block <= size; i += block)
+            for (std::size_t j = 0; j < block; ++j)
+                out[i + j] += fn(in[i + j], grad[i + j]);
+        for (; i < size; ++i)
+            out[i] += fn(in[i], grad[i]);
+    }
+
+    // [lhs_out, rhs_out] += fn(lhs, rhs, grad), i.e. the backward pass of a
+    // binary operation, whose two outputs must not alias either
+    template<typename T, typename Fn>
+    void zip_accumulate(const T* __restrict lhs, const T* __restrict rhs, const T* __restrict grad, T* __restrict lhs_out, T* __restrict rhs_out, std::size_t size, Fn fn) {
+        std::size_t i = 0;
+        for (; i + block <= size; i += block)
+            for (std::size_t j = 0; j < block; ++j) {
+                auto [lhs_grad, rhs_grad] = fn(lhs[i + j], rhs[i + j], grad[i + j]);
+                lhs_out[i + j] += lhs_grad;
+                rhs_out[i + j] += rhs_grad;
+            }
+        for (; i < size; ++i) {
+            auto [lhs_grad, rhs_grad] = fn(lhs[i], rhs[i], grad[i]);
+            lhs_out[i] += lhs_grad;
+            rhs_out[i] += rhs_grad;
+        }
+    }
+}
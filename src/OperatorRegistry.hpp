@@ -0,0 +1,889 @@
+#pragma once
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cassert>
+#include <utility>
+#include <type_traits>
+#include <string_view>
+
+#include "VectorMath.hpp"
+
+
+
+template<typename T> class Variable;
+
+namespace OperatorRegistry {
+
+    // Every operation is identified by a compact op code, which allows
+    // execution modes that do not store the operation structs themselves
+    // (e.g. the `Tape`) to dispatch back to them via `visit()`.
+    enum class OpCode : std::uint8_t {
+        Leaf,
+        Add, Sub, Mul, Div, MatMul,
+        Neg, Reciprocal, Abs, Exp, Log, Sin, Cos, Tan, Sum, Mean, Transpose,
+        Shift, Scale, Affine, DivScalar, RDivScalar, SumTo,
+        Fused,  // chain of elementwise operations stored in the node, see `FusedChain`
+        Custom, // backward function stored in the node, e.g. of a checkpoint
+    };
+
+    // Scalar operations combine a variable with constants, which they store
+    // inline instead of materialising them as Variables.
+    constexpr bool has_constants(OpCode code) {
+        return code >= OpCode::Shift && code <= OpCode::SumTo;
+    }
+
+    // Operations that save intermediates of their forward pass in their node
+    // via `save()`, instead of constants.
+    constexpr bool saves_values(OpCode code) {
+        return code == OpCode::Sin || code == OpCode::Cos;
+    }
+
+    // Operations of one input that are applied to each element separately,
+    // thus they can be fused into chains.
+    constexpr bool is_elementwise(OpCode code) {
+        return (code >= OpCode::Neg && code <= OpCode::Tan) || (code >= OpCode::Shift && code <= OpCode::RDivScalar);
+    }
+
+    constexpr std::size_t num_op_codes = static_cast<std::size_t>(OpCode::Custom) + 1;
+
+    constexpr std::string_view name(OpCode code) {
+        constexpr std::array<std::string_view, num_op_codes> names{
+            "Leaf",
+            "Add", "Sub", "Mul", "Div", "MatMul",
+            "Neg", "Reciprocal", "Abs", "Exp", "Log", "Sin", "Cos", "Tan", "Sum", "Mean", "Transpose",
+            "Shift", "Scale", "Affine", "DivScalar", "RDivScalar", "SumTo",
+            "Fused",
+            "Custom",
+        };
+        return names[static_cast<std::size_t>(code)];
+    }
+
+    ///////////////////////////////////////////////////////////////////////////
+    ///                           VALUE FUNCTIONS                           ///
+    ///////////////////////////////////////////////////////////////////////////
+
+    // The operations only call the following functions on values, always
+    // unqualified: for scalars, the generic versions below and those of the
+    // standard library are used, while value types like Tensor overload them
+    // in their own namespace, where they are found via argument dependent
+    // lookup.
+    using std::abs;
+    using std::exp;
+    using std::log;
+    using std::sin;
+    using std::cos;
+    using std::tan;
+
+    template<typename T>
+    T sign(const T& val) { return val > T(0) ? T(1) : val < T(0) ? T(-1) : T(0); }
+
+    template<typename T>
+    std::size_t numel(const T& val) { return 1; }
+
+    // heap memory held by a value, see GraphStats.hpp
+    template<typename T>
+    std::size_t heap_bytes(const T& val) { return 0; }
+
+    template<typename T>
+    bool same_shape(const T& lhs, const T& rhs) { return true; }
+
+    template<typename T>
+    T sum(const T& val) { return val; }
+
+    template<typename T>
+    T mean(const T& val) { return val; }
+
+    template<typename T>
+    T sum_to(const T& val, const T& like) { return val; }
+
+    template<typename T>
+    T transpose(const T& val) { return val; }
+
+    template<typename T>
+    T matmul(const T& lhs, const T& rhs) { return lhs * rhs; }
+
+
+    // Each operation defines its forward pass via `operator()`, its backward
+    // pass on Variables via `backward()`, which builds a computational graph
+    // if the incoming gradient requires a gradient, and its backward pass on
+    // plain values via `backward_value()`. Scalar operations additionally
+    // return their constants via `constants()`.
+    //
+    // Backward functions should not redo the work of the forward pass.
+    // Operations whose derivative follows from their output define
+    // `backward_output()`, which is passed the output of the node instead of
+    // its input (on Variables the node itself, thus no new nodes are created
+    // for it). Operations that need other intermediates save them in their
+    // node during the forward pass via `save()` and read them in
+    // `backward_saved()`. Both are optional, see `unary_backward_value()`.
+    //
+    // Transcendental operations also evaluate whole arrays at once via
+    // `forward_array()`, and `save_array()` where they save values, which the
+    // batched paths use instead of one libm call per element (see VectorMath).
+
+    ///////////////////////////////////////////////////////////////////////////
+    ///                          BINARY OPERATIONS                          ///
+    ///////////////////////////////////////////////////////////////////////////
+
+    struct Add {
+        static constexpr OpCode code = OpCode::Add;
+        static constexpr int arity = 2;
+
+        template<typename T>
+        T operator()(const T& lhs, const T& rhs) const { return lhs + rhs; }
+
+
+        template<typename T>
+        std::array<Variable<T>, 2> backward(const Variable<T>& lhs, const Variable<T>& rhs, const Variable<T>& prev_grad) const {
+            return {prev_grad, prev_grad};
+        }
+
+        template<typename T>
+        std::array<T, 2> backward_value(const T& lhs, const T& rhs, const T& prev_grad) const {
+            return {prev_grad, prev_grad};
+        }
+
+        // template<typename T>
+        // std::vector<Variable<T>> backward(const std::shared_ptr<VariableImpl<T>>& lhs_impl, const std::shared_ptr<VariableImpl<T>>& rhs_impl, const Variable<T>& prev_grad) const {
+        //     return {prev_grad, prev_grad};
+        // }
+    };
+
+    struct Sub {
+        static constexpr OpCode code = OpCode::Sub;
+        static constexpr int arity = 2;
+
+        template<typename T>
+        T operator()(const T& lhs, const T& rhs) const { return lhs - rhs; }
+
+        template<typename T>
+        std::array<Variable<T>, 2> backward(const Variable<T>& lhs, const Variable<T>& rhs, const Variable<T>& prev_grad) const {
+            return {prev_grad, -prev_grad};
+        }
+
+        template<typename T>
+        std::array<T, 2> backward_value(const T& lhs, const T& rhs, const T& prev_grad) const {
+            return {prev_grad, -prev_grad};
+        }
+
+        // template<typename T>
+        // std::vector<Variable<T>> backward(const std::shared_ptr<VariableImpl<T>>& lhs_impl, const std::shared_ptr<VariableImpl<T>>& rhs_impl, const Variable<T>& prev_grad) const {
+        //     return {prev_grad, -prev_grad};
+        // }
+    };
+
+    struct Mul {
+        static constexpr OpCode code = OpCode::Mul;
+        static constexpr int arity = 2;
+
+        template<typename T>
+        T operator()(const T& lhs, const T& rhs) const { return lhs * rhs; }
+
+        template<typename T>
+        std::array<Variable<T>, 2> backward(const Variable<T>& lhs, const Variable<T>& rhs, const Variable<T>& prev_grad) const {
+            return {prev_grad * rhs, prev_grad * lhs};
+        }
+
+        template<typename T>
+        std::array<T, 2> backward_value(const T& lhs, const T& rhs, const T& prev_grad) const {
+            return {prev_grad * rhs, prev_grad * lhs};
+        }
+        
+        // template<typename T>
+        // std::vector<Variable<T>> backward(const std::shared_ptr<VariableImpl<T>>& lhs_impl, const std::shared_ptr<VariableImpl<T>>& rhs_impl, const Variable<T>& prev_grad) const {
+        //     Variable<T> lhs(lhs_impl);
+        //     Variable<T> rhs(rhs_impl);
+        //     return {prev_grad * rhs, prev_grad * lhs};
+        // }
+    };
+
+    struct Div {
+        static constexpr OpCode code = OpCode::Div;
+        static constexpr int arity = 2;
+
+        template<typename T>
+        T operator()(const T& lhs, const T& rhs) const { return lhs / rhs; }
+
+        template<typename T>
+        std::array<Variable<T>, 2> backward(const Variable<T>& lhs, const Variable<T>& rhs, const Variable<T>& prev_grad) const {
+            return {prev_grad / rhs, prev_grad * -lhs / (rhs * rhs)};
+        }
+
+        template<typename T>
+        std::array<T, 2> backward_value(const T& lhs, const T& rhs, const T& prev_grad) const {
+            return {prev_grad / rhs, prev_grad * -lhs / (rhs * rhs)};
+        }
+
+        // template<typename T>
+        // std::vector<Variable<T>> backward(const std::shared_ptr<VariableImpl<T>>& lhs_impl, const std::shared_ptr<VariableImpl<T>>& rhs_impl, const Variable<T>& prev_grad) const {
+        //     Variable<T> lhs(lhs_impl);
+        //     Variable<T> rhs(rhs_impl);
+        //     return {prev_grad / rhs, prev_grad * -lhs / (rhs * rhs)};;
+        // }
+    };
+
+    struct MatMul {
+        static constexpr OpCode code = OpCode::MatMul;
+        static constexpr int arity = 2;
+
+        template<typename T>
+        T operator()(const T& lhs, const T& rhs) const { return matmul(lhs, rhs); }
+
+        template<typename T>
+        std::array<Variable<T>, 2> backward(const Variable<T>& lhs, const Variable<T>& rhs, const Variable<T>& prev_grad) const {
+            return {matmul(prev_grad, rhs.transpose()), matmul(lhs.transpose(), prev_grad)};
+        }
+
+        template<typename T>
+        std::array<T, 2> backward_value(const T& lhs, const T& rhs, const T& prev_grad) const {
+            return {matmul(prev_grad, transpose(rhs)), matmul(transpose(lhs), prev_grad)};
+        }
+    };
+
+    ///////////////////////////////////////////////////////////////////////////
+    ///                          UNARY OPERATIONS                           ///
+    ///////////////////////////////////////////////////////////////////////////
+
+    struct Neg {
+        static constexpr OpCode code = OpCode::Neg;
+        static constexpr int arity = 1;
+
+        template<typename T>
+        T operator()(const T& val) const { return -val; }
+
+        template<typename T>
+        Variable<T> backward(const Variable<T>& var, const Variable<T>& prev_grad) const {
+            return -prev_grad;
+        }
+
+        template<typename T>
+        T backward_value(const T& val, const T& prev_grad) const {
+            return -prev_grad;
+        }
+
+        // template<typename T>
+        // std::vector<Variable<T>> backward(const std::shared_ptr<VariableImpl<T>>& var_impl, const Variable<T>& prev_grad) const {
+        //     return {-prev_grad};
+        // }        
+    };
+
+    struct Reciprocal {
+        static constexpr OpCode code = OpCode::Reciprocal;
+        static constexpr int arity = 1;
+
+        template<typename T>
+        T operator()(const T& val) const { return 1/val; }
+
+        template<typename T>
+        Variable<T> backward(const Variable<T>& var, const Variable<T>& prev_grad) const {
+            return prev_grad * static_cast<T>(-1) / (var * var);
+        }
+
+        template<typename T>
+        T backward_value(const T& val, const T& prev_grad) const {
+            return prev_grad * static_cast<T>(-1) / (val * val);
+        }
+
+        // d(1/x)/dx = -(1/x)^2
+        template<typename T>
+        Variable<T> backward_output(const Variable<T>& out, const Variable<T>& prev_grad) const {
+            return -(prev_grad * (out * out));
+        }
+
+        template<typename T>
+        T backward_output(const T& out, const T& prev_grad) const {
+            return -(prev_grad * (out * out));
+        }
+
+        // template<typename T>
+        // std::vector<Variable<T>> backward(const std::shared_ptr<VariableImpl<T>>& var_impl, const Variable<T>& prev_grad) const {
+        //     Variable<T> var(var_impl);
+        //     return {prev_grad * static_cast<T>(-1) / (var * var)};
+        // } 
+    };
+
+    struct Abs {
+        static constexpr OpCode code = OpCode::Abs;
+        static constexpr int arity = 1;
+
+        template<typename T>
+        T operator()(const T& val) const { return abs(val); }
+
+        template<typename T>
+        Variable<T> backward(const Variable<T>& var, const Variable<T>& prev_grad) const {
+            return prev_grad * sign(var.value());
+        }
+
+        template<typename T>
+        T backward_value(const T& val, const T& prev_grad) const {
+            return prev_grad * sign(val);
+        }
+
+        // template<typename T>
+        // std::vector<Variable<T>> backward(const std::shared_ptr<VariableImpl<T>>& var_impl, const Variable<T>& prev_grad) const {
+        //     // Variable<T> var(var_impl);
+        //     T sign = var_impl->value() > 0 ? 1 : var_impl->value() < 0 ? -1 : 0;
+        //     return {prev_grad * sign};
+        // } 
+    };
+
+    struct Exp {
+        static constexpr OpCode code = OpCode::Exp;
+        static constexpr int arity = 1;
+
+        template<typename T>
+        T operator()(const T& val) const { return exp(val); }
+
+        template<typename T>
+        void forward_array(const T* in, T* out, std::size_t size) const { VectorMath::exp(in, out, size); }
+
+        template<typename T>
+        Variable<T> backward(const Variable<T>& var, const Variable<T>& prev_grad) const {
+            return prev_grad * var.exp();
+        }
+
+        template<typename T>
+        T backward_value(const T& val, const T& prev_grad) const {
+            return prev_grad * exp(val);
+        }
+
+        // d(exp(x))/dx = exp(x)
+        template<typename T>
+        Variable<T> backward_output(const Variable<T>& out, const Variable<T>& prev_grad) const {
+            return prev_grad * out;
+        }
+
+        template<typename T>
+        T backward_output(const T& out, const T& prev_grad) const {
+            return prev_grad * out;
+        }
+
+        // template<typename T>
+        // std::vector<Variable<T>> backward(const std::shared_ptr<VariableImpl<T>>& var_impl, const Variable<T>& prev_grad) const {
+        //     Variable<T> var(var_impl);
+        //     return {prev_grad * var.exp()};
+        // } 
+    };
+
+    struct Log {
+        static constexpr OpCode code = OpCode::Log;
+        static constexpr int arity = 1;
+
+        template<typename T>
+        T operator()(const T& val) const { return log(val); }
+
+        template<typename T>
+        void forward_array(const T* in, T* out, std::size_t size) const { VectorMath::log(in, out, size); }
+
+        template<typename T>
+        Variable<T> backward(const Variable<T>& var, const Variable<T>& prev_grad) const {
+            return prev_grad * (static_cast<T>(1) / var);
+        }
+
+        template<typename T>
+        T backward_value(const T& val, const T& prev_grad) const {
+            return prev_grad * (static_cast<T>(1) / val);
+        }
+
+        // template<typename T>
+        // std::vector<Variable<T>> backward(const std::shared_ptr<VariableImpl<T>>& var_impl, const Variable<T>& prev_grad) const {
+        //     Variable<T> var(var_impl);
+        //     return {prev_grad / var};
+        // } 
+    };
+
+    struct Sin {
+        static constexpr OpCode code = OpCode::Sin;
+        static constexpr int arity = 1;
+
+        template<typename T>
+        T operator()(const T& val) const { return sin(val); }
+
+        template<typename T>
+        void forward_array(const T* in, T* out, std::size_t size) const { VectorMath::sin(in, out, size); }
+
+        template<typename T>
+        Variable<T> backward(const Variable<T>& var, const Variable<T>& prev_grad) const {
+            return prev_grad * var.cos();
+        }
+
+        template<typename T>
+        T backward_value(const T& val, const T& prev_grad) const {
+            return prev_grad * cos(val);
+        }
+
+        // cos(x) cannot be recovered from sin(x), thus it is saved. Saved
+        // values are constants w.r.t. the graph, Variables keep using
+        // `backward()` for higher-order gradients.
+        template<typename T>
+        std::array<T, 2> save(const T& val, const T&) const { return {cos(val), T{}}; }
+
+        template<typename T>
+        T backward_saved(const std::array<T, 2>& saved, const T& prev_grad) const {
+            return prev_grad * saved[0];
+        }
+
+        template<typename T>
+        void save_array(const T* in, T* saved, std::size_t size) const { VectorMath::cos(in, saved, size); }
+
+        // template<typename T>
+        // std::vector<Variable<T>> backward(const std::shared_ptr<VariableImpl<T>>& var_impl, const Variable<T>& prev_grad) const {
+        //     Variable<T> var(var_impl);
+        //     return {prev_grad * var.cos()};
+        // } 
+    };
+
+    struct Cos {
+        static constexpr OpCode code = OpCode::Cos;
+        static constexpr int arity = 1;
+
+        template<typename T>
+        T operator()(const T& val) const { return cos(val); }
+
+        template<typename T>
+        void forward_array(const T* in, T* out, std::size_t size) const { VectorMath::cos(in, out, size); }
+
+        template<typename T>
+        Variable<T> backward(const Variable<T>& var, const Variable<T>& prev_grad) const {
+            return prev_grad * -var.sin();
+        }
+
+        template<typename T>
+        T backward_value(const T& val, const T& prev_grad) const {
+            return prev_grad * -sin(val);
+        }
+
+        // see `Sin::save()`
+        template<typename T>
+        std::array<T, 2> save(const T& val, const T&) const { return {sin(val), T{}}; }
+
+        template<typename T>
+        T backward_saved(const std::array<T, 2>& saved, const T& prev_grad) const {
+            return prev_grad * -saved[0];
+        }
+
+        template<typename T>
+        void save_array(const T* in, T* saved, std::size_t size) const { VectorMath::sin(in, saved, size); }
+
+        // template<typename T>
+        // std::vector<Variable<T>> backward(const std::shared_ptr<VariableImpl<T>>& var_impl, const Variable<T>& prev_grad) const {
+        //     Variable<T> var(var_impl);
+        //     return {prev_grad * -var.sin()};
+        // } 
+    };
+
+    struct Tan {
+        static constexpr OpCode code = OpCode::Tan;
+        static constexpr int arity = 1;
+
+        template<typename T>
+        T operator()(const T& val) const { return tan(val); }
+
+        template<typename T>
+        void forward_array(const T* in, T* out, std::size_t size) const { VectorMath::tan(in, out, size); }
+
+        template<typename T>
+        Variable<T> backward(const Variable<T>& var, const Variable<T>& prev_grad) const {
+            return prev_grad * static_cast<T>(1)/(var.cos() * var.cos());
+        }
+
+        template<typename T>
+        T backward_value(const T& val, const T& prev_grad) const {
+            return prev_grad * static_cast<T>(1) / (cos(val) * cos(val));
+        }
+
+        // d(tan(x))/dx = 1 + tan(x)^2
+        template<typename T>
+        Variable<T> backward_output(const Variable<T>& out, const Variable<T>& prev_grad) const {
+            return prev_grad * (out * out + static_cast<T>(1));
+        }
+
+        template<typename T>
+        T backward_output(const T& out, const T& prev_grad) const {
+            return prev_grad * (out * out + static_cast<T>(1));
+        }
+
+        // template<typename T>
+        // std::vector<Variable<T>> backward(const std::shared_ptr<VariableImpl<T>>& var_impl, const Variable<T>& prev_grad) const {
+        //     Variable<T> var(var_impl);
+        //     return {prev_grad / (var.cos() * var.cos())};
+        // } 
+    };
+
+
+    ///////////////////////////////////////////////////////////////////////////
+    ///                             REDUCTIONS                              ///
+    ///////////////////////////////////////////////////////////////////////////
+
+    // The reductions (and the transpose) are the identity on scalars.
+
+    struct Sum {
+        static constexpr OpCode code = OpCode::Sum;
+        static constexpr int arity = 1;
+
+        template<typename T>
+        T operator()(const T& val) const { return sum(val); }
+
+        template<typename T>
+        Variable<T> backward(const Variable<T>& var, const Variable<T>& prev_grad) const {
+            return prev_grad.sum_to(var.value());
+        }
+
+        template<typename T>
+        T backward_value(const T& val, const T& prev_grad) const {
+            return sum_to(prev_grad, val);
+        }
+    };
+
+    struct Mean {
+        static constexpr OpCode code = OpCode::Mean;
+        static constexpr int arity = 1;
+
+        template<typename T>
+        T operator()(const T& val) const { return mean(val); }
+
+        template<typename T>
+        Variable<T> backward(const Variable<T>& var, const Variable<T>& prev_grad) const {
+            return prev_grad.sum_to(var.value()) / static_cast<T>(numel(var.value()));
+        }
+
+        template<typename T>
+        T backward_value(const T& val, const T& prev_grad) const {
+            return sum_to(prev_grad, val) / static_cast<T>(numel(val));
+        }
+    };
+
+    struct Transpose {
+        static constexpr OpCode code = OpCode::Transpose;
+        static constexpr int arity = 1;
+
+        template<typename T>
+        T operator()(const T& val) const { return transpose(val); }
+
+        template<typename T>
+        Variable<T> backward(const Variable<T>& var, const Variable<T>& prev_grad) const {
+            return prev_grad.transpose();
+        }
+
+        template<typename T>
+        T backward_value(const T& val, const T& prev_grad) const {
+            return transpose(prev_grad);
+        }
+    };
+
+
+    ///////////////////////////////////////////////////////////////////////////
+    ///                          SCALAR OPERATIONS                          ///
+    ///////////////////////////////////////////////////////////////////////////
+
+    // val + shift
+    template<typename T>
+    struct Shift {
+        static constexpr OpCode code = OpCode::Shift;
+        static constexpr int arity = 1;
+
+        T shift;
+
+        T operator()(const T& val) const { return val + shift; }
+
+        Variable<T> backward(const Variable<T>& var, const Variable<T>& prev_grad) const {
+            return prev_grad;
+        }
+
+        T backward_value(const T& val, const T& prev_grad) const {
+            return prev_grad;
+        }
+
+        std::array<T, 2> constants() const { return {shift, T{}}; }
+    };
+
+    // val * scale
+    template<typename T>
+    struct Scale {
+        static constexpr OpCode code = OpCode::Scale;
+        static constexpr int arity = 1;
+
+        T scale;
+
+        T operator()(const T& val) const { return val * scale; }
+
+        Variable<T> backward(const Variable<T>& var, const Variable<T>& prev_grad) const {
+            return prev_grad * scale;
+        }
+
+        T backward_value(const T& val, const T& prev_grad) const {
+            return prev_grad * scale;
+        }
+
+        std::array<T, 2> constants() const { return {scale, T{}}; }
+    };
+
+    // val * scale + shift
+    template<typename T>
+    struct Affine {
+        static constexpr OpCode code = OpCode::Affine;
+        static constexpr int arity = 1;
+
+        T scale;
+        T shift;
+
+        T operator()(const T& val) const { return val * scale + shift; }
+
+        Variable<T> backward(const Variable<T>& var, const Variable<T>& prev_grad) const {
+            return prev_grad * scale;
+        }
+
+        T backward_value(const T& val, const T& prev_grad) const {
+            return prev_grad * scale;
+        }
+
+        std::array<T, 2> constants() const { return {scale, shift}; }
+    };
+
+    // val / divisor
+    template<typename T>
+    struct DivScalar {
+        static constexpr OpCode code = OpCode::DivScalar;
+        static constexpr int arity = 1;
+
+        T divisor;
+
+        T operator()(const T& val) const { return val / divisor; }
+
+        Variable<T> backward(const Variable<T>& var, const Variable<T>& prev_grad) const {
+            return prev_grad / divisor;
+        }
+
+        T backward_value(const T& val, const T& prev_grad) const {
+            return prev_grad / divisor;
+        }
+
+        std::array<T, 2> constants() const { return {divisor, T{}}; }
+    };
+
+    // dividend / val
+    template<typename T>
+    struct RDivScalar {
+        static constexpr OpCode code = OpCode::RDivScalar;
+        static constexpr int arity = 1;
+
+        T dividend;
+
+        T operator()(const T& val) const { return dividend / val; }
+
+        Variable<T> backward(const Variable<T>& var, const Variable<T>& prev_grad) const {
+            return prev_grad * -dividend / (var * var);
+        }
+
+        T backward_value(const T& val, const T& prev_grad) const {
+            return prev_grad * -dividend / (val * val);
+        }
+
+        std::array<T, 2> constants() const { return {dividend, T{}}; }
+    };
+
+
+    // Sums (or repeats) val to the shape of `like`, which is the backward
+    // operation of broadcasting. Since its own backward operation broadcasts
+    // the gradient back to the shape of val, it is its own adjoint.
+    template<typename T>
+    struct SumTo {
+        static constexpr OpCode code = OpCode::SumTo;
+        static constexpr int arity = 1;
+
+        T like;
+
+        T operator()(const T& val) const { return sum_to(val, like); }
+
+        Variable<T> backward(const Variable<T>& var, const Variable<T>& prev_grad) const {
+            return prev_grad.sum_to(var.value());
+        }
+
+        T backward_value(const T& val, const T& prev_grad) const {
+            return sum_to(prev_grad, val);
+        }
+
+        std::array<T, 2> constants() const { return {like, T{}}; }
+    };
+
+    // Returns the constants an operation stores inline (zero for all
+    // operations that are not scalar operations).
+    template<typename T, typename Op>
+    std::array<T, 2> constants_of(const Op& op) {
+        if constexpr (requires { op.constants(); })
+            return op.constants();
+        else
+            return {};
+    }
+
+    // Returns what the node of an operation with input `val` and output
+    // `out` stores inline: the values saved for `backward_saved()`, or else
+    // the constants of the operation.
+    template<typename T, typename Op>
+    std::array<T, 2> stored_of(const Op& op, const T& val, const T& out) {
+        if constexpr (requires { op.save(val, out); })
+            return op.save(val, out);
+        else
+            return constants_of<T>(op);
+    }
+
+    // The backward function on plain values of a unary operation with input
+    // `val` and output `out`, which reuses the output or the values `saved`
+    // by the forward pass if the operation supports it. `saved` is nullptr
+    // where nothing has been saved, then the operation recomputes them.
+    template<typename T, typename Op>
+    T unary_backward_value(const Op& op, const T& val, const T& out, const std::array<std::type_identity_t<T>, 2>* saved, const T& prev_grad) {
+        if constexpr (requires { op.backward_output(out, prev_grad); }) {
+            return op.backward_output(out, prev_grad);
+        } else if constexpr (requires { op.backward_saved(*saved, prev_grad); }) {
+            if (saved)
+                return op.backward_saved(*saved, prev_grad);
+        }
+        return op.backward_value(val, prev_grad);
+    }
+
+    // Calls `fn` with an instance of the operation registered under `code`.
+    // Scalar operations are constructed from the given `constants`.
+    // `fn` has to return the same type for every operation.
+    template<typename T, typename Fn>
+    decltype(auto) visit(OpCode code, const std::array<T, 2>& constants, Fn&& fn) {
+        switch (code) {
+            case OpCode::Add:        return fn(Add{});
+            case OpCode::Sub:        return fn(Sub{});
+            case OpCode::Mul:        return fn(Mul{});
+            case OpCode::Div:        return fn(Div{});
+            case OpCode::MatMul:     return fn(MatMul{});
+            case OpCode::Neg:        return fn(Neg{});
+            case OpCode::Reciprocal: return fn(Reciprocal{});
+            case OpCode::Abs:        return fn(Abs{});
+            case OpCode::Exp:        return fn(Exp{});
+            case OpCode::Log:        return fn(Log{});
+            case OpCode::Sin:        return fn(Sin{});
+            case OpCode::Cos:        return fn(Cos{});
+            case OpCode::Tan:        return fn(Tan{});
+            case OpCode::Sum:        return fn(Sum{});
+            case OpCode::Mean:       return fn(Mean{});
+            case OpCode::Transpose:  return fn(Transpose{});
+            case OpCode::Shift:      return fn(Shift<T>{constants[0]});
+            case OpCode::Scale:      return fn(Scale<T>{constants[0]});
+            case OpCode::Affine:     return fn(Affine<T>{constants[0], constants[1]});
+            case OpCode::DivScalar:  return fn(DivScalar<T>{constants[0]});
+            case OpCode::RDivScalar: return fn(RDivScalar<T>{constants[0]});
+            case OpCode::SumTo:      return fn(SumTo<T>{constants[0]});
+            case OpCode::Leaf:       break;
+            case OpCode::Fused:      break;
+            case OpCode::Custom:     break;
+        }
+        assert(false && "leaves, fused and custom operations have no registered operation");
+        std::unreachable();
+    }
+
+    ///////////////////////////////////////////////////////////////////////////
+    ///                           FUSED OPERATIONS                          ///
+    ///////////////////////////////////////////////////////////////////////////
+
+    // A straight-line chain of elementwise operations, which a single node
+    // computes instead of one node per operation (see `unary_operation()`).
+    // The node only keeps the input and the output of the chain. Operations
+    // without constants keep their output in the second slot of their step,
+    // which none of them uses otherwise, thus the backward functions only
+    // recompute the cheap intermediate values of scalar operations from the
+    // input. They then apply the backward functions of the operations in
+    // reverse order, which are passed the output and the saved values of each
+    // operation as well.
+    template<typename T>
+    struct FusedChain {
+        static constexpr OpCode code = OpCode::Fused;
+        static constexpr int arity = 1;
+        static constexpr std::size_t max_length = 4;
+
+        // `stored` is what the node of the operation would store inline, i.e.
+        // its constants or its saved values (see `stored_of()`), and the
+        // output of operations without constants.
+        struct Step {
+            OpCode op;
+            std::array<T, 2> stored;
+        };
+
+        std::array<Step, max_length> steps;
+        std::uint8_t length = 0;
+
+        bool full() const { return length == max_length; }
+
+        // `val` is the input of the operation, i.e. the output of the chain so
+        // far.
+        void append(OpCode op, const std::array<T, 2>& stored, const T& val) {
+            assert(is_elementwise(op) && !full() && "only elementwise operations can be fused");
+            if (length > 0 && keeps_output(steps[length - 1]))
+                steps[length - 1].stored[1] = val;
+            steps[length++] = {op, stored};
+        }
+
+        T operator()(const T& val) const {
+            T out = val;
+            for (std::size_t i = 0; i < length; ++i)
+                out = apply(steps[i], out);
+            return out;
+        }
+
+        // Variables are passed to the operations on Variables, which build the
+        // graph of the gradient step by step (i.e. `create_graph=true`).
+        Variable<T> backward(const Variable<T>& var, const Variable<T>& prev_grad) const {
+            std::array<Variable<T>, max_length> inputs;
+            inputs[0] = var;
+            for (std::size_t i = 1; i < length; ++i)
+                inputs[i] = apply(steps[i - 1], inputs[i - 1]);
+            Variable<T> grad = prev_grad;
+            for (std::size_t i = length; i-- > 0;)
+                grad = visit(steps[i].op, steps[i].stored, [&](const auto& op) -> Variable<T> {
+                    if constexpr (std::decay_t<decltype(op)>::arity == 1)
+                        return op.backward(inputs[i], grad).sum_to(inputs[i].value());
+                    else
+                        std::unreachable();
+                });
+            return grad;
+        }
+
+        T backward_value(const T& val, const T& out, const T& prev_grad) const {
+            std::array<T, max_length> recomputed;
+            std::array<const T*, max_length + 1> inputs;
+            inputs[0] = &val;
+            for (std::size_t i = 1; i < length; ++i) {
+                if (keeps_output(steps[i - 1])) {
+                    inputs[i] = &steps[i - 1].stored[1];
+                } else {
+                    recomputed[i] = apply(steps[i - 1], *inputs[i - 1]);
+                    inputs[i] = &recomputed[i];
+                }
+            }
+            inputs[length] = &out;
+            T grad = prev_grad;
+            for (std::size_t i = length; i-- > 0;)
+                grad = visit(steps[i].op, steps[i].stored, [&](const auto& op) -> T {
+                    if constexpr (std::decay_t<decltype(op)>::arity == 1)
+                        return sum_to(unary_backward_value(op, *inputs[i], *inputs[i + 1], &steps[i].stored, grad), *inputs[i]);
+                    else
+                        std::unreachable();
+                });
+            return grad;
+        }
+
+    private:
+        static bool keeps_output(const Step& step) { return !has_constants(step.op); }
+
+        // `Value` is T or Variable<T>
+        template<typename Value>
+        static Value apply(const Step& step, const Value& val) {
+            return visit(step.op, step.stored, [&](const auto& op) -> Value {
+                if constexpr (std::decay_t<decltype(op)>::arity != 1)
+                    std::unreachable();
+                else if constexpr (std::is_same_v<Value, T>)
+                    return op(val);
+                else
+                    return unary_operation(val, op);
+            });
+        }
+    };
+}
@@ -0,0 +1,261 @@
+#pragma once
+#include <new>
+#include <array>
+#include <chrono>
+#include <format>
+#include <string>
+#include <thread>
+#include <vector>
+#include <utility>
+#include <cstdlib>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <functional>
+#include <string_view>
+
+#include "OperatorRegistry.hpp"
+
+
+
+// The Profiler is an opt-in instrumentation layer for the computational graph.
+// While a profiler is active on a thread, every operation on Variables and
+// every node processed by `backward()` on that thread is timed and counted
+// per op code, and recorded as an event. The events can be exported as a
+// Chrome trace (open it in chrome://tracing or https://ui.perfetto.dev), and
+// the counters as a summary table. While no profiler is active, the hooks cost
+// a single thread-local load and branch per operation and per backward pass.
+//
+// Heap allocations can only be counted by replacing the global operator new,
+// which a header cannot do for the whole program. Define the macro
+// `AUTOGRAD_PROFILE_ALLOCATIONS` in exactly one translation unit before
+// including this header to install counting versions of it. Allocations are
+// attributed to the operation or backward node during which they happen, and
+// `Profiler::thread_allocated_bytes()` counts all bytes of the thread.
+//
+// `backward_parallel()` only records the backward pass as a whole, since
+// profilers are not shared between threads.
+//
+// Example:
+//      Profiler profiler;
+//      {
+//          Profiler::Scope scope(profiler);
+//          f(x, y).backward();
+//      }
+//      profiler.print_summary(std::cout);
+//      std::ofstream trace("trace.json");
+//      profiler.write_chrome_trace(trace);
+class Profiler {
+public:
+    using OpCode = OperatorRegistry::OpCode;
+    using Clock = std::chrono::steady_clock;
+
+    enum class Phase : std::uint8_t {
+        Forward,        // an operation that created a value
+        Backward,       // a node processed by backward()
+        BackwardPass,   // a whole call of backward()
+    };
+
+    struct Event {
+        Phase phase;
+        OpCode op;
+        const void* node; // nullptr for operations that did not create a node
+        Clock::time_point start;
+        Clock::duration duration;
+    };
+
+    struct OpStats {
+        std::size_t nodes = 0;
+        std::size_t forward_calls = 0;
+        std::size_t backward_calls = 0;
+        Clock::duration forward_time{};
+        Clock::duration backward_time{};
+        std::size_t allocations = 0;
+        std::size_t allocated_bytes = 0;
+    };
+
+    // State at the beginning of an operation, which is passed back to `end()`.
+    struct Span {
+        Clock::time_point start;
+        std::size_t allocations = 0;
+        std::size_t allocated_bytes = 0;
+    };
+
+    // Activates a profiler on the current thread for the lifetime of the scope.
+    class Scope {
+    public:
+        explicit Scope(Profiler& profiler) : _previous(std::exchange(active(), &profiler)) {}
+        ~Scope() { active() = _previous; }
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+    private:
+        Profiler* _previous;
+    };
+
+    Profiler() : _origin(Clock::now()), _thread(std::hash<std::thread::id>{}(std::this_thread::get_id())) {}
+
+    static Profiler*& active() {
+        thread_local Profiler* profiler = nullptr;
+        return profiler;
+    }
+
+    // Bytes allocated by the current thread since it started, whether or not
+    // a profiler is active. Only counted with `AUTOGRAD_PROFILE_ALLOCATIONS`.
+    static std::size_t& thread_allocated_bytes() noexcept {
+        thread_local std::size_t bytes = 0;
+        return bytes;
+    }
+
+    static void record_allocation(std::size_t bytes) noexcept {
+        thread_allocated_bytes() += bytes;
+        if (Profiler* profiler = active()) {
+            ++profiler->_allocations;
+            profiler->_allocated_bytes += bytes;
+        }
+    }
+
+    Span begin() const {
+        return {Clock::now(), _allocations, _allocated_bytes};
+    }
+
+    void end(Phase phase, OpCode op, const void* node, const Span& span) {
+        const Clock::duration duration = Clock::now() - span.start;
+        // taken before the event is stored, so that the profiler does not
+        // count its own allocations
+        const std::size_t allocations = _allocations - span.allocations;
+        const std::size_t allocated_bytes = _allocated_bytes - span.allocated_bytes;
+
+        if (phase != Phase::BackwardPass) {
+            OpStats& stats = _stats[static_cast<std::size_t>(op)];
+            if (phase == Phase::Forward) {
+                ++stats.forward_calls;
+                stats.forward_time += duration;
+                stats.nodes += node != nullptr;
+            } else {
+                ++stats.backward_calls;
+                stats.backward_time += duration;
+            }
+            stats.allocations += allocations;
+            stats.allocated_bytes += allocated_bytes;
+        }
+        _events.push_back({phase, op, node, span.start, duration});
+    }
+
+    // Counts the node of an operation `op` under `Fused` instead, once an
+    // operation has been fused into it, since its backward time is counted
+    // there as well (see `unary_operation()`). Nodes created before the
+    // profiler was active are not counted in the first place.
+    void fuse_node(OpCode op) {
+        OpStats& stats = _stats[static_cast<std::size_t>(op)];
+        if (stats.nodes > 0) {
+            --stats.nodes;
+            ++_stats[static_cast<std::size_t>(OpCode::Fused)].nodes;
+        }
+    }
+
+    const std::vector<Event>& events() const { return _events; }
+    const OpStats& stats(OpCode op) const { return _stats[static_cast<std::size_t>(op)]; }
+    std::size_t allocations() const { return _allocations; }
+    std::size_t allocated_bytes() const { return _allocated_bytes; }
+
+    // The nodes in the order in which backward() processed them.
+    std::vector<const void*> backward_order() const {
+        std::vector<const void*> order;
+        for (const Event& event : _events)
+            if (event.phase == Phase::Backward)
+                order.push_back(event.node);
+        return order;
+    }
+
+    void clear() {
+        _events.clear();
+        _stats = {};
+        _allocations = 0;
+        _allocated_bytes = 0;
+    }
+
+    // Writes the events in the Trace Event Format, as complete events ("X")
+    // with timestamps in microseconds since the profiler was created.
+    void write_chrome_trace(std::ostream& out) const {
+        out << "{\"traceEvents\": [\n";
+        for (std::size_t i = 0; i < _events.size(); ++i) {
+            const Event& event = _events[i];
+            const std::string_view category = event.phase == Phase::Forward ? "forward" : "backward";
+            const std::string_view name = event.phase == Phase::BackwardPass ? "backward()" : OperatorRegistry::name(event.op);
+            out << std::format("{{\"name\": \"{}\", \"cat\": \"{}\", \"ph\": \"X\", \"ts\": {:.3f}, \"dur\": {:.3f}, \"pid\": 1, \"tid\": {}, \"args\": {{\"node\": \"{}\"}}}}{}\n",
+                name, category, microseconds(event.start - _origin), microseconds(event.duration), _thread,
+                event.node, i + 1 < _events.size() ? "," : "");
+        }
+        out << "], \"displayTimeUnit\": \"ns\"}\n";
+    }
+
+    // Prints the counters of all op codes that occurred as a table.
+    void print_summary(std::ostream& out) const {
+        out << std::format("{:<12} {:>8} {:>12} {:>10} {:>12} {:>10} {:>8} {:>10}\n",
+            "op", "nodes", "forward us", "avg ns", "backward us", "avg ns", "allocs", "bytes");
+        OpStats total;
+        for (std::size_t i = 0; i < _stats.size(); ++i) {
+            const OpStats& stats = _stats[i];
+            if (stats.forward_calls == 0 && stats.backward_calls == 0)
+                continue;
+            print_row(out, OperatorRegistry::name(static_cast<OpCode>(i)), stats);
+            total.nodes += stats.nodes;
+            total.forward_calls += stats.forward_calls;
+            total.backward_calls += stats.backward_calls;
+            total.forward_time += stats.forward_time;
+            total.backward_time += stats.backward_time;
+            total.allocations += stats.allocations;
+            total.allocated_bytes += stats.allocated_bytes;
+        }
+        print_row(out, "total", total);
+    }
+
+private:
+    static double microseconds(Clock::duration duration) {
+        return std::chrono::duration<double, std::micro>(duration).count();
+    }
+
+    static double average_ns(Clock::duration duration, std::size_t calls) {
+        return calls == 0 ? 0.0 : std::chrono::duration<double, std::nano>(duration).count() / calls;
+    }
+
+    static void print_row(std::ostream& out, std::string_view name, const OpStats& stats) {
+        out << std::format("{:<12} {:>8} {:>12.1f} {:>10.1f} {:>12.1f} {:>10.1f} {:>8} {:>10}\n",
+            name, stats.nodes,
+            microseconds(stats.forward_time), average_ns(stats.forward_time, stats.forward_calls),
+            microseconds(stats.backward_time), average_ns(stats.backward_time, stats.backward_calls),
+            stats.allocations, stats.allocated_bytes);
+    }
+
+    Clock::time_point _origin;
+    std::size_t _thread;
+    std::vector<Event> _events;
+    std::array<OpStats, OperatorRegistry::num_op_codes> _stats{};
+    std::size_t _allocations = 0;
+    std::size_t _allocated_bytes = 0;
+};
+
+
+#ifdef AUTOGRAD_PROFILE_ALLOCATIONS
+// Counting replacements of the global allocation functions, the array and
+// nothrow versions forward to these. They are not inlined, since GCC would
+// otherwise see malloc() paired with operator delete and vice versa at the
+// call sites and warn about mismatched allocation functions.
+[[gnu::noinline]] void* operator new(std::size_t size) {
+    Profiler::record_allocation(size);
+    if (void* ptr = std::malloc(size ? size : 1))
+        return ptr;
+    throw std::bad_alloc();
+}
+[[gnu::noinline]] void* operator new(std::size_t size, std::align_val_t alignment) {
+    Profiler::record_allocation(size);
+    const std::size_t align = static_cast<std::size_t>(alignment);
+    if (void* ptr = std::aligned_alloc(align, size == 0 ? align : (size + align - 1) / align * align))
+        return ptr;
+    throw std::bad_alloc();
+}
+[[gnu::noinline]] void operator delete(void* ptr) noexcept { std::free(ptr); }
+[[gnu::noinline]] void operator delete(void* ptr, std::size_t) noexcept { std::free(ptr); }
+[[gnu::noinline]] void operator delete(void* ptr, std::align_val_t) noexcept { std::free(ptr); }
+[[gnu::noinline]] void operator delete(void* ptr, std::size_t, std::align_val_t) noexcept { std::free(ptr); }
+#endif
@@ -0,0 +1,334 @@
+#pragma once
+#include <span>
+#include <array>
+#include <vector>
+#include <memory>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <optional>
+#include <algorithm>
+#include <unordered_map>
+
+#include "Variable.hpp"
+#include "Dual.hpp"
+#include "Jacobian.hpp"
+#include "GraphStats.hpp"
+#include "OperatorRegistry.hpp"
+
+
+
+// Sparse Jacobians and Hessians of functions with many variables, whose
+// derivatives have few nonzeros. Instead of one pass per row (or column),
+// they are computed in three steps:
+//
+//  1. Sparsity detection: the function is evaluated once on Variables and
+//     index sets are propagated through the graph, i.e. every node collects
+//     the inputs it depends on. For the Hessian, every nonlinear operation
+//     additionally records which inputs interact in it, e.g. `a * b` makes
+//     every input of `a` interact with every input of `b`, while `exp(a)`
+//     makes all inputs of `a` interact with each other. Linear operations
+//     (sums, scalar operations, ...) add no interactions. The patterns are
+//     conservative, i.e. they may contain entries that happen to be zero.
+//
+//  2. Coloring: rows (Jacobian) or columns (Hessian) that are structurally
+//     orthogonal, i.e. have no nonzero in a common column (row), get the same
+//     color. For the Hessian, this is a distance-2 coloring of its adjacency
+//     graph, which allows to read every entry directly from the compressed
+//     Hessian. The number of colors of the greedy coloring is bounded by the
+//     number of nonzeros per row and column, not by the number of variables.
+//
+//  3. Compressed evaluation: all rows (columns) of the same color are seeded
+//     at once, thus one seed per color suffices. The Jacobian uses the
+//     vector-seeded backward pass (see Jacobian.hpp), the Hessian forward
+//     over reverse with `Variable<Dual<T, Width>>` (see Hessian.hpp), both
+//     with `Width` colors per pass.
+//
+// The results are returned in the compressed sparse row (CSR) format. `fn`
+// is called with a span of Variables, once with `Variable<T>` for the
+// detection and, for the Hessian, with `Variable<Dual<T, Width>>` for the
+// evaluation, thus it is typically a generic lambda. Like for the
+// CompiledFunction, `fn` must not branch on values in a way that changes the
+// sparsity pattern.
+//
+// Example:
+//      // f(x) = sum_i sin(x[i] * x[i + 1])
+//      auto f = [](auto x) {
+//          auto out = (x[0] * x[1]).sin();
+//          for (std::size_t i = 1; i + 1 < x.size(); ++i)
+//              out = out + (x[i] * x[i + 1]).sin();
+//          return out;
+//      };
+//      CsrMatrix<double> H = sparse_hessian(f, x);   // 3 colors for any x.size()
+
+
+template<typename T>
+struct CsrMatrix {
+    std::size_t rows = 0;
+    std::size_t cols = 0;
+    std::vector<std::size_t> row_offsets;   // entries of row i are [row_offsets[i], row_offsets[i + 1])
+    std::vector<std::uint32_t> col_indices; // sorted within each row
+    std::vector<T> values;
+
+    std::size_t nnz() const { return values.size(); }
+
+    // Returns the entry (i, j), which is zero if it is not stored.
+    T operator()(std::size_t i, std::size_t j) const {
+        auto begin = col_indices.begin() + row_offsets[i];
+        auto end = col_indices.begin() + row_offsets[i + 1];
+        auto it = std::lower_bound(begin, end, static_cast<std::uint32_t>(j));
+        return it != end && *it == j ? values[it - col_indices.begin()] : T(0);
+    }
+};
+
+
+namespace SparseDerivatives {
+
+    using Index = std::uint32_t;
+    using IndexSet = std::vector<Index>; // sorted
+
+    // rows of a sparsity pattern, each one a sorted set of column indices
+    using Pattern = std::vector<IndexSet>;
+
+    inline IndexSet merge(const IndexSet& lhs, const IndexSet& rhs) {
+        IndexSet out;
+        out.reserve(lhs.size() + rhs.size());
+        std::set_union(lhs.begin(), lhs.end(), rhs.begin(), rhs.end(), std::back_inserter(out));
+        return out;
+    }
+
+    // Records that all inputs in `lhs` interact with all inputs in `rhs`.
+    inline void interact(Pattern& pattern, const IndexSet& lhs, const IndexSet& rhs) {
+        for (Index i : lhs)
+            pattern[i].insert(pattern[i].end(), rhs.begin(), rhs.end());
+        for (Index j : rhs)
+            pattern[j].insert(pattern[j].end(), lhs.begin(), lhs.end());
+    }
+
+    // Propagates the index sets of `inputs` through the graphs of `roots` and
+    // calls `on_node(node, parent_sets, node_set)` for every non-leaf node,
+    // parents before children. Returns the index sets of the roots.
+    template<typename T, typename OnNode>
+    std::vector<IndexSet> propagate_index_sets(std::span<const Variable<T>> roots, std::span<const Variable<T>> inputs, OnNode&& on_node) {
+        std::unordered_map<const VariableImpl<T>*, IndexSet> sets;
+        for (std::size_t j = 0; j < inputs.size(); ++j)
+            sets[inputs[j].variable().get()] = {static_cast<Index>(j)};
+        for (const auto& root : roots) {
+            GraphInspection::for_each_node(root.variable(), [&](const VariableImpl<T>& node, std::size_t) {
+                // nodes shared with the graph of a previous root and inputs
+                // already have their sets
+                if (sets.contains(&node))
+                    return;
+                IndexSet& set = sets[&node];
+                const auto parents = node.parents();
+                std::array<const IndexSet*, 2> parent_sets{};
+                for (std::size_t k = 0; k < parents.size(); ++k) {
+                    parent_sets[k] = &sets.at(parents[k].get());
+                    set = merge(set, *parent_sets[k]);
+                }
+                if (!parents.empty())
+                    on_node(node, parent_sets, set);
+            });
+        }
+        std::vector<IndexSet> out;
+        out.reserve(roots.size());
+        for (const auto& root : roots)
+            out.push_back(sets.at(root.variable().get()));
+        return out;
+    }
+
+    // Row `i` holds the inputs that `outputs[i]` depends on.
+    template<typename T>
+    Pattern jacobian_sparsity(std::span<const Variable<T>> outputs, std::span<const Variable<T>> inputs) {
+        return propagate_index_sets(outputs, inputs, [](const auto&, const auto&, const auto&) {});
+    }
+
+    // Row `i` holds the inputs `j` for which d²output / dx_i dx_j may be nonzero.
+    template<typename T>
+    Pattern hessian_sparsity(const Variable<T>& output, std::span<const Variable<T>> inputs) {
+        using OperatorRegistry::OpCode;
+        Pattern pattern(inputs.size());
+        propagate_index_sets(std::span<const Variable<T>>(&output, 1), inputs,
+                             [&](const VariableImpl<T>& node, const std::array<const IndexSet*, 2>& parents, const IndexSet& set) {
+            switch (node.op()) {
+                case OpCode::Mul:
+                case OpCode::MatMul:
+                    interact(pattern, *parents[0], *parents[1]);
+                    break;
+                case OpCode::Div:
+                    interact(pattern, *parents[0], *parents[1]);
+                    interact(pattern, *parents[1], *parents[1]);
+                    break;
+                case OpCode::Reciprocal:
+                case OpCode::Exp:
+                case OpCode::Log:
+                case OpCode::Sin:
+                case OpCode::Cos:
+                case OpCode::Tan:
+                case OpCode::RDivScalar:
+                case OpCode::Fused:  // assumed to be nonlinear
+                case OpCode::Custom: // unknown, thus assumed to be nonlinear
+                    interact(pattern, set, set);
+                    break;
+                default: // linear, or piecewise linear like Abs
+                    break;
+            }
+        });
+        for (IndexSet& row : pattern) {
+            std::sort(row.begin(), row.end());
+            row.erase(std::unique(row.begin(), row.end()), row.end());
+        }
+        return pattern;
+    }
+
+    // Returns the transposed pattern with `cols` rows.
+    inline Pattern transpose(const Pattern& pattern, std::size_t cols) {
+        Pattern out(cols);
+        for (std::size_t i = 0; i < pattern.size(); ++i)
+            for (Index j : pattern[i])
+                out[j].push_back(static_cast<Index>(i));
+        return out;
+    }
+
+    // Greedily colors the columns `0, ..., cols - 1` of `pattern` such that
+    // columns with a nonzero in the same row have different colors, i.e. all
+    // columns of one color are structurally orthogonal. Returns the colors.
+    inline std::vector<Index> color_columns(const Pattern& pattern, std::size_t cols) {
+        constexpr Index none = static_cast<Index>(-1);
+        const Pattern rows_of = transpose(pattern, cols);
+        std::vector<Index> colors(cols, none);
+        // `forbidden[c] == j` if color c is taken by a neighbour of column j
+        std::vector<Index> forbidden(cols, none);
+        for (std::size_t j = 0; j < cols; ++j) {
+            for (Index row : rows_of[j])
+                for (Index k : pattern[row])
+                    if (colors[k] != none)
+                        forbidden[colors[k]] = static_cast<Index>(j);
+            Index color = 0;
+            while (forbidden[color] == j)
+                ++color;
+            colors[j] = color;
+        }
+        return colors;
+    }
+
+    // Distance-2 coloring of the adjacency graph of a symmetric pattern: two
+    // columns get different colors if they are adjacent or have a common
+    // neighbour, thus every entry (i, j) can be read from the compressed
+    // Hessian as the entry i of the product with the seed of color(j).
+    inline std::vector<Index> color_distance2(const Pattern& pattern) {
+        Pattern with_diagonal = pattern;
+        for (std::size_t i = 0; i < pattern.size(); ++i) {
+            IndexSet& row = with_diagonal[i];
+            row.insert(std::lower_bound(row.begin(), row.end(), static_cast<Index>(i)), static_cast<Index>(i));
+            row.erase(std::unique(row.begin(), row.end()), row.end());
+        }
+        return color_columns(with_diagonal, pattern.size());
+    }
+
+    inline std::size_t num_colors(const std::vector<Index>& colors) {
+        return colors.empty() ? 0 : *std::max_element(colors.begin(), colors.end()) + 1;
+    }
+
+    // CSR matrix with the structure of `pattern` and zero values.
+    template<typename T>
+    CsrMatrix<T> csr_from_pattern(const Pattern& pattern, std::size_t cols) {
+        CsrMatrix<T> out;
+        out.rows = pattern.size();
+        out.cols = cols;
+        out.row_offsets.reserve(pattern.size() + 1);
+        out.row_offsets.push_back(0);
+        for (const IndexSet& row : pattern) {
+            out.col_indices.insert(out.col_indices.end(), row.begin(), row.end());
+            out.row_offsets.push_back(out.col_indices.size());
+        }
+        out.values.assign(out.col_indices.size(), T(0));
+        return out;
+    }
+
+} // namespace SparseDerivatives
+
+
+// Returns the Jacobian `J(i, j) = d fn(x)[i] / d x[j]` of `fn`, which returns
+// a vector of Variables. Rows of the same color are seeded together, thus the
+// number of backward traversals is the number of colors divided by `Width`.
+template<std::size_t Width = 8, typename T, typename Fn>
+CsrMatrix<T> sparse_jacobian(Fn&& fn, const std::vector<T>& x) {
+    using namespace SparseDerivatives;
+    std::vector<Variable<T>> inputs;
+    inputs.reserve(x.size());
+    for (const T& value : x)
+        inputs.emplace_back(value, true);
+    const std::vector<Variable<T>> outputs = fn(std::span<const Variable<T>>(inputs));
+
+    const Pattern pattern = jacobian_sparsity<T>(outputs, inputs);
+    const std::vector<Index> colors = color_columns(transpose(pattern, x.size()), outputs.size());
+    CsrMatrix<T> result = csr_from_pattern<T>(pattern, x.size());
+
+    std::vector<std::array<T, Width>> seeds(outputs.size());
+    for (std::size_t begin = 0; begin < num_colors(colors); begin += Width) {
+        for (std::size_t i = 0; i < outputs.size(); ++i)
+            for (std::size_t k = 0; k < Width; ++k)
+                seeds[i][k] = T(colors[i] == begin + k);
+        const std::vector<std::array<T, Width>> products = vjp<Width>(std::span<const Variable<T>>(outputs),
+                                                                      std::span<const std::array<T, Width>>(seeds), std::span<const Variable<T>>(inputs));
+        // the row of every nonzero is the only row of its color in its column
+        for (std::size_t i = 0; i < outputs.size(); ++i) {
+            if (colors[i] < begin || colors[i] >= begin + Width)
+                continue;
+            for (std::size_t e = result.row_offsets[i]; e < result.row_offsets[i + 1]; ++e)
+                result.values[e] = products[result.col_indices[e]][colors[i] - begin];
+        }
+    }
+    return result;
+}
+
+
+// Returns the Hessian `H(i, j) = d² fn(x) / dx_i dx_j` of `fn`, which returns
+// a scalar Variable. Columns of the same color are seeded together, thus the
+// number of backward traversals is the number of colors divided by `Width`.
+template<std::size_t Width = 8, typename T, typename Fn>
+CsrMatrix<T> sparse_hessian(Fn&& fn, const std::vector<T>& x) {
+    using namespace SparseDerivatives;
+    Pattern pattern;
+    {
+        std::vector<Variable<T>> inputs;
+        inputs.reserve(x.size());
+        for (const T& value : x)
+            inputs.emplace_back(value, true);
+        const Variable<T> output = fn(std::span<const Variable<T>>(inputs));
+        pattern = hessian_sparsity<T>(output, inputs);
+    }
+    const std::vector<Index> colors = color_distance2(pattern);
+    CsrMatrix<T> result = csr_from_pattern<T>(pattern, x.size());
+
+    using Seed = Dual<T, Width>;
+    std::vector<Variable<Seed>> inputs;
+    inputs.reserve(x.size());
+    for (std::size_t begin = 0; begin < num_colors(colors); begin += Width) {
+        // the tangent k of x[j] selects the color `begin + k`
+        inputs.clear();
+        for (std::size_t j = 0; j < x.size(); ++j) {
+            typename Seed::Tangent tangent{};
+            if (colors[j] >= begin && colors[j] < begin + Width)
+                tangent[colors[j] - begin] = 1;
+            inputs.emplace_back(Seed(x[j], tangent), true);
+        }
+        Variable<Seed> output = fn(std::span<const Variable<Seed>>(inputs));
+        output.backward(Seed(1));
+
+        // H(i, j) is entry i of the product with the seed of color(j)
+        for (std::size_t i = 0; i < x.size(); ++i) {
+            const std::optional<Seed> grad = inputs[i].grad_value();
+            if (!grad)
+                continue;
+            for (std::size_t e = result.row_offsets[i]; e < result.row_offsets[i + 1]; ++e) {
+                const Index j = result.col_indices[e];
+                if (colors[j] >= begin && colors[j] < begin + Width)
+                    result.values[e] = grad->tangent(colors[j] - begin);
+            }
+        }
+    }
+    return result;
+}
@@ -0,0 +1,347 @@
+#pragma once
+#include <vector>
+#include <array>
+#include <cstdint>
+#include <cassert>
+#include <cstddef>
+#include <compare>
+#include <type_traits>
+#include <utility>
+
+#include "OperatorRegistry.hpp"
+
+
+
+// The Tape is an alternative execution mode to the graph of shared
+// VariableImpl nodes. Instead of allocating a node, a closure and the
+// parent/child vectors for every operation, each operation appends a single
+// record {op code, input indices, value} to a contiguous, append-only buffer
+// (a Wengert list). Since the records are appended in the order of
+// evaluation, the buffer is already topologically sorted and the backward
+// pass is a single reverse sweep over it.
+//
+// Every thread owns one tape per value type, which is accessed via
+// `Tape<T>::get()`. `reset()` discards all records but keeps the allocated
+// memory, so that e.g. a training loop does not allocate anymore after its
+// first iteration.
+template<typename T>
+class Tape {
+public:
+    using OpCode = OperatorRegistry::OpCode;
+    using Index = std::uint32_t;
+
+    // For scalar operations, which have only one input, `rhs` is the index
+    // of their constants in a separate buffer, and for operations that save
+    // values (see `OperatorRegistry::stored_of()`) the index of those.
+    struct Record {
+        T value;
+        Index lhs;
+        Index rhs;
+        OpCode op;
+    };
+
+    // A guard records the outcome of comparing the value of the record
+    // `index` with the constant `rhs` (see TapeValue).
+    struct Guard {
+        Index index;
+        T rhs;
+        std::partial_ordering ordering;
+    };
+
+    static Tape<T>& get() {
+        thread_local Tape<T> tape;
+        return tape;
+    }
+
+    Index push(OpCode op, T value, Index lhs = 0, Index rhs = 0) {
+        _records.push_back({value, lhs, rhs, op});
+        return static_cast<Index>(_records.size() - 1);
+    }
+
+    Index push_constants(const std::array<T, 2>& constants) {
+        _constants.push_back(constants);
+        return static_cast<Index>(_constants.size() - 1);
+    }
+
+    void push_guard(Index index, T rhs, std::partial_ordering ordering) {
+        _guards.push_back({index, rhs, ordering});
+    }
+
+    // Discards all records and gradients without releasing their memory.
+    void reset() {
+        _records.clear();
+        _constants.clear();
+        _guards.clear();
+        _grads.clear();
+    }
+
+    void reserve(std::size_t size) {
+        _records.reserve(size);
+        _grads.reserve(size);
+    }
+
+    std::size_t size() const { return _records.size(); }
+    const std::vector<Record>& records() const { return _records; }
+    const std::vector<Guard>& guards() const { return _guards; }
+
+    const std::array<T, 2>& constants(const Record& record) const {
+        static constexpr std::array<T, 2> no_constants{};
+        return OperatorRegistry::has_constants(record.op) ? _constants[record.rhs] : no_constants;
+    }
+    // the constants of a record, or the values its operation saved
+    const std::array<T, 2>& stored(const Record& record) const {
+        return OperatorRegistry::saves_values(record.op) ? _constants[record.rhs] : constants(record);
+    }
+    T value(Index index) const { return _records[index].value; }
+    T grad(Index index) const { return index < _grads.size() ? _grads[index] : T(0); }
+
+    // Computes the gradients of the record `root` w.r.t. all records that
+    // precede it. Gradients of a previous backward call are overwritten.
+    void backward(Index root, T prev_grad = 1) {
+        assert(root < _records.size());
+        _grads.assign(_records.size(), T(0));
+        _grads[root] = prev_grad;
+
+        for (Index i = root + 1; i-- > 0;) {
+            const Record& record = _records[i];
+            if (record.op == OpCode::Leaf)
+                continue;
+
+            const T grad = _grads[i];
+            const std::array<T, 2>& stored = this->stored(record);
+            OperatorRegistry::visit(record.op, stored, [&](const auto& op) {
+                if constexpr (std::decay_t<decltype(op)>::arity == 2) {
+                    auto [lhs_grad, rhs_grad] = op.backward_value(_records[record.lhs].value, _records[record.rhs].value, grad);
+                    _grads[record.lhs] += lhs_grad;
+                    _grads[record.rhs] += rhs_grad;
+                } else {
+                    _grads[record.lhs] += OperatorRegistry::unary_backward_value(op, _records[record.lhs].value, record.value, &stored, grad);
+                }
+            });
+        }
+    }
+
+private:
+    std::vector<Record> _records;
+    std::vector<std::array<T, 2>> _constants;
+    std::vector<Guard> _guards;
+    std::vector<T> _grads;
+};
+
+
+// The value of a TapeVariable. The tape only records operations, thus
+// branches on values (like the `if` in `f()` of main.cpp) are invisible to it,
+// and a recording is only valid for inputs that take the same branches.
+// Therefore every comparison of a TapeValue with a constant pushes a guard with
+// its outcome onto the tape, which a BatchProgram checks whenever it replays
+// the recording. Converting a TapeValue to T guards the exact value, since it
+// is unknown what the value is used for.
+template<typename T>
+class TapeValue {
+public:
+    using Index = typename Tape<T>::Index;
+
+    TapeValue(T value, Index index) : _value(value), _index(index) {}
+
+    operator T() const {
+        Tape<T>::get().push_guard(_index, _value, std::partial_ordering::equivalent);
+        return _value;
+    }
+
+    // the value without pushing a guard, e.g. for printing
+    T unguarded() const { return _value; }
+
+    template<typename U> requires std::is_arithmetic_v<U>
+    friend std::partial_ordering operator<=>(const TapeValue<T>& lhs, const U& rhs) {
+        std::partial_ordering ordering = lhs._value <=> static_cast<T>(rhs);
+        Tape<T>::get().push_guard(lhs._index, static_cast<T>(rhs), ordering);
+        return ordering;
+    }
+
+    template<typename U> requires std::is_arithmetic_v<U>
+    friend bool operator==(const TapeValue<T>& lhs, const U& rhs) {
+        return (lhs <=> rhs) == 0;
+    }
+
+private:
+    T _value;
+    Index _index;
+};
+
+
+// A TapeVariable is a lightweight handle, i.e. the index of its record on the
+// tape of the current thread. It mirrors the interface of Variable, so that
+// functions templated on the variable type (like `f()` in main.cpp) can be
+// evaluated in tape mode as well. TapeVariables are only valid until the tape
+// is reset.
+template<typename T>
+class TapeVariable {
+public:
+    using Index = typename Tape<T>::Index;
+
+    TapeVariable() = default;
+
+    TapeVariable(T value)
+        : _index(Tape<T>::get().push(OperatorRegistry::OpCode::Leaf, value)) {}
+
+    TapeValue<T> value() const { return {Tape<T>::get().value(_index), _index}; }
+    T grad() const { return Tape<T>::get().grad(_index); }
+    Index index() const { return _index; }
+
+    void backward(T prev_grad = 1) const {
+        Tape<T>::get().backward(_index, prev_grad);
+    }
+
+    template<typename A, typename Op>
+    friend TapeVariable<A> unary_operation(const TapeVariable<A>& var, const Op& op);
+
+    template<typename A, typename Op>
+    friend TapeVariable<A> binary_operation(const TapeVariable<A>& lhs, const TapeVariable<A>& rhs, const Op& op);
+
+
+    ///////////////////////////////////////////////////////////////////////////
+    ///                          UNARY OPERATIONS                           ///
+    ///////////////////////////////////////////////////////////////////////////
+
+    TapeVariable<T> operator-() const {
+        return unary_operation(*this, OperatorRegistry::Neg{});
+    }
+
+    TapeVariable<T> reciprocal() const {
+        return unary_operation(*this, OperatorRegistry::Reciprocal{});
+    }
+
+    TapeVariable<T> abs() const {
+        return unary_operation(*this, OperatorRegistry::Abs{});
+    }
+
+    TapeVariable<T> exp() const {
+        return unary_operation(*this, OperatorRegistry::Exp{});
+    }
+
+    TapeVariable<T> log() const {
+        return unary_operation(*this, OperatorRegistry::Log{});
+    }
+
+    TapeVariable<T> sin() const {
+        return unary_operation(*this, OperatorRegistry::Sin{});
+    }
+
+    TapeVariable<T> cos() const {
+        return unary_operation(*this, OperatorRegistry::Cos{});
+    }
+
+    TapeVariable<T> tan() const {
+        return unary_operation(*this, OperatorRegistry::Tan{});
+    }
+
+private:
+    explicit TapeVariable(Index index, std::nullptr_t) : _index(index) {}
+
+    Index _index = 0;
+};
+
+
+template<typename T, typename Op>
+TapeVariable<T> unary_operation(const TapeVariable<T>& var, const Op& op) {
+    static_assert(OperatorRegistry::saves_values(Op::code) == requires(const T& val) { op.save(val, val); });
+    Tape<T>& tape = Tape<T>::get();
+    const T val = tape.value(var._index);
+    T out = op(val);
+    typename Tape<T>::Index stored = 0;
+    if constexpr (OperatorRegistry::has_constants(Op::code) || OperatorRegistry::saves_values(Op::code))
+        stored = tape.push_constants(OperatorRegistry::stored_of<T>(op, val, out));
+    typename Tape<T>::Index index = tape.push(Op::code, std::move(out), var._index, stored);
+    return TapeVariable<T>(index, nullptr);
+}
+
+template<typename T, typename Op>
+TapeVariable<T> binary_operation(const TapeVariable<T>& lhs, const TapeVariable<T>& rhs, const Op& op) {
+    Tape<T>& tape = Tape<T>::get();
+    typename Tape<T>::Index index = tape.push(Op::code, op(tape.value(lhs._index), tape.value(rhs._index)), lhs._index, rhs._index);
+    return TapeVariable<T>(index, nullptr);
+}
+
+
+///////////////////////////////////////////////////////////////////////////
+///                          BINARY OPERATIONS                          ///
+///////////////////////////////////////////////////////////////////////////
+
+template<typename T>
+TapeVariable<T> operator+(const TapeVariable<T>& lhs, const TapeVariable<T>& rhs) {
+    return binary_operation(lhs, rhs, OperatorRegistry::Add{});
+}
+
+template<typename T>
+TapeVariable<T> operator+(const TapeVariable<T>& lhs, const T& rhs) {
+    return unary_operation(lhs, OperatorRegistry::Shift<T>{rhs});
+}
+
+template<typename T>
+TapeVariable<T> operator+(const T& lhs, const TapeVariable<T>& rhs) {
+    return unary_operation(rhs, OperatorRegistry::Shift<T>{lhs});
+}
+
+
+
+template<typename T>
+TapeVariable<T> operator-(const TapeVariable<T>& lhs, const TapeVariable<T>& rhs) {
+    return binary_operation(lhs, rhs, OperatorRegistry::Sub{});
+}
+
+template<typename T>
+TapeVariable<T> operator-(const TapeVariable<T>& lhs, const T& rhs) {
+    return unary_operation(lhs, OperatorRegistry::Shift<T>{-rhs});
+}
+
+template<typename T>
+TapeVariable<T> operator-(const T& lhs, const TapeVariable<T>& rhs) {
+    return unary_operation(rhs, OperatorRegistry::Affine<T>{static_cast<T>(-1), lhs});
+}
+
+
+
+template<typename T>
+TapeVariable<T> operator*(const TapeVariable<T>& lhs, const TapeVariable<T>& rhs) {
+    return binary_operation(lhs, rhs, OperatorRegistry::Mul{});
+}
+
+template<typename T>
+TapeVariable<T> operator*(const TapeVariable<T>& lhs, const T& rhs) {
+    return unary_operation(lhs, OperatorRegistry::Scale<T>{rhs});
+}
+
+template<typename T>
+TapeVariable<T> operator*(const T& lhs, const TapeVariable<T>& rhs) {
+    return unary_operation(rhs, OperatorRegistry::Scale<T>{lhs});
+}
+
+
+
+template<typename T>
+TapeVariable<T> operator/(const TapeVariable<T>& lhs, const TapeVariable<T>& rhs) {
+    return binary_operation(lhs, rhs, OperatorRegistry::Div{});
+}
+
+template<typename T>
+TapeVariable<T> operator/(const TapeVariable<T>& lhs, const T& rhs) {
+    return unary_operation(lhs, OperatorRegistry::DivScalar<T>{rhs});
+}
+
+template<typename T>
+TapeVariable<T> operator/(const T& lhs, const TapeVariable<T>& rhs) {
+    return unary_operation(rhs, OperatorRegistry::RDivScalar<T>{lhs});
+}
+
+
+
+///////////////////////////////////////////////////////////////////////////
+///                              PRINTING                               ///
+///////////////////////////////////////////////////////////////////////////
+
+template<typename T>
+struct std::formatter<TapeValue<T>> : std::formatter<T> {
+    auto format(const TapeValue<T>& value, format_context& ctx) const {
+        return std::formatter<T>::format(value.unguarded(), ctx);
+    }
+};
@@ -0,0 +1,494 @@
+#pragma once
+#include <new>
+#include <array>
+#include <span>
+#include <memory>
+#include <cmath>
+#include <cassert>
+#include <cstddef>
+#include <algorithm>
+#include <type_traits>
+#include <initializer_list>
+
+#include "Kernels.hpp"
+#include "VectorMath.hpp"
+
+
+
+// A Tensor is an n-dimensional array of arithmetic values with contiguous,
+// row-major storage. It can be used as the value type of Variable, e.g.
+// `Variable<Tensor<float>>`, so that a single node of the computational graph
+// holds a whole array instead of one scalar and the number of nodes scales
+// with the number of operations instead of the number of elements.
+//
+// Tensors have value semantics with copy-on-write storage: copies share their
+// storage (which makes passing them around as cheap as copying a shared_ptr),
+// and the storage is only copied when a tensor whose storage is shared is
+// modified. The storage is aligned to `alignment` bytes, i.e. to the width of
+// the largest vector registers, and all elementwise kernels operate on plain
+// pointers in fixed-size blocks, which lets the compiler vectorize them.
+//
+// Binary operations broadcast their operands like NumPy: the shapes are
+// aligned at their last dimension and every dimension of size one (or that is
+// missing) is repeated to match the other operand. A 0-dimensional tensor
+// holds a single value and broadcasts to every shape.
+
+
+// The shape of a tensor. The dimensions are stored inline, so that copying a
+// tensor never allocates.
+class TensorShape {
+public:
+    static constexpr std::size_t max_dims = 6;
+
+    TensorShape() = default;
+    TensorShape(std::initializer_list<std::size_t> dims) : _ndim(dims.size()) {
+        assert(dims.size() <= max_dims && "too many dimensions");
+        std::copy(dims.begin(), dims.end(), _dims.begin());
+    }
+
+    std::size_t ndim() const { return _ndim; }
+    std::size_t numel() const {
+        std::size_t numel = 1;
+        for (std::size_t dim : *this)
+            numel *= dim;
+        return numel;
+    }
+
+    std::size_t operator[](std::size_t i) const { return _dims[i]; }
+    std::size_t& operator[](std::size_t i) { return _dims[i]; }
+    const std::size_t* begin() const { return _dims.data(); }
+    const std::size_t* end() const { return _dims.data() + _ndim; }
+
+    void resize(std::size_t ndim) {
+        assert(ndim <= max_dims && "too many dimensions");
+        _ndim = ndim;
+    }
+
+    bool operator==(const TensorShape& other) const {
+        return std::equal(begin(), end(), other.begin(), other.end());
+    }
+
+private:
+    std::array<std::size_t, max_dims> _dims{};
+    std::size_t _ndim = 0;
+};
+
+using TensorStrides = std::array<std::size_t, TensorShape::max_dims>;
+
+
+// Calls `fn(index, lhs_offset, rhs_offset)` for every element of `shape` in
+// row-major order, where the offsets of both operands advance by their
+// respective strides (which are zero along broadcast dimensions).
+namespace Kernels {
+
+    template<typename Fn>
+    void for_each_broadcast(const TensorShape& shape, const TensorStrides& lhs_strides, const TensorStrides& rhs_strides, Fn fn) {
+        const std::size_t ndim = shape.ndim();
+        const std::size_t size = shape.numel();
+        TensorStrides index{};
+        std::size_t lhs_offset = 0;
+        std::size_t rhs_offset = 0;
+        for (std::size_t i = 0; i < size; ++i) {
+            fn(i, lhs_offset, rhs_offset);
+            for (std::size_t d = ndim; d-- > 0;) {
+                lhs_offset += lhs_strides[d];
+                rhs_offset += rhs_strides[d];
+                if (++index[d] < shape[d])
+                    break;
+                lhs_offset -= lhs_strides[d] * shape[d];
+                rhs_offset -= rhs_strides[d] * shape[d];
+                index[d] = 0;
+            }
+        }
+    }
+}
+
+
+template<typename T>
+class Tensor {
+    static_assert(std::is_arithmetic_v<T>, "tensors hold arithmetic values");
+
+public:
+    using value_type = T;
+    using Shape = TensorShape;
+    using Strides = TensorStrides;
+
+    static constexpr std::size_t alignment = 64;
+
+    // A default constructed tensor is a 0-dimensional zero. All of them share
+    // the same storage, so that e.g. the unused constants of graph nodes do
+    // not allocate.
+    Tensor() : _storage(shared_zero()) {}
+
+    // 0-dimensional tensor, which broadcasts to every shape
+    Tensor(T value) : Tensor(Shape{}, value) {}
+
+    Tensor(const Shape& shape, T fill) : _shape(shape), _storage(allocate(shape.numel())) {
+        std::fill_n(_storage.get(), size(), fill);
+    }
+
+    Tensor(const Shape& shape, std::span<const T> values) : _shape(shape), _storage(allocate(shape.numel())) {
+        assert(values.size() == size() && "the number of values does not match the shape");
+        std::copy(values.begin(), values.end(), _storage.get());
+    }
+
+    Tensor(const Shape& shape, std::initializer_list<T> values)
+        : Tensor(shape, std::span<const T>(values.begin(), values.size())) {}
+
+    static Tensor zeros(const Shape& shape) { return Tensor(shape, T(0)); }
+    static Tensor ones(const Shape& shape) { return Tensor(shape, T(1)); }
+
+    // Tensor with uninitialized values, which is only used as the output of
+    // kernels that overwrite all of its values.
+    static Tensor empty(const Shape& shape) { return Tensor(shape, allocate(shape.numel())); }
+
+    const Shape& shape() const { return _shape; }
+    std::size_t ndim() const { return _shape.ndim(); }
+    std::size_t size() const { return _shape.numel(); }
+
+    // Row-major strides in number of elements.
+    Strides strides() const {
+        Strides strides{};
+        std::size_t stride = 1;
+        for (std::size_t d = ndim(); d-- > 0;) {
+            strides[d] = stride;
+            stride *= _shape[d];
+        }
+        return strides;
+    }
+
+    // Strides of this tensor when broadcast to `shape`, which are zero along
+    // all dimensions that are repeated.
+    Strides broadcast_strides(const Shape& shape) const {
+        assert(ndim() <= shape.ndim() && "cannot broadcast to fewer dimensions");
+        Strides own = strides();
+        Strides strides{};
+        const std::size_t offset = shape.ndim() - ndim();
+        for (std::size_t d = 0; d < ndim(); ++d)
+            strides[offset + d] = _shape[d] == 1 ? 0 : own[d];
+        return strides;
+    }
+
+    const T* data() const { return _storage.get(); }
+    // Mutable access detaches the storage if it is shared with other tensors.
+    T* data() {
+        detach();
+        return _storage.get();
+    }
+
+    T operator[](std::size_t i) const { return data()[i]; }
+    T& operator[](std::size_t i) { return data()[i]; }
+
+    T item() const {
+        assert(size() == 1 && "only tensors with a single element can be converted to a value");
+        return data()[0];
+    }
+
+    Tensor clone() const {
+        return Tensor(_shape, std::span<const T>(data(), size()));
+    }
+
+    // Accumulates in place if the shapes match, which is the common case for
+    // gradients.
+    Tensor& operator+=(const Tensor& other) {
+        if (_shape != other._shape || &other == this)
+            return *this = *this + other;
+        const T* in = other.data();
+        Kernels::accumulate(in, data(), size());
+        return *this;
+    }
+
+
+    ///////////////////////////////////////////////////////////////////////////
+    ///                          BINARY OPERATIONS                          ///
+    ///////////////////////////////////////////////////////////////////////////
+
+    // The operators are hidden friends, thus plain values are implicitly
+    // converted to 0-dimensional tensors, e.g. `tensor * 2`.
+
+    friend Tensor operator+(const Tensor& lhs, const Tensor& rhs) {
+        return zip(lhs, rhs, [](T x, T y) { return x + y; });
+    }
+
+    friend Tensor operator-(const Tensor& lhs, const Tensor& rhs) {
+        return zip(lhs, rhs, [](T x, T y) { return x - y; });
+    }
+
+    friend Tensor operator*(const Tensor& lhs, const Tensor& rhs) {
+        return zip(lhs, rhs, [](T x, T y) { return x * y; });
+    }
+
+    friend Tensor operator/(const Tensor& lhs, const Tensor& rhs) {
+        return zip(lhs, rhs, [](T x, T y) { return x / y; });
+    }
+
+    friend Tensor operator-(const Tensor& val) {
+        return map(val, [](T x) { return -x; });
+    }
+
+    // Applies `fn` to every element.
+    template<typename Fn>
+    static Tensor map(const Tensor& val, Fn fn) {
+        Tensor out = empty(val.shape());
+        Kernels::map(val.data(), out.data(), out.size(), fn);
+        return out;
+    }
+
+    // Applies a kernel `fn(in, out, size)` that processes all elements at
+    // once, e.g. the functions of VectorMath.
+    template<typename Fn>
+    static Tensor map_array(const Tensor& val, Fn fn) {
+        Tensor out = empty(val.shape());
+        fn(val.data(), out.data(), out.size());
+        return out;
+    }
+
+    // Applies `fn` to every pair of elements of the broadcast operands.
+    template<typename Fn>
+    static Tensor zip(const Tensor& lhs, const Tensor& rhs, Fn fn) {
+        const Shape shape = broadcast_shape(lhs.shape(), rhs.shape());
+        Tensor out = empty(shape);
+        T* out_data = out.data();
+        const T* lhs_data = lhs.data();
+        const T* rhs_data = rhs.data();
+
+        if (lhs.shape() == shape && rhs.shape() == shape) {
+            Kernels::zip(lhs_data, rhs_data, out_data, out.size(), fn);
+        } else if (lhs.shape() == shape && rhs.size() == 1) {
+            const T y = rhs_data[0];
+            Kernels::map(lhs_data, out_data, out.size(), [&](T x) { return fn(x, y); });
+        } else if (rhs.shape() == shape && lhs.size() == 1) {
+            const T x = lhs_data[0];
+            Kernels::map(rhs_data, out_data, out.size(), [&](T y) { return fn(x, y); });
+        } else {
+            Kernels::for_each_broadcast(shape, lhs.broadcast_strides(shape), rhs.broadcast_strides(shape),
+                [&](std::size_t i, std::size_t l, std::size_t r) { out_data[i] = fn(lhs_data[l], rhs_data[r]); });
+        }
+        return out;
+    }
+
+    static Shape broadcast_shape(const Shape& lhs, const Shape& rhs) {
+        Shape shape;
+        shape.resize(std::max(lhs.ndim(), rhs.ndim()));
+        for (std::size_t d = 0; d < shape.ndim(); ++d) {
+            // dimensions are aligned at the last one, missing ones are 1
+            const std::size_t l = d + lhs.ndim() >= shape.ndim() ? lhs[d + lhs.ndim() - shape.ndim()] : 1;
+            const std::size_t r = d + rhs.ndim() >= shape.ndim() ? rhs[d + rhs.ndim() - shape.ndim()] : 1;
+            assert((l == r || l == 1 || r == 1) && "shapes cannot be broadcast");
+            shape[d] = l == 1 ? r : l;
+        }
+        return shape;
+    }
+
+private:
+    Tensor(const Shape& shape, std::shared_ptr<T[]> storage) : _shape(shape), _storage(std::move(storage)) {}
+
+    static std::shared_ptr<T[]> allocate(std::size_t size) {
+        void* ptr = ::operator new(std::max<std::size_t>(size, 1) * sizeof(T), std::align_val_t{alignment});
+        return std::shared_ptr<T[]>(static_cast<T*>(ptr), [](T* ptr) {
+            ::operator delete(ptr, std::align_val_t{alignment});
+        });
+    }
+
+    static const std::shared_ptr<T[]>& shared_zero() {
+        static const std::shared_ptr<T[]> zero = [] {
+            std::shared_ptr<T[]> zero = allocate(1);
+            zero[0] = T(0);
+            return zero;
+        }();
+        return zero;
+    }
+
+    void detach() {
+        if (_storage.use_count() > 1) {
+            std::shared_ptr<T[]> storage = allocate(size());
+            std::copy_n(_storage.get(), size(), storage.get());
+            _storage = std::move(storage);
+        }
+    }
+
+    Shape _shape;
+    std::shared_ptr<T[]> _storage;
+};
+
+
+///////////////////////////////////////////////////////////////////////////
+///                          UNARY OPERATIONS                           ///
+///////////////////////////////////////////////////////////////////////////
+
+// The elementwise functions are found via argument dependent lookup, which
+// lets the operations of the OperatorRegistry call e.g. `exp(val)` on scalars
+// and tensors alike.
+
+template<typename T>
+Tensor<T> abs(const Tensor<T>& val) {
+    return Tensor<T>::map(val, [](T x) { return std::abs(x); });
+}
+
+template<typename T>
+Tensor<T> sign(const Tensor<T>& val) {
+    return Tensor<T>::map(val, [](T x) { return T((x > 0) - (x < 0)); });
+}
+
+template<typename T>
+Tensor<T> exp(const Tensor<T>& val) {
+    return Tensor<T>::map_array(val, VectorMath::exp<T>);
+}
+
+template<typename T>
+Tensor<T> log(const Tensor<T>& val) {
+    return Tensor<T>::map_array(val, VectorMath::log<T>);
+}
+
+template<typename T>
+Tensor<T> sin(const Tensor<T>& val) {
+    return Tensor<T>::map_array(val, VectorMath::sin<T>);
+}
+
+template<typename T>
+Tensor<T> cos(const Tensor<T>& val) {
+    return Tensor<T>::map_array(val, VectorMath::cos<T>);
+}
+
+template<typename T>
+Tensor<T> tan(const Tensor<T>& val) {
+    return Tensor<T>::map_array(val, VectorMath::tan<T>);
+}
+
+
+///////////////////////////////////////////////////////////////////////////
+///                             REDUCTIONS                              ///
+///////////////////////////////////////////////////////////////////////////
+
+template<typename T>
+std::size_t numel(const Tensor<T>& val) {
+    return val.size();
+}
+
+template<typename T>
+std::size_t heap_bytes(const Tensor<T>& val) {
+    return val.size() * sizeof(T);
+}
+
+template<typename T>
+bool same_shape(const Tensor<T>& lhs, const Tensor<T>& rhs) {
+    return lhs.shape() == rhs.shape();
+}
+
+// Sum of all elements as a 0-dimensional tensor.
+template<typename T>
+Tensor<T> sum(const Tensor<T>& val) {
+    return Tensor<T>(Kernels::sum(val.data(), val.size()));
+}
+
+template<typename T>
+Tensor<T> mean(const Tensor<T>& val) {
+    return Tensor<T>(Kernels::sum(val.data(), val.size()) / static_cast<T>(val.size()));
+}
+
+// Brings `val` to the shape of `like` by summing over all dimensions along
+// which `like` is broadcast, and by repeating `val` along all dimensions along
+// which `val` is broadcast. This is the backward operation of broadcasting:
+// the gradient w.r.t. a broadcast operand is the sum of the gradients of all
+// elements it has been repeated to.
+template<typename T>
+Tensor<T> sum_to(const Tensor<T>& val, const Tensor<T>& like) {
+    if (val.shape() == like.shape())
+        return val;
+
+    const TensorShape shape = Tensor<T>::broadcast_shape(val.shape(), like.shape());
+    Tensor<T> out = Tensor<T>::zeros(like.shape());
+    T* out_data = out.data();
+    const T* val_data = val.data();
+    Kernels::for_each_broadcast(shape, val.broadcast_strides(shape), out.broadcast_strides(shape),
+        [&](std::size_t, std::size_t v, std::size_t o) { out_data[o] += val_data[v]; });
+    return out;
+}
+
+
+///////////////////////////////////////////////////////////////////////////
+///                           MATRIX PRODUCTS                           ///
+///////////////////////////////////////////////////////////////////////////
+
+// Transpose of a matrix; tensors with fewer dimensions are returned as is.
+template<typename T>
+Tensor<T> transpose(const Tensor<T>& val) {
+    if (val.ndim() < 2)
+        return val;
+    assert(val.ndim() == 2 && "only matrices can be transposed");
+
+    constexpr std::size_t block = 32;
+    const std::size_t rows = val.shape()[0];
+    const std::size_t cols = val.shape()[1];
+    Tensor<T> out = Tensor<T>::empty({cols, rows});
+    T* out_data = out.data();
+    const T* val_data = val.data();
+    for (std::size_t i0 = 0; i0 < rows; i0 += block)
+        for (std::size_t j0 = 0; j0 < cols; j0 += block)
+            for (std::size_t i = i0; i < std::min(i0 + block, rows); ++i)
+                for (std::size_t j = j0; j < std::min(j0 + block, cols); ++j)
+                    out_data[j * rows + i] = val_data[i * cols + j];
+    return out;
+}
+
+// Product of the matrices `lhs` (m x k) and `rhs` (k x n).
+//
+// The loops are tiled, such that a tile of `rhs` and a tile of rows of the
+// output stay in cache while they are reused, and ordered i-k-j, such that the
+// innermost loop adds a scaled, contiguous row of `rhs` to a contiguous row of
+// the output, which is vectorized.
+template<typename T>
+Tensor<T> matmul(const Tensor<T>& lhs, const Tensor<T>& rhs) {
+    assert(lhs.ndim() == 2 && rhs.ndim() == 2 && "matmul expects matrices");
+    assert(lhs.shape()[1] == rhs.shape()[0] && "inner dimensions of matmul do not match");
+
+    constexpr std::size_t block = 64;
+    const std::size_t m = lhs.shape()[0];
+    const std::size_t k = lhs.shape()[1];
+    const std::size_t n = rhs.shape()[1];
+    Tensor<T> out = Tensor<T>::zeros({m, n});
+    T* out_data = out.data();
+    const T* lhs_data = lhs.data();
+    const T* rhs_data = rhs.data();
+    for (std::size_t i0 = 0; i0 < m; i0 += block)
+        for (std::size_t p0 = 0; p0 < k; p0 += block)
+            for (std::size_t j0 = 0; j0 < n; j0 += block) {
+                const std::size_t j_size = std::min(j0 + block, n) - j0;
+                for (std::size_t i = i0; i < std::min(i0 + block, m); ++i)
+                    for (std::size_t p = p0; p < std::min(p0 + block, k); ++p)
+                        Kernels::axpy(lhs_data[i * k + p], rhs_data + p * n + j0, out_data + i * n + j0, j_size);
+            }
+    return out;
+}
+
+
+///////////////////////////////////////////////////////////////////////////
+///                              PRINTING                               ///
+///////////////////////////////////////////////////////////////////////////
+
+// Custom formatter of Tensor, which prints nested lists of its elements with
+// the format of its value type, e.g. `std::println("{:.3f}", tensor)`.
+template<typename T>
+struct std::formatter<Tensor<T>> : std::formatter<T> {
+    auto format(const Tensor<T>& tensor, format_context& ctx) const {
+        auto out = std::format_to(ctx.out(), "Tensor(");
+        std::size_t index = 0;
+        out = format_dim(tensor, 0, index, ctx, out);
+        return std::format_to(out, ")");
+    }
+
+private:
+    auto format_dim(const Tensor<T>& tensor, std::size_t dim, std::size_t& index, format_context& ctx, auto out) const -> decltype(out) {
+        if (dim == tensor.ndim()) {
+            ctx.advance_to(out);
+            return std::formatter<T>::format(tensor[index++], ctx);
+        }
+        out = std::format_to(out, "[");
+        for (std::size_t i = 0; i < tensor.shape()[dim]; ++i) {
+            if (i > 0)
+                out = std::format_to(out, ", ");
+            out = format_dim(tensor, dim + 1, index, ctx, out);
+        }
+        return std::format_to(out, "]");
+    }
+};
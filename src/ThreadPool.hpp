@@ -0,0 +1,175 @@
+#pragma once
+#include <mutex>
+#include <deque>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <cstddef>
+#include <algorithm>
+#include <functional>
+#include <condition_variable>
+
+
+
+// A fixed set of worker threads, which run jobs together with the thread that
+// submits them. The pool does not own a queue of tasks itself; instead, a job
+// is broadcast to all threads, which then share its work among each other,
+// e.g. via `process_all()`.
+class ThreadPool {
+public:
+    // The calling thread of `broadcast()` counts as one of the threads.
+    explicit ThreadPool(std::size_t num_threads = std::max(1u, std::thread::hardware_concurrency())) {
+        for (std::size_t thread = 1; thread < num_threads; ++thread)
+            _workers.emplace_back([this, thread] { work(thread); });
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard lock(_mutex);
+            _stop = true;
+        }
+        _start.notify_all();
+        for (std::thread& worker : _workers)
+            worker.join();
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    static ThreadPool& global() {
+        static ThreadPool pool;
+        return pool;
+    }
+
+    std::size_t size() const { return _workers.size() + 1; }
+
+    // Calls `job(thread)` once on every thread of the pool, where the calling
+    // thread is thread 0, and returns once all calls have returned. Jobs must
+    // not broadcast to the same pool themselves.
+    void broadcast(const std::function<void(std::size_t)>& job) {
+        std::lock_guard broadcast_lock(_broadcast_mutex);
+        {
+            std::lock_guard lock(_mutex);
+            _job = &job;
+            _running = _workers.size();
+            ++_generation;
+        }
+        _start.notify_all();
+
+        job(0);
+
+        std::unique_lock lock(_mutex);
+        _done.wait(lock, [this] { return _running == 0; });
+        _job = nullptr;
+    }
+
+private:
+    void work(std::size_t thread) {
+        std::size_t generation = 0;
+        while (true) {
+            const std::function<void(std::size_t)>* job;
+            {
+                std::unique_lock lock(_mutex);
+                _start.wait(lock, [&] { return _stop || _generation != generation; });
+                if (_stop)
+                    return;
+                generation = _generation;
+                job = _job;
+            }
+
+            (*job)(thread);
+
+            std::lock_guard lock(_mutex);
+            if (--_running == 0)
+                _done.notify_one();
+        }
+    }
+
+    std::vector<std::thread> _workers;
+    std::mutex _broadcast_mutex;
+    std::mutex _mutex;
+    std::condition_variable _start;
+    std::condition_variable _done;
+    const std::function<void(std::size_t)>* _job = nullptr;
+    std::size_t _generation = 0;
+    std::size_t _running = 0;
+    bool _stop = false;
+};
+
+
+// One queue of items per thread. Every thread pushes to and pops from the back
+// of its own queue, i.e. it processes the items it created most recently
+// first, which keeps their data in its cache. Threads whose queue is empty
+// steal the oldest item from the front of another queue.
+template<typename Item>
+class WorkStealingQueues {
+public:
+    explicit WorkStealingQueues(std::size_t num_threads)
+        : _queues(std::make_unique<Queue[]>(num_threads)), _num_threads(num_threads) {}
+
+    void push(std::size_t thread, Item item) {
+        std::lock_guard lock(_queues[thread].mutex);
+        _queues[thread].items.push_back(std::move(item));
+    }
+
+    bool pop(std::size_t thread, Item& item) {
+        for (std::size_t i = 0; i < _num_threads; ++i) {
+            Queue& queue = _queues[(thread + i) % _num_threads];
+            std::lock_guard lock(queue.mutex);
+            if (queue.items.empty())
+                continue;
+            if (i == 0) {
+                item = std::move(queue.items.back());
+                queue.items.pop_back();
+            } else {
+                item = std::move(queue.items.front());
+                queue.items.pop_front();
+            }
+            return true;
+        }
+        return false;
+    }
+
+private:
+    // each queue on its own cache line to avoid false sharing
+    struct alignas(64) Queue {
+        std::mutex mutex;
+        std::deque<Item> items;
+    };
+
+    std::unique_ptr<Queue[]> _queues;
+    std::size_t _num_threads;
+};
+
+
+// Processes the `initial` items and all items that are pushed while processing
+// them on all threads of `pool`. `fn(item, thread, push)` processes a single
+// item, where `push(item)` adds a new item. Returns once all items have been
+// processed.
+template<typename Item, typename Fn>
+void process_all(ThreadPool& pool, std::vector<Item> initial, Fn fn) {
+    WorkStealingQueues<Item> queues(pool.size());
+    // An item is pending from being pushed until it has been processed, and
+    // the items that an item pushes are counted before the item itself is
+    // done, thus `pending` only reaches zero once all items are processed.
+    std::atomic<std::size_t> pending = initial.size();
+    for (std::size_t i = 0; i < initial.size(); ++i)
+        queues.push(i % pool.size(), std::move(initial[i]));
+
+    pool.broadcast([&](std::size_t thread) {
+        auto push = [&](Item item) {
+            pending.fetch_add(1, std::memory_order_relaxed);
+            queues.push(thread, std::move(item));
+        };
+        Item item;
+        while (pending.load(std::memory_order_acquire) > 0) {
+            if (queues.pop(thread, item)) {
+                fn(std::move(item), thread, push);
+                pending.fetch_sub(1, std::memory_order_acq_rel);
+            } else {
+                std::this_thread::yield();
+            }
+        }
+    });
+}
@@ -2,226 +2,24 @@
 #include <iostream>
 #include <vector>
 #include <memory>
-#include <functional>
+#include <span>
 #include <cmath>
+#include <type_traits>
+#include <utility>
 
 #include "VariableImpl.hpp"
+#include "OperatorRegistry.hpp"
 
 
 
 template<typename T> class Variable;
 
-namespace OperatorRegistry {
-
-    ///////////////////////////////////////////////////////////////////////////
-    ///                          BINARY OPERATIONS                          ///
-    ///////////////////////////////////////////////////////////////////////////
-
-    struct Add {
-        template<typename T>
-        T operator()(const T lhs, const T rhs) const { return lhs + rhs; }
-
-
-        template<typename T>
-        std::vector<Variable<T>> backward(const Variable<T>& lhs, const Variable<T>& rhs, const Variable<T>& prev_grad) const {
-            return {prev_grad, prev_grad};
-        }
-
-        // template<typename T>
-        // std::vector<Variable<T>> backward(const std::shared_ptr<VariableImpl<T>>& lhs_impl, const std::shared_ptr<VariableImpl<T>>& rhs_impl, const Variable<T>& prev_grad) const {
-        //     return {prev_grad, prev_grad};
-        // }
-    };
-
-    struct Sub {
-        template<typename T>
-        T operator()(const T lhs, const T rhs) const { return lhs - rhs; }
-
-        template<typename T>
-        std::vector<Variable<T>> backward(const Variable<T>& lhs, const Variable<T>& rhs, const Variable<T>& prev_grad) const {
-            return {prev_grad, -prev_grad};
-        }
-
-        // template<typename T>
-        // std::vector<Variable<T>> backward(const std::shared_ptr<VariableImpl<T>>& lhs_impl, const std::shared_ptr<VariableImpl<T>>& rhs_impl, const Variable<T>& prev_grad) const {
-        //     return {prev_grad, -prev_grad};
-        // }
-    };
-
-    struct Mul {
-        template<typename T>
-        T operator()(const T lhs, const T rhs) const { return lhs * rhs; }
-
-        template<typename T>
-        std::vector<Variable<T>> backward(const Variable<T>& lhs, const Variable<T>& rhs, const Variable<T>& prev_grad) const {
-            return {prev_grad * rhs, prev_grad * lhs};
-        }
-        
-        // template<typename T>
-        // std::vector<Variable<T>> backward(const std::shared_ptr<VariableImpl<T>>& lhs_impl, const std::shared_ptr<VariableImpl<T>>& rhs_impl, const Variable<T>& prev_grad) const {
-        //     Variable<T> lhs(lhs_impl);
-        //     Variable<T> rhs(rhs_impl);
-        //     return {prev_grad * rhs, prev_grad * lhs};
-        // }
-    };
-
-    struct Div {
-        template<typename T>
-        T operator()(const T lhs, const T rhs) const { return lhs / rhs; }
-
-        template<typename T>
-        std::vector<Variable<T>> backward(const Variable<T>& lhs, const Variable<T>& rhs, const Variable<T>& prev_grad) const {
-            return {prev_grad / rhs, prev_grad * -lhs / (rhs * rhs)};
-        }
-
-        // template<typename T>
-        // std::vector<Variable<T>> backward(const std::shared_ptr<VariableImpl<T>>& lhs_impl, const std::shared_ptr<VariableImpl<T>>& rhs_impl, const Variable<T>& prev_grad) const {
-        //     Variable<T> lhs(lhs_impl);
-        //     Variable<T> rhs(rhs_impl);
-        //     return {prev_grad / rhs, prev_grad * -lhs / (rhs * rhs)};;
-        // }
-    };
-
-    ///////////////////////////////////////////////////////////////////////////
-    ///                          UNARY OPERATIONS                           ///
-    ///////////////////////////////////////////////////////////////////////////
-
-    struct Neg {
-        template<typename T>
-        T operator()(const T val) const { return -val; }
-
-        template<typename T>
-         std::vector<Variable<T>> backward(const Variable<T>& var, const Variable<T>& prev_grad) const {
-            return {-prev_grad};
-        }
-
-        // template<typename T>
-        // std::vector<Variable<T>> backward(const std::shared_ptr<VariableImpl<T>>& var_impl, const Variable<T>& prev_grad) const {
-        //     return {-prev_grad};
-        // }        
-    };
-
-    struct Reciprocal {
-        template<typename T>
-        T operator()(const T val) const { return 1/val; }
-
-        template<typename T>
-         std::vector<Variable<T>> backward(const Variable<T>& var, const Variable<T>& prev_grad) const {
-            return {prev_grad * static_cast<T>(-1) / (var * var)};
-        }
-
-        // template<typename T>
-        // std::vector<Variable<T>> backward(const std::shared_ptr<VariableImpl<T>>& var_impl, const Variable<T>& prev_grad) const {
-        //     Variable<T> var(var_impl);
-        //     return {prev_grad * static_cast<T>(-1) / (var * var)};
-        // } 
-    };
-
-    struct Abs {
-        template<typename T>
-        T operator()(const T val) const { return std::abs(val); }
-
-        template<typename T>
-         std::vector<Variable<T>> backward(const Variable<T>& var, const Variable<T>& prev_grad) const {
-            T sign = var.value() > 0 ? 1 : var.value() < 0 ? -1 : 0;
-            return {prev_grad * sign};
-        }
-
-        // template<typename T>
-        // std::vector<Variable<T>> backward(const std::shared_ptr<VariableImpl<T>>& var_impl, const Variable<T>& prev_grad) const {
-        //     // Variable<T> var(var_impl);
-        //     T sign = var_impl->value() > 0 ? 1 : var_impl->value() < 0 ? -1 : 0;
-        //     return {prev_grad * sign};
-        // } 
-    };
-
-    struct Exp {
-        template<typename T>
-        T operator()(const T val) const { return std::exp(val); }
-
-        template<typename T>
-         std::vector<Variable<T>> backward(const Variable<T>& var, const Variable<T>& prev_grad) const {
-            return {prev_grad * var.exp()};
-        }
-
-        // template<typename T>
-        // std::vector<Variable<T>> backward(const std::shared_ptr<VariableImpl<T>>& var_impl, const Variable<T>& prev_grad) const {
-        //     Variable<T> var(var_impl);
-        //     return {prev_grad * var.exp()};
-        // } 
-    };
-
-    struct Log {
-        template<typename T>
-        T operator()(const T val) const { return std::log(val); }
-
-        template<typename T>
-         std::vector<Variable<T>> backward(const Variable<T>& var, const Variable<T>& prev_grad) const {
-            return {prev_grad * (static_cast<T>(1) / var)};
-        }
-
-        // template<typename T>
-        // std::vector<Variable<T>> backward(const std::shared_ptr<VariableImpl<T>>& var_impl, const Variable<T>& prev_grad) const {
-        //     Variable<T> var(var_impl);
-        //     return {prev_grad / var};
-        // } 
-    };
-
-    struct Sin {
-        template<typename T>
-        T operator()(const T val) const { return std::sin(val); }
-
-        template<typename T>
-         std::vector<Variable<T>> backward(const Variable<T>& var, const Variable<T>& prev_grad) const {
-            return {prev_grad * var.cos()};
-        }
-
-        // template<typename T>
-        // std::vector<Variable<T>> backward(const std::shared_ptr<VariableImpl<T>>& var_impl, const Variable<T>& prev_grad) const {
-        //     Variable<T> var(var_impl);
-        //     return {prev_grad * var.cos()};
-        // } 
-    };
-
-    struct Cos {
-        template<typename T>
-        T operator()(const T val) const { return std::cos(val); }
-
-        template<typename T>
-         std::vector<Variable<T>> backward(const Variable<T>& var, const Variable<T>& prev_grad) const {
-            return {prev_grad * -var.sin()};
-        }
-
-        // template<typename T>
-        // std::vector<Variable<T>> backward(const std::shared_ptr<VariableImpl<T>>& var_impl, const Variable<T>& prev_grad) const {
-        //     Variable<T> var(var_impl);
-        //     return {prev_grad * -var.sin()};
-        // } 
-    };
-
-    struct Tan {
-        template<typename T>
-        T operator()(const T val) const { return std::tan(val); }
-
-        template<typename T>
-         std::vector<Variable<T>> backward(const Variable<T>& var, const Variable<T>& prev_grad) const {
-            return {prev_grad * static_cast<T>(1)/(var.cos() * var.cos())};
-        }
-
-        // template<typename T>
-        // std::vector<Variable<T>> backward(const std::shared_ptr<VariableImpl<T>>& var_impl, const Variable<T>& prev_grad) const {
-        //     Variable<T> var(var_impl);
-        //     return {prev_grad / (var.cos() * var.cos())};
-        // } 
-    };
-}
-
 
 // The Variable class has two purposes:
 // (1) it wraps a std::shared_pointer<VariableImpl<T>>
 // (2) defines basic arithmetic operations for these shared pointers as well as
-//     registers the backward function, which maps the grad w.r.t. the output
-//     to the grad w.r.t. the input
+//     registers the operation, whose backward function maps the grad w.r.t.
+//     the output to the grad w.r.t. the input
 template<typename T>
 class Variable {
 public:
@@ -256,8 +54,9 @@ public:
         return *this;
     }
 
-    T value() const { return _variable->value(); }
-    std::optional<Variable<T>> grad() const { return _variable->grad(); }   
+    const T& value() const { return _variable->value(); }
+    std::optional<Variable<T>> grad() const { return _variable->grad(); }
+    std::optional<T> grad_value() const { return _variable->grad_value(); }
     void zero_grad() { _variable->zero_grad(); }
     bool requires_grad() const { return _variable->requires_grad(); }
     bool set_requires_grad(bool v = true) { return _variable->set_requires_grad(v); }
@@ -272,10 +71,16 @@ public:
             // graphs need to be retained.
             assert(retain_graph && "create_graph required retain_graph");
         }
-        _variable->backward(Variable(prev_grad, create_graph, false), retain_graph, nullptr, _variable);
+        _variable->backward(prev_grad, retain_graph, create_graph);
     }
 
-    const std::vector<std::shared_ptr<VariableImpl<T>>>& parents() const {
+    // First-order backward pass that processes independent branches of the
+    // graph in parallel, see `VariableImpl::backward_parallel()`.
+    void backward_parallel(ThreadPool& pool = ThreadPool::global(), T prev_grad = 1, bool retain_graph = false) {
+        _variable->backward_parallel(prev_grad, retain_graph, pool);
+    }
+
+    std::span<const std::shared_ptr<VariableImpl<T>>> parents() const {
         return _variable->parents();
     }
 
@@ -295,43 +100,100 @@ public:
     friend Variable<A> unary_operation(const Variable<A>& var, const Op& op);
 
     template<typename A, typename Op>
-    friend Variable<A> binary_operation(const Variable<A>& lhs, const Variable<A>& rhs, const Op& op);
+    friend Variable<A> unary_operation(Variable<A>&& var, const Op& op);
+
+    template<typename A, typename Op>
+    friend Variable<A> binary_operation(Variable<A> lhs, Variable<A> rhs, const Op& op);
 
 
     ///////////////////////////////////////////////////////////////////////////
     ///                          UNARY OPERATIONS                           ///
     ///////////////////////////////////////////////////////////////////////////
 
+    // Elementwise operations on temporaries are fused into a single node,
+    // see `unary_operation()`, thus they also take rvalues.
+
     template<typename A>
-    friend Variable<A> operator-(const Variable<A>& var);
+    friend Variable<A> operator-(Variable<A> var);
 
-    Variable<T> reciprocal() const {
+    Variable<T> reciprocal() const& {
         return unary_operation(*this, OperatorRegistry::Reciprocal{});
     }
+    Variable<T> reciprocal() && {
+        return unary_operation(std::move(*this), OperatorRegistry::Reciprocal{});
+    }
 
-    Variable<T> abs() const {
+    Variable<T> abs() const& {
         return unary_operation(*this, OperatorRegistry::Abs{});
     }
+    Variable<T> abs() && {
+        return unary_operation(std::move(*this), OperatorRegistry::Abs{});
+    }
 
-    Variable<T> exp() const {
+    Variable<T> exp() const& {
         return unary_operation(*this, OperatorRegistry::Exp{});
     }
+    Variable<T> exp() && {
+        return unary_operation(std::move(*this), OperatorRegistry::Exp{});
+    }
 
-    Variable<T> log() const {
+    Variable<T> log() const& {
         return unary_operation(*this, OperatorRegistry::Log{});
     }
+    Variable<T> log() && {
+        return unary_operation(std::move(*this), OperatorRegistry::Log{});
+    }
 
-    Variable<T> sin() const {
+    Variable<T> sin() const& {
         return unary_operation(*this, OperatorRegistry::Sin{});
     }
+    Variable<T> sin() && {
+        return unary_operation(std::move(*this), OperatorRegistry::Sin{});
+    }
 
-    Variable<T> cos() const {
+    Variable<T> cos() const& {
         return unary_operation(*this, OperatorRegistry::Cos{});
     }
+    Variable<T> cos() && {
+        return unary_operation(std::move(*this), OperatorRegistry::Cos{});
+    }
 
-    Variable<T> tan() const {
+    Variable<T> tan() const& {
         return unary_operation(*this, OperatorRegistry::Tan{});
     }
+    Variable<T> tan() && {
+        return unary_operation(std::move(*this), OperatorRegistry::Tan{});
+    }
+
+
+    ///////////////////////////////////////////////////////////////////////////
+    ///                             REDUCTIONS                              ///
+    ///////////////////////////////////////////////////////////////////////////
+
+    // For value types like Tensor, these reduce over all elements, while they
+    // are the identity on scalars.
+
+    Variable<T> sum() const {
+        return unary_operation(*this, OperatorRegistry::Sum{});
+    }
+
+    Variable<T> mean() const {
+        return unary_operation(*this, OperatorRegistry::Mean{});
+    }
+
+    Variable<T> transpose() const {
+        return unary_operation(*this, OperatorRegistry::Transpose{});
+    }
+
+    // Sums this variable over all dimensions along which `like` is broadcast
+    // to it (see `sum_to()` in Tensor.hpp). Does not create a node if the
+    // shapes are the same already.
+    Variable<T> sum_to(const T& like) const {
+        using OperatorRegistry::same_shape;
+        if (same_shape(value(), like))
+            return *this;
+        return unary_operation(*this, OperatorRegistry::SumTo<T>{like});
+    }
 
 
     ///////////////////////////////////////////////////////////////////////////
@@ -339,183 +201,293 @@ public:
     ///////////////////////////////////////////////////////////////////////////
 
     template<typename A>
-    friend Variable<A> operator+(const Variable<A>& lhs, const Variable<A>& rhs);
+    friend Variable<A> operator+(Variable<A> lhs, Variable<A> rhs);
     template<typename A>
-    friend Variable<A> operator+(const Variable<A>& lhs, const A& rhs);
+    friend Variable<A> operator+(Variable<A> lhs, const std::type_identity_t<A>& rhs);
     template<typename A>
-    friend Variable<A> operator+(const A& lhs, const Variable<A>& rhs);
+    friend Variable<A> operator+(const std::type_identity_t<A>& lhs, Variable<A> rhs);
 
     template<typename A>
-    friend Variable<A> operator-(const Variable<A>& lhs, const Variable<A>& rhs);
+    friend Variable<A> operator-(Variable<A> lhs, Variable<A> rhs);
     template<typename A>
-    friend Variable<A> operator-(const Variable<A>& lhs, const A& rhs);
+    friend Variable<A> operator-(Variable<A> lhs, const std::type_identity_t<A>& rhs);
     template<typename A>
-    friend Variable<A> operator-(const A& lhs, const Variable<A>& rhs);
+    friend Variable<A> operator-(const std::type_identity_t<A>& lhs, Variable<A> rhs);
 
     template<typename A>
-    friend Variable<A> operator*(const Variable<A>& lhs, const Variable<A>& rhs);
+    friend Variable<A> operator*(Variable<A> lhs, Variable<A> rhs);
     template<typename A>
-    friend Variable<A> operator*(const Variable<A>& lhs, const A& rhs);
+    friend Variable<A> operator*(Variable<A> lhs, const std::type_identity_t<A>& rhs);
     template<typename A>
-    friend Variable<A> operator*(const A& lhs, const Variable<A>& rhs);
+    friend Variable<A> operator*(const std::type_identity_t<A>& lhs, Variable<A> rhs);
 
     template<typename A>
-    friend Variable<A> operator/(const Variable<A>& lhs, const Variable<A>& rhs);
+    friend Variable<A> operator/(Variable<A> lhs, Variable<A> rhs);
     template<typename A>
-    friend Variable<A> operator/(const Variable<A>& lhs, const A& rhs);
+    friend Variable<A> operator/(Variable<A> lhs, const std::type_identity_t<A>& rhs);
     template<typename A>
-    friend Variable<A> operator/(const A& lhs, const Variable<A>& rhs);
+    friend Variable<A> operator/(const std::type_identity_t<A>& lhs, Variable<A> rhs);
 
 private:
     std::shared_ptr<VariableImpl<T>> _variable;
 };
 
 
-template<typename T, typename Op>
-Variable<T> binary_operation(const Variable<T>& lhs, const Variable<T>& rhs, const Op& op) {
-    bool requires_grad = lhs.requires_grad() || rhs.requires_grad();
-    Variable<T> out(op(lhs.value(), rhs.value()), requires_grad, false);
-    // Variables created by operations are non-leaf
+// While a NoGrad scope is active on the current thread, operations on
+// Variables do not build computational graphs, even if their inputs require
+// a gradient: their results are plain values that neither require a
+// gradient nor have parents or children, e.g. for inference. Other threads
+// are not affected. `NoGrad(false)` builds graphs again within its scope.
+//
+// Example:
+//      {
+//          NoGrad no_grad;
+//          Variable<double> prediction = model(x, w);
+//      }
+class NoGrad {
+public:
+    explicit NoGrad(bool active = true) : _previous(std::exchange(NoGrad::active(), active)) {}
+    ~NoGrad() { NoGrad::active() = _previous; }
+    NoGrad(const NoGrad&) = delete;
+    NoGrad& operator=(const NoGrad&) = delete;
+
+    static bool& active() {
+        thread_local bool active = false;
+        return active;
+    }
 
-    if (out.requires_grad()) {
-        // Note that `lhs_var && rhs_var` should always evaluate to `true` and
-        // weak pointers are only chosen to not unnecessarily increase the
-        // reference count of the parents of this->_variable (makes debugging easier).
-        // This is due to `lhs_wp` or `rhs_wp` being invalid only if `this->_variable`
-        // has deleted its parents (note: just deleting parents does not force
-        // that lhs._variable nor rhs._variable are invalid), but this is only
-        // done in `this->_variable->backward()` after the gradients of all
-        // children have been accumulated and `retain_graph=false`. But in this
-        // case `_backward_fn` is also set to `nullptr`, thus `_backward_fn`
-        //  can no longer be called in `this->_variable->backward()`, therefore
-        // `lhs_var && rhs_var` always evaluate to `true` when
-        // `this->_variable->backward()` is called.
-        // out._variable->set_backward_fn([lhs_wp = std::weak_ptr<VariableImpl<T>>(lhs._variable),
-        //                                 rhs_wp = std::weak_ptr<VariableImpl<T>>(rhs._variable), &op](const Variable<T>& prev_grad) {
-        //     auto lhs_var = lhs_wp.lock();
-        //     auto rhs_var = rhs_wp.lock();
-        //     if (lhs_var && rhs_var) {
-        //         return op.backward(lhs_var, rhs_var, prev_grad);
-        //     }
-        //     return std::vector<Variable<T>>{};
-        // });
-
-        // The lambda function captures the Variables as values, i.e. creates
-        // copies of them (and thus increases the use count of the underlying
-        // shared pointer), since if they are captured by reference, then those
-        // can cause some weird errors at runtime. Not sure why right now. 
-        out._variable->set_backward_fn([lhs, rhs, &op](const Variable<T>& prev_grad) {
-            return op.backward(lhs, rhs, prev_grad);
-        });
-        
-        out._variable->add_parent(lhs._variable);
-        out._variable->add_parent(rhs._variable);
+private:
+    bool _previous;
+};
+
+
+// While a GraphCapture is active on the current thread, every node that an
+// operation adds to a computational graph is appended to it in the order of
+// creation, i.e. in topological order (see CompiledFunction).
+template<typename T>
+struct GraphCapture {
+    // Activates a capture on the current thread for the lifetime of the scope.
+    class Scope {
+    public:
+        explicit Scope(GraphCapture<T>& capture) : _previous(std::exchange(active(), &capture)) {}
+        ~Scope() { active() = _previous; }
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+    private:
+        GraphCapture<T>* _previous;
+    };
+
+    std::vector<std::shared_ptr<VariableImpl<T>>> nodes;
+
+    static GraphCapture<T>*& active() {
+        thread_local GraphCapture<T>* capture = nullptr;
+        return capture;
+    }
+};
+
+
+// Results that do not require a gradient, since no input requires one or
+// since a NoGrad scope is active, are only values. They are written into the
+// node of a temporary input that is referenced by nothing else and does not
+// require a gradient itself, if there is one, instead of a new node. Thus
+// chains of such operations on temporaries allocate only once.
+template<typename T>
+bool is_reusable(const Variable<T>& var) {
+    return var.variable().use_count() == 1 && !var.requires_grad();
+}
+
+
+template<typename T, typename Op>
+Variable<T> binary_operation(Variable<T> lhs, Variable<T> rhs, const Op& op) {
+    Profiler* profiler = Profiler::active();
+    const Profiler::Span span = profiler ? profiler->begin() : Profiler::Span{};
+    const bool requires_grad = (lhs.requires_grad() || rhs.requires_grad()) && !NoGrad::active();
+    T value = op(lhs.value(), rhs.value());
+    Variable<T> out;
+
+    if (requires_grad) {
+        // Variables created by operations are non-leaf
+        out = Variable<T>(std::move(value), true, false);
+        // Instead of a backward closure only the op code of the operation is
+        // stored. The inputs of the operation are the parents of `out`, thus
+        // `out` does not need to hold any further references to them.
+        out._variable->set_op(Op::code);
         lhs._variable->add_child(out._variable);
         rhs._variable->add_child(out._variable);
+        out._variable->add_parent(std::move(lhs._variable));
+        out._variable->add_parent(std::move(rhs._variable));
+        if (GraphCapture<T>* capture = GraphCapture<T>::active())
+            capture->nodes.push_back(out._variable);
+    } else if (is_reusable(lhs) || is_reusable(rhs)) {
+        out = is_reusable(lhs) ? std::move(lhs) : std::move(rhs);
+        out._variable->set_value(std::move(value));
+    } else {
+        out = Variable<T>(std::move(value), false, false);
     }
 
+    if (profiler)
+        profiler->end(Profiler::Phase::Forward, Op::code, out.requires_grad() ? out._variable.get() : nullptr, span);
     return out;
 }
 
 
 template<typename T, typename Op>
 Variable<T> unary_operation(const Variable<T>& var, const Op& op) {
-    Variable<T> out(op(var.value()), var.requires_grad(), false);
+    Profiler* profiler = Profiler::active();
+    const Profiler::Span span = profiler ? profiler->begin() : Profiler::Span{};
+    Variable<T> out(op(var.value()), var.requires_grad() && !NoGrad::active(), false);
     // Variables created by operations are non-leaf
 
     if (out.requires_grad()) {
-        // for discussion of weak pointer usage see `binary_operation`
-        // out._variable->set_backward_fn([var_wp = std::weak_ptr<VariableImpl<T>>(var._variable), &op](const Variable<T>& prev_grad) {
-        //     auto var = var_wp.lock();
-        //     if (var)
-        //         return op.backward(var, prev_grad);
-        //     return std::vector<Variable<T>>{};
-        // });
-        out._variable->set_backward_fn([var, &op](const Variable<T>& prev_grad) {
-            return op.backward(var, prev_grad);
-        });
-
+        out._variable->set_op(Op::code, OperatorRegistry::stored_of<T>(op, var.value(), out.value()));
         out._variable->add_parent(var._variable);
         var._variable->add_child(out._variable);
+        if (GraphCapture<T>* capture = GraphCapture<T>::active())
+            capture->nodes.push_back(out._variable);
     }
 
+    if (profiler)
+        profiler->end(Profiler::Phase::Forward, Op::code, out.requires_grad() ? out._variable.get() : nullptr, span);
     return out;
 }
 
+// Chains of elementwise operations like `(2 * x).cos().abs()` only pass
+// temporaries from one operation to the next. If the node of a temporary is
+// referenced by nothing else, i.e. neither by other Variables nor by
+// children nor by a GraphCapture, the operation is fused into that node
+// instead of creating a new one (see `OperatorRegistry::FusedChain`).
+// Temporaries without a graph are reused for the result instead (see
+// `is_reusable()`).
+template<typename T, typename Op>
+Variable<T> unary_operation(Variable<T>&& var, const Op& op) {
+    const bool reuse = is_reusable(var);
+    bool fuse = false;
+    if constexpr (OperatorRegistry::is_elementwise(Op::code))
+        fuse = !reuse && !NoGrad::active() && var._variable.use_count() == 1 && var._variable->can_fuse();
+    if (!reuse && !fuse)
+        return unary_operation(std::as_const(var), op);
+
+    Profiler* profiler = Profiler::active();
+    const Profiler::Span span = profiler ? profiler->begin() : Profiler::Span{};
+    if (reuse) {
+        var._variable->set_value(op(var.value()));
+    } else {
+        if (profiler && var._variable->op() != OperatorRegistry::OpCode::Fused)
+            profiler->fuse_node(var._variable->op());
+        T value = op(var.value());
+        var._variable->fuse(Op::code, OperatorRegistry::stored_of<T>(op, var.value(), value), std::move(value));
+    }
+    // no node is created by reusing or fusing, the fused node is counted
+    // under `Fused` from now on
+    if (profiler)
+        profiler->end(Profiler::Phase::Forward, Op::code, nullptr, span);
+    return std::move(var);
+}
+
 
 
 template<typename T>
-Variable<T> operator-(const Variable<T>& var) {
-    return unary_operation(var, OperatorRegistry::Neg{});
+Variable<T> operator-(Variable<T> var) {
+    return unary_operation(std::move(var), OperatorRegistry::Neg{});
 }
 
 
 
+// Operands that do not require a gradient, while the other operand does, are
+// constants w.r.t. the backward pass, thus they are folded into a scalar
+// operation, which stores their value inline instead of keeping their
+// VariableImpl alive. The operands are taken by value, so that temporaries
+// can be fused or reused (see `unary_operation()` and `is_reusable()`).
+// The value type is only deduced from the Variable, so that constants are
+// converted to it, e.g. `var * 2` for a `Variable<Tensor<float>>`.
+
 template <typename T>
-Variable<T> operator+(const Variable<T>& lhs, const Variable<T>& rhs) {
-    return binary_operation(lhs, rhs, OperatorRegistry::Add{});
+Variable<T> operator+(Variable<T> lhs, Variable<T> rhs) {
+    if (lhs.requires_grad() && !rhs.requires_grad())
+        return std::move(lhs) + rhs.value();
+    if (!lhs.requires_grad() && rhs.requires_grad())
+        return lhs.value() + std::move(rhs);
+    return binary_operation(std::move(lhs), std::move(rhs), OperatorRegistry::Add{});
 }
 
 template<typename T>
-Variable<T> operator+(const Variable<T>& lhs, const T& rhs) {
-    Variable<T> out = lhs + Variable<T>(rhs, false, false);
-    return out;
+Variable<T> operator+(Variable<T> lhs, const std::type_identity_t<T>& rhs) {
+    return unary_operation(std::move(lhs), OperatorRegistry::Shift<T>{rhs});
 }
 
 template<typename T>
-Variable<T> operator+(const T& lhs, const Variable<T>& rhs) {
-    return Variable<T>(lhs, false, false) + rhs;
+Variable<T> operator+(const std::type_identity_t<T>& lhs, Variable<T> rhs) {
+    return unary_operation(std::move(rhs), OperatorRegistry::Shift<T>{lhs});
 }
 
 
 
 template<typename T>
-Variable<T> operator-(const Variable<T>& lhs, const Variable<T>& rhs) {
-    return binary_operation(lhs, rhs, OperatorRegistry::Sub{});
+Variable<T> operator-(Variable<T> lhs, Variable<T> rhs) {
+    if (lhs.requires_grad() && !rhs.requires_grad())
+        return std::move(lhs) - rhs.value();
+    if (!lhs.requires_grad() && rhs.requires_grad())
+        return lhs.value() - std::move(rhs);
+    return binary_operation(std::move(lhs), std::move(rhs), OperatorRegistry::Sub{});
 }
 
 template<typename T>
-Variable<T> operator-(const Variable<T>& lhs, const T& rhs) {
-    return lhs - Variable<T>(rhs, false, false);
+Variable<T> operator-(Variable<T> lhs, const std::type_identity_t<T>& rhs) {
+    return unary_operation(std::move(lhs), OperatorRegistry::Shift<T>{-rhs});
 }
 
 template<typename T>
-Variable<T> operator-(const T& lhs, const Variable<T>& rhs) {
-    return Variable<T>(lhs, false, false) - rhs;
+Variable<T> operator-(const std::type_identity_t<T>& lhs, Variable<T> rhs) {
+    return unary_operation(std::move(rhs), OperatorRegistry::Affine<T>{static_cast<T>(-1), lhs});
 }
 
 
 
 template<typename T>
-Variable<T> operator*(const Variable<T>& lhs, const Variable<T>& rhs) {
-    return binary_operation(lhs, rhs, OperatorRegistry::Mul{});
+Variable<T> operator*(Variable<T> lhs, Variable<T> rhs) {
+    if (lhs.requires_grad() && !rhs.requires_grad())
+        return std::move(lhs) * rhs.value();
+    if (!lhs.requires_grad() && rhs.requires_grad())
+        return lhs.value() * std::move(rhs);
+    return binary_operation(std::move(lhs), std::move(rhs), OperatorRegistry::Mul{});
 }
 
 template<typename T>
-Variable<T> operator*(const Variable<T>& lhs, const T& rhs) {
-    return lhs * Variable<T>(rhs, false, false);
+Variable<T> operator*(Variable<T> lhs, const std::type_identity_t<T>& rhs) {
+    return unary_operation(std::move(lhs), OperatorRegistry::Scale<T>{rhs});
 }
 
 template<typename T>
-Variable<T> operator*(const T& lhs, const Variable<T>& rhs) {
-    return Variable<T>(lhs, false, false) * rhs;
+Variable<T> operator*(const std::type_identity_t<T>& lhs, Variable<T> rhs) {
+    return unary_operation(std::move(rhs), OperatorRegistry::Scale<T>{lhs});
 }
 
 
 
 template<typename T>
-Variable<T> operator/(const Variable<T>& lhs, const Variable<T>& rhs) {
-    return binary_operation(lhs, rhs, OperatorRegistry::Div{});
+Variable<T> operator/(Variable<T> lhs, Variable<T> rhs) {
+    if (lhs.requires_grad() && !rhs.requires_grad())
+        return std::move(lhs) / rhs.value();
+    if (!lhs.requires_grad() && rhs.requires_grad())
+        return lhs.value() / std::move(rhs);
+    return binary_operation(std::move(lhs), std::move(rhs), OperatorRegistry::Div{});
+}
+
+template<typename T>
+Variable<T> operator/(Variable<T> lhs, const std::type_identity_t<T>& rhs) {
+    return unary_operation(std::move(lhs), OperatorRegistry::DivScalar<T>{rhs});
 }
 
 template<typename T>
-Variable<T> operator/(const Variable<T>& lhs, const T& rhs) {
-    return lhs / Variable<T>(rhs, false, false);
+Variable<T> operator/(const std::type_identity_t<T>& lhs, Variable<T> rhs) {
+    return unary_operation(std::move(rhs), OperatorRegistry::RDivScalar<T>{lhs});
 }
 
+
+
 template<typename T>
-Variable<T> operator/(const T& lhs, const Variable<T>& rhs) {
-    return Variable<T>(lhs, false, false) / rhs;
+Variable<T> matmul(const Variable<T>& lhs, const Variable<T>& rhs) {
+    return binary_operation(lhs, rhs, OperatorRegistry::MatMul{});
 }
 
 
@@ -570,7 +542,7 @@ struct std::formatter<Variable<T>> : std::formatter<std::string> {
             if (var.grad().has_value())
                 out = std::format_to(out, ", grad={:.{}g}", var.grad().value().value(), precision);
         } else {
-            out = std::format_to(out, "Variable({})", var.value());
+            out = std::format_to(out, "Variable({}", var.value());
             if (var.grad().has_value())
                 out = std::format_to(out, ", grad={}", var.grad().value().value());
         }
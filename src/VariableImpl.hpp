@@ -1,12 +1,88 @@
 #pragma once
 #include <vector>
+#include <array>
+#include <span>
 #include <memory>
-#include <functional>
+#include <atomic>
+#include <thread>
 #include <cassert>
+#include <cstdint>
 #include <optional>
+#include <functional>
+#include <variant>
+#include <utility>
+#include <type_traits>
+#include <unordered_map>
+#include <algorithm>
+
+#include "OperatorRegistry.hpp"
+#include "ThreadPool.hpp"
+#include "Profiler.hpp"
 
 
 template<typename T> class Variable;
+template<typename T> class VariableImpl;
+
+
+// A GradientBuffer collects the gradients of leaves during `backward()` calls
+// of one thread instead of accumulating them in the leaves themselves. This
+// allows several threads to run forward and backward passes concurrently on
+// graphs that share the same leaves (e.g. the parameters of a model), which
+// are then summed into the leaves by `all_reduce()` (see DataParallel.hpp).
+// Only plain gradients are buffered, i.e. `create_graph` must be `false`.
+//
+// Example:
+//      GradientBuffer<double> buffer;
+//      {
+//          typename GradientBuffer<double>::Scope scope(buffer);
+//          loss(params, shard).backward();
+//      }
+//      buffer.reduce();
+template<typename T>
+class GradientBuffer {
+public:
+    // Activates a buffer on the current thread for the lifetime of the scope.
+    class Scope {
+    public:
+        explicit Scope(GradientBuffer<T>& buffer) : _previous(std::exchange(active(), &buffer)) {}
+        ~Scope() { active() = _previous; }
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+    private:
+        GradientBuffer<T>* _previous;
+    };
+
+    static GradientBuffer<T>*& active() {
+        thread_local GradientBuffer<T>* buffer = nullptr;
+        return buffer;
+    }
+
+    void add(const std::shared_ptr<VariableImpl<T>>& leaf, const T& grad) {
+        auto [it, inserted] = _indices.try_emplace(leaf.get(), _grads.size());
+        if (inserted)
+            _grads.emplace_back(leaf, grad);
+        else
+            _grads[it->second].second += grad;
+    }
+
+    bool empty() const { return _grads.empty(); }
+    std::size_t size() const { return _grads.size(); }
+    const std::vector<std::pair<std::shared_ptr<VariableImpl<T>>, T>>& entries() const { return _grads; }
+
+    // Accumulates the buffered gradients into their leaves in the order in
+    // which the leaves first received a gradient, and clears the buffer.
+    void reduce();
+
+    void clear() {
+        _grads.clear();
+        _indices.clear();
+    }
+
+private:
+    std::vector<std::pair<std::shared_ptr<VariableImpl<T>>, T>> _grads;
+    std::unordered_map<const VariableImpl<T>*, std::size_t> _indices;
+};
+
 
 template<typename T>
 class VariableImpl : public std::enable_shared_from_this<VariableImpl<T>> {
@@ -14,21 +90,41 @@ public:
     VariableImpl(T value, bool requires_grad = false, bool is_leaf = false)
         : _value(value), _grad(), _requires_grad(requires_grad), _is_leaf(is_leaf) {}
 
-    T value() const { return _value; }
-    std::optional<Variable<T>> grad() const { return _grad; }
+    const T& value() const { return _value; }
+    std::optional<Variable<T>> grad() const {
+        if (std::holds_alternative<T>(_grad))
+            return Variable<T>(std::get<T>(_grad), false, false);
+        if (std::holds_alternative<Variable<T>>(_grad))
+            return std::get<Variable<T>>(_grad);
+        return std::nullopt;
+    }
+    std::optional<T> grad_value() const {
+        if (std::holds_alternative<T>(_grad))
+            return std::get<T>(_grad);
+        if (std::holds_alternative<Variable<T>>(_grad))
+            return std::get<Variable<T>>(_grad).value();
+        return std::nullopt;
+    }
     bool requires_grad() const { return _requires_grad; }
     bool set_requires_grad(const bool requires_grad = true) {
         _is_leaf = true;
         if (!requires_grad) {
-            _parents.clear();
+            clear_parents();
             _children.clear();
-            _backward_fn = nullptr;
         }
         return _requires_grad = requires_grad;
     }
     bool is_leaf() const { return _is_leaf; }
 
+    // Stores the result of an operation without a graph in a node that is
+    // referenced by nothing else (see `is_reusable()` in Variable.hpp).
+    void set_value(T value) {
+        _value = std::move(value);
+        _is_leaf = false;
+    }
+
     bool is_child(const std::shared_ptr<VariableImpl<T>>& child) const {
+        ChildrenLock lock(_children_lock);
         for (const auto& child_wp : _children) {
             auto child_other = child_wp.lock();
             if (child_other && child_other.get() == child.get()) {
@@ -38,62 +134,115 @@ public:
         return false;
     }        
 
-    void set_grad(const T& grad) { _grad = Variable(grad, false, false); }
-    void set_grad(const Variable<T>& grad) { _grad = grad; }
-    void reset_grad() { _grad.reset(); }
-    void zero_grad() { _grad = Variable<T>(0, false, false); }
-    void add_grad(const T& grad) { _grad = _grad.has_value() ? _grad.value() + grad : Variable(grad, false, false); }
-    void add_grad(const Variable<T>& grad) { _grad = _grad.has_value() ? _grad.value() + grad : grad; }
+    void set_grad(const T& grad) { _grad = grad; }
+    void set_grad(const Variable<T>& grad) {
+        if (grad.requires_grad())
+            _grad = grad;
+        else
+            _grad = grad.value();
+    }
+    void reset_grad() { _grad = std::monostate{}; }
+    void zero_grad() { _grad = T(0); }
+
+    // Plain gradients are accumulated in place, only gradients that are part
+    // of a computational graph (i.e. `create_graph=true`) create new nodes.
+    void add_grad(const T& grad) {
+        if (T* grad_value = std::get_if<T>(&_grad))
+            *grad_value += grad;
+        else if (Variable<T>* grad_var = std::get_if<Variable<T>>(&_grad))
+            *grad_var = *grad_var + grad;
+        else
+            _grad = grad;
+    }
+    void add_grad(const Variable<T>& grad) {
+        if (!grad.requires_grad())
+            add_grad(grad.value());
+        else if (T* grad_value = std::get_if<T>(&_grad))
+            _grad = *grad_value + grad;
+        else if (Variable<T>* grad_var = std::get_if<Variable<T>>(&_grad))
+            *grad_var = *grad_var + grad;
+        else
+            _grad = grad;
+    }
     
 
-    const std::vector<std::shared_ptr<VariableImpl<T>>>& parents() const { return _parents; }
+    std::span<const std::shared_ptr<VariableImpl<T>>> parents() const { return {_parents.data(), _num_parents}; }
+    // Not synchronized with concurrent calls of `add_child()`.
     const std::vector<std::weak_ptr<VariableImpl<T>>>& children() const { return _children; }
 
-    void add_parent(const std::shared_ptr<VariableImpl<T>>& parent) {
+    void add_parent(std::shared_ptr<VariableImpl<T>> parent) {
         if (_requires_grad) {
-            _parents.emplace_back(parent);
+            assert(_num_parents < _parents.size() && "operations have at most two inputs");
+            _parents[_num_parents++] = std::move(parent);
         }
     }
 
+    // Leaves may be shared by graphs that are built on several threads at
+    // once, thus children are registered under a spinlock, which is hardly
+    // ever contended. Children that have been destroyed are pruned whenever
+    // the vector would grow, so that long-lived leaves do not accumulate
+    // the children of all graphs they have ever been part of.
     void add_child(const std::shared_ptr<VariableImpl<T>>& child) {
         if (_requires_grad) {
+            ChildrenLock lock(_children_lock);
+            if (_children.size() == _children.capacity())
+                std::erase_if(_children, [](const auto& child_wp) { return child_wp.expired(); });
             _children.emplace_back(child);
         }
     }
 
-    bool is_part_of_graph(const std::shared_ptr<VariableImpl<T>>& root) const {
-        if (this == root.get())
-            return true;
-
-        for (const auto& child_wp : _children) {
-            if (auto child = child_wp.lock(); child && child->is_part_of_graph(root))
-                return true;
-        }
-        return false;
+    // Rewiring of nodes by graph optimizations (see GraphOptimization.hpp).
+    // The children of the old and new parents are not updated.
+    void set_parents(std::span<const std::shared_ptr<VariableImpl<T>>> parents) {
+        assert(parents.size() <= _parents.size() && "operations have at most two inputs");
+        // `parents` may refer to the current parents
+        std::array<std::shared_ptr<VariableImpl<T>>, 2> new_parents;
+        std::copy(parents.begin(), parents.end(), new_parents.begin());
+        _parents = std::move(new_parents);
+        _num_parents = static_cast<std::uint8_t>(parents.size());
     }
-
-    int num_children_in_graph(const std::shared_ptr<VariableImpl<T>>& root) const {
-        int num = 0;
-        for (const auto& child_wp : _children) {
-            if (auto child = child_wp.lock(); child && child->is_part_of_graph(root))
-                ++num;
-        }
-        return num;
+    // Removes the children that have been destroyed and, if this node has been
+    // unlinked from some of its children, the children that no longer have it
+    // as a parent. Returns the number of removed children.
+    std::size_t prune_children(bool unlinked = false) {
+        ChildrenLock lock(_children_lock);
+        return std::erase_if(_children, [&](const auto& child_wp) {
+            if (!unlinked)
+                return child_wp.expired();
+            std::shared_ptr<VariableImpl<T>> child = child_wp.lock();
+            return !child || std::ranges::none_of(child->parents(), [this](const auto& parent) { return parent.get() == this; });
+        });
     }
 
-
-    // The `backward()` function computes and propagates gradients for this variable 
-    // in a computational graph. It first accumulates the incoming gradients 
-    // from its children, then determines if this is the last backward call 
-    // for this variable based on the number of backward calls made and the 
-    // number of children it has. If it is the last call and a `_backward_fn` 
-    // is defined, it computes the gradients for its parents using `_backward_fn`
-    // and recursively calls their `backward()` methods to propagate the gradients 
-    // up the graph. If `retain_graph` is `true`, the computational graph is preserved 
-    // for future backward calls; otherwise, it clears the parent pointers and 
-    // the backward function to release memory resources. Only leaf nodes retain 
-    // their gradients, while non-leaf nodes reset their gradients to avoid 
-    // incorrect accumulation in future calls.
+    // The `backward()` function computes and propagates the gradients of the
+    // computational graph whose root is `this`. It works in two linear sweeps
+    // over the graph, both driven by an explicit work list instead of recursion,
+    // so neither diamond-heavy graphs nor very long chains are a problem:
+    //
+    //  1. Starting at the root, the graph is traversed upwards along the parents
+    //     of each node. Every node that requires a gradient counts how many edges
+    //     from nodes of the graph point to it, i.e. how many incoming gradients
+    //     it has to accumulate before its own gradient is complete. Children that
+    //     are not an ancestor of the root are never visited and thus not counted.
+    //     Leaves without parents are not counted either, since they have nothing
+    //     to propagate and can accumulate each incoming gradient right away. This
+    //     way, backward passes on different threads never touch the counters of
+    //     leaves they share.
+    //
+    //  2. The root accumulates the incoming gradient and is the first node whose
+    //     gradient is complete. Whenever the gradient of a node is complete, the
+    //     backward function of its operation `_op` computes the gradients w.r.t.
+    //     its inputs, which are then
+    //     accumulated by the parents while decrementing their counters. A parent
+    //     whose counter reaches zero has received all of its incoming gradients
+    //     and is pushed onto the work list.
+    //
+    // Each node and each edge is thus visited a constant number of times. If
+    // `retain_graph` is `true`, the computational graph is preserved for future
+    // backward calls; otherwise, a node clears its parent pointers and its
+    // operation as soon as it has been processed to release memory
+    // resources. Only leaf nodes retain their gradients, while non-leaf nodes
+    // reset their gradients to avoid incorrect accumulation in future calls.
     //
     //
     ///////////////////////////////////////////////////////////////////////////
@@ -111,155 +260,565 @@ public:
     //      E   D <- Variable(D)
     //
     // Traversal Steps for Backpropagation without retaining the graph:
-    //  1. Start from the Variable(D).backward():
-    //     - Call D.backward() with `root=true to begin the backward process.
-    //
-    //  2. In D:
-    //     - D checks how many of its children are part of the computational graph -> [].
-    //     - Since D is the root of the computational graph it accumulates the 
-    //       incoming gradient.
-    //     - Since D is the root it computes the gradients w.r.t. the inputs.
-    //     - Calls B.backward() (its first parent) to propagate its gradient upwards.
-    //
-    //  3. In B:
-    //     - B checks how many of its children are part of the computational graph -> [D].
-    //        (E is not an ancestor of the root)
-    //     - Since D is a valid child it accumulates the incoming gradient.
-    //     - Since B has now accumulated all incoming gradients it computes the gradients w.r.t. the inputs.
-    //     - Calls A.backward() to propagate its gradient upwards.
-    //
-    //  4. In A:
-    //     - A checks how many of its children are part of the computational graph -> [B,C].
-    //     - Since B is a valid child it accumulates the incoming gradient.
-    //     - Since the gradient of C is still missing it returns the backward() call to D
-    //
-    //  5. In D:
-    //     - Deletes the reference to B (If nothing else references B, then it gets deleted)
-    //     - Calls C.backward() (its second parent) to propagate its gradient upwards.
-    //
-    //  6. In C:
-    //     - C checks how many of its children are part of the computational graph -> [D].
-    //     - Since D is a valid child it accumulates the incoming gradient.
-    //     - Since C has now accumulated all incoming gradients it computes the gradients w.r.t. the inputs.
-    //     - Calls A.backward() to propagate its gradient upwards.
-    //
-    //  7. In A:
-    //     - Since C is a valid child it accumulates the incoming gradient.
-    //     - Since A has now accumulated all incoming gradients it computes the gradients w.r.t. the inputs.
-    //     - Calls X.backward() to propagate its gradient upwards.
-    //
-    //  8. In X:
-    //     - X checks how many of its children are part of the computational graph -> [A].
-    //     - Since X is a valid child it accumulates the incoming gradient.
-    //     - Since X has no `_backward_fn` it returns the backward() call to A.
-    //
-    //  9. In A:
-    //     - Deletes the reference to X and returns the backward() call to C.
-    //
-    // 10. In C:
-    //     - Deletes the reference to A and returns the backward() call to D.
+    //  1. Counting the incoming gradients starting from D:
+    //     - D visits its parents B and C -> B: 1, C: 1
+    //     - C visits its parent A -> A: 1
+    //     - B visits its parent A (already visited) -> A: 2
+    //     - A visits its parent X, a leaf, which is not counted
+    //       (E is not an ancestor of the root and is never visited)
     //
-    // 11. In D:
-    //     - Deletes the reference to C and returns the backward() call to Variable(D)
-    //       finishing the backward process.
+    //  2. Propagating the gradients, work list = [D]:
+    //     - D accumulates the incoming gradient, computes the gradients w.r.t.
+    //       B and C and passes them on -> B: 0, C: 0, work list = [B, C]
+    //     - D deletes the references to its parents.
+    //     - C computes the gradient w.r.t. A -> A: 1, work list = [B]
+    //     - B computes the gradient w.r.t. A -> A: 0, work list = [A]
+    //     - A computes the gradient w.r.t. X, which X accumulates right away
+    //       and keeps since it is a leaf, finishing the backward process.
     //
-    void backward(const Variable<T>& prev_grad, bool retain_graph, const std::shared_ptr<VariableImpl<T>>& child = nullptr, const std::shared_ptr<VariableImpl<T>>& root = nullptr) {
+    void backward(const T& prev_grad, bool retain_graph, bool create_graph) {
         // If a variable has no parents that require gradients, we do not need
         // to store, compute & propagate gradients at all.
         if (!requires_grad())
             return;
-        
-        // On the first backwards call traverse the computational graph downwards
-        // towards the root and check how many of the children that are alive are
-        // an ancestor of the root. We do this only on the first call because
-        // if the graph is not retained, then during the accumulation process
-        // of the incoming gradients some children might already get deleted
-        // thus reducing the number of children that are part of the graph.
-        if (_num_bwd_calls == -1) {
-            _children_in_graph = num_children_in_graph(root);
-            _num_bwd_calls = 0;
+        Profiler* profiler = Profiler::active();
+        const Profiler::Span span = profiler ? profiler->begin() : Profiler::Span{};
+
+        // Count the incoming gradients of every node that is an ancestor of the
+        // root. A counter of -1 marks a node that has not been visited yet.
+        // Raw pointers suffice here, since the whole graph is kept alive by
+        // the root during this sweep.
+        _num_pending_grads = 0;
+        std::vector<VariableImpl<T>*> stack{this};
+        while (!stack.empty()) {
+            VariableImpl<T>* node = stack.back();
+            stack.pop_back();
+            for (const auto& parent : node->parents()) {
+                if (!parent->requires_grad() || parent->is_source())
+                    continue;
+                if (parent->_num_pending_grads == -1) {
+                    parent->_num_pending_grads = 0;
+                    stack.push_back(parent.get());
+                }
+                ++parent->_num_pending_grads;
+            }
         }
 
-        // Accumulate all incoming gradients from valid children or if `this` is
-        // the root of the computational graph.
-        bool is_root = this == root.get();
-        if (is_root || is_child(child)) {
+        // The work list holds shared pointers, since nodes that do not retain
+        // the graph release their parents while other nodes are still waiting
+        // to be processed.
+        if (create_graph)
+            add_grad(Variable<T>(prev_grad, true, false));
+        else
             add_grad(prev_grad);
-            ++_num_bwd_calls;
+        std::vector<std::shared_ptr<VariableImpl<T>>> ready{this->shared_from_this()};
+        while (!ready.empty()) {
+            std::shared_ptr<VariableImpl<T>> node = std::move(ready.back());
+            ready.pop_back();
+            node->propagate_grad(retain_graph, create_graph, ready, profiler);
         }
 
-        // If the incoming gradients of all children have been accumulated
-        // calculate the gradients of the inputs using registered backward functions.
-        bool is_last_bwd_call = is_root || _num_bwd_calls == _children_in_graph;
-        if (!is_last_bwd_call)
+        if (profiler)
+            profiler->end(Profiler::Phase::BackwardPass, OperatorRegistry::OpCode::Leaf, this, span);
+    }
+
+    // Like `backward()` with `create_graph=false`, but independent branches of
+    // the graph are processed in parallel on the threads of `pool`. The
+    // counting sweep is the same, except that it also numbers the incoming
+    // edges of every node. Instead of accumulating into the gradients of the
+    // parents, every child writes its gradient into the slot of its edge, and
+    // decrements the counter of the parent atomically. The thread that brings
+    // the counter to zero sums the slots in the order of their numbers and
+    // processes the parent, thus the result is race-free and does not depend
+    // on the schedule or the number of threads; it may however differ from
+    // `backward()` in the last bits, which sums in a different order.
+    //
+    // Source leaves may be shared with graphs that other threads build or
+    // differentiate at the same time, thus, like in `backward()`, their
+    // counters are not touched. Their edges are numbered by this pass alone,
+    // and once all nodes have been processed, the calling thread sums their
+    // slots and accumulates them like `pass_grads()`, i.e. into the active
+    // GradientBuffer if there is one.
+    //
+    // Parallelism only pays off if there are independent branches whose
+    // operations are expensive enough, e.g. many loss terms on Tensors. For
+    // graphs of cheap scalar operations, `backward()` is faster.
+    void backward_parallel(const T& prev_grad, bool retain_graph, ThreadPool& pool = ThreadPool::global()) {
+        if (!requires_grad())
             return;
+        Profiler* profiler = Profiler::active();
+        const Profiler::Span span = profiler ? profiler->begin() : Profiler::Span{};
 
-        // If any of the incoming gradients has requires_grad=true, then
-        // this means `create_graph` was set to `true` in the initial backward().
-        // If `create_graph=false` we can later delete the parents, children & _backward_fn
-        // of the outgoing gradients.
-        bool create_graph = _grad.has_value() && _grad.value().requires_grad();
-
-        if (_backward_fn) {
-            // If one incoming `prev_grad` has `requires_grad = true`, then all
-            // outgoing gradients will also have `requires_grad = true`, thus
-            // they will create a new computational graph.
-            std::vector<Variable<T>> in_grads = _backward_fn(_grad.value());
-            size_t n_inputs = _parents.size();
-            assert(n_inputs == in_grads.size());
-
-            for (size_t i = 0; i < n_inputs; ++i) {
-                auto& in_grad = in_grads[i];
-                if (!create_graph) {
-                    // Delete parents, children & _backward_fn of outgoing grad.
-                    in_grad.set_requires_grad(false);
+        // Counting sweep, where `edges[i][k]` is first the number of the edge
+        // from node `i` to its parent `k` among the incoming edges of the
+        // parent and then the index of its slot.
+        _num_pending_grads = 0;
+        _backward_index = 0;
+        std::vector<VariableImpl<T>*> nodes{this};
+        std::vector<std::array<std::uint32_t, 2>> edges;
+        // the source leaves and their numbers of incoming edges
+        std::vector<VariableImpl<T>*> sources;
+        std::vector<std::size_t> source_edges;
+        std::unordered_map<const VariableImpl<T>*, std::size_t> source_indices;
+        for (std::size_t i = 0; i < nodes.size(); ++i) {
+            VariableImpl<T>* node = nodes[i];
+            edges.emplace_back();
+            for (std::size_t k = 0; k < node->_num_parents; ++k) {
+                VariableImpl<T>* parent = node->_parents[k].get();
+                if (!parent->requires_grad())
+                    continue;
+                if (parent->is_source()) {
+                    auto [it, inserted] = source_indices.try_emplace(parent, sources.size());
+                    if (inserted) {
+                        sources.push_back(parent);
+                        source_edges.push_back(0);
+                    }
+                    edges[i][k] = static_cast<std::uint32_t>(source_edges[it->second]++);
+                    continue;
                 }
-                _parents[i]->backward(in_grads[i], retain_graph, this->shared_from_this(), root);
+                if (parent->_num_pending_grads == -1) {
+                    parent->_num_pending_grads = 0;
+                    parent->_backward_index = static_cast<std::uint32_t>(nodes.size());
+                    nodes.push_back(parent);
+                }
+                edges[i][k] = static_cast<std::uint32_t>(parent->_num_pending_grads++);
+            }
+        }
+
+        // the slots of node `i` are `slots[slot_begin[i]]...slots[slot_begin[i + 1] - 1]`,
+        // followed by the slots of the sources
+        std::vector<std::size_t> slot_begin(nodes.size() + 1, 0);
+        for (std::size_t i = 0; i < nodes.size(); ++i)
+            slot_begin[i + 1] = slot_begin[i] + static_cast<std::size_t>(nodes[i]->_num_pending_grads);
+        std::vector<std::size_t> source_begin(sources.size() + 1, slot_begin.back());
+        for (std::size_t j = 0; j < sources.size(); ++j)
+            source_begin[j + 1] = source_begin[j] + source_edges[j];
+        for (std::size_t i = 0; i < nodes.size(); ++i) {
+            for (std::size_t k = 0; k < nodes[i]->_num_parents; ++k) {
+                const VariableImpl<T>* parent = nodes[i]->_parents[k].get();
+                if (!parent->requires_grad())
+                    continue;
+                if (parent->is_source())
+                    edges[i][k] += static_cast<std::uint32_t>(source_begin[source_indices.at(parent)]);
+                else
+                    edges[i][k] += static_cast<std::uint32_t>(slot_begin[parent->_backward_index]);
+            }
+        }
+        std::vector<T> slots(source_begin.back());
+
+        auto process = [&](std::shared_ptr<VariableImpl<T>> node, std::size_t, auto& push) {
+            // Chains of nodes are processed by the same thread without going
+            // through the queues, only further ready parents are pushed.
+            while (node) {
+                const std::size_t i = node->_backward_index;
+                node->_num_pending_grads = -1;
+
+                // the slots are released right away, like the gradients of
+                // non-leaf nodes in `backward()`
+                T grad = prev_grad;
+                if (i != 0) {
+                    grad = std::move(slots[slot_begin[i]]);
+                    for (std::size_t s = slot_begin[i] + 1; s < slot_begin[i + 1]; ++s)
+                        grad += std::exchange(slots[s], T{});
+                }
+
+                std::shared_ptr<VariableImpl<T>> next;
+                if (node->has_backward_fn()) {
+                    std::array<T, 2> in_grads = node->backward_value(grad);
+                    for (std::size_t k = 0; k < node->_num_parents; ++k) {
+                        auto& parent = node->_parents[k];
+                        if (!parent->requires_grad())
+                            continue;
+                        using OperatorRegistry::sum_to;
+                        slots[edges[i][k]] = sum_to(in_grads[k], parent->value());
+                        if (parent->is_source())
+                            continue;
+                        // The release makes the slot visible to the thread
+                        // that sees the counter reach zero.
+                        if (std::atomic_ref<int>(parent->_num_pending_grads).fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                            if (next)
+                                push(std::move(next));
+                            next = parent;
+                        }
+                    }
+                }
+
+                // only leaf nodes keep their gradients
+                if (node->is_leaf())
+                    node->add_grad(grad);
                 if (!retain_graph) {
-                    _parents[i].reset();
+                    node->clear_parents();
+                    node->_children.clear();
+                }
+                node = std::move(next);
+            }
+        };
+        process_all(pool, std::vector<std::shared_ptr<VariableImpl<T>>>{this->shared_from_this()}, process);
+
+        GradientBuffer<T>* buffer = GradientBuffer<T>::active();
+        for (std::size_t j = 0; j < sources.size(); ++j) {
+            T grad = std::move(slots[source_begin[j]]);
+            for (std::size_t s = source_begin[j] + 1; s < source_begin[j + 1]; ++s)
+                grad += slots[s];
+            if (buffer)
+                buffer->add(sources[j]->shared_from_this(), grad);
+            else
+                sources[j]->add_grad(grad);
+        }
+
+        if (profiler)
+            profiler->end(Profiler::Phase::BackwardPass, OperatorRegistry::OpCode::Leaf, this, span);
+    }
+
+    // Vector-seeded backward pass from several `roots` at once, which
+    // propagates K cotangents per node instead of one gradient, i.e. computes
+    // K vector-Jacobian products in a single traversal, and returns the K
+    // cotangents of each of the `inputs` (zeros for inputs that the roots do
+    // not depend on). `seeds[j]` are the K cotangents of `roots[j]`. The
+    // counting sweep is the one of `backward_parallel()` started from all
+    // roots, the cotangents are stored per `_backward_index`. The graph is
+    // retained and no gradients are accumulated.
+    //
+    // For scalar value types, every operation is linear in the incoming
+    // gradient, thus the partial derivatives of a node are computed once and
+    // all K cotangents are updated with a tight loop over `std::array<T, K>`,
+    // which the compiler vectorizes. Other value types (e.g. Tensor) call the
+    // backward function of the operation once per cotangent. Custom
+    // operations are not supported, since they may accumulate gradients.
+    template<std::size_t K>
+    static std::vector<std::array<T, K>> backward_vector(std::span<const std::shared_ptr<VariableImpl<T>>> roots, std::span<const std::array<T, K>> seeds,
+                                                         std::span<const std::shared_ptr<VariableImpl<T>>> inputs) {
+        assert(roots.size() == seeds.size() && "one seed is required per root");
+        using Cotangent = std::array<T, K>;
+        Cotangent zero;
+        zero.fill(T(0));
+
+        std::vector<VariableImpl<T>*> nodes;
+        std::vector<Cotangent> cotangents;
+        auto visit_node = [&](VariableImpl<T>* node) {
+            node->_num_pending_grads = 0;
+            node->_backward_index = static_cast<std::uint32_t>(nodes.size());
+            nodes.push_back(node);
+            cotangents.push_back(zero);
+        };
+        for (const auto& root : roots)
+            if (root->_num_pending_grads == -1)
+                visit_node(root.get());
+        const std::size_t num_roots = nodes.size();
+        for (std::size_t i = 0; i < nodes.size(); ++i) {
+            VariableImpl<T>* node = nodes[i];
+            assert(node->_op != OperatorRegistry::OpCode::Custom && "custom operations do not support vector-seeded backward");
+            for (std::size_t k = 0; k < node->_num_parents; ++k) {
+                VariableImpl<T>* parent = node->_parents[k].get();
+                if (!parent->requires_grad())
+                    continue;
+                if (parent->_num_pending_grads == -1)
+                    visit_node(parent);
+                ++parent->_num_pending_grads;
+            }
+        }
+
+        for (std::size_t j = 0; j < roots.size(); ++j) {
+            Cotangent& cotangent = cotangents[roots[j]->_backward_index];
+            for (std::size_t k = 0; k < K; ++k)
+                cotangent[k] += seeds[j][k];
+        }
+
+        // roots that are ancestors of other roots wait for their cotangents
+        std::vector<VariableImpl<T>*> ready;
+        for (std::size_t i = 0; i < num_roots; ++i)
+            if (nodes[i]->_num_pending_grads == 0)
+                ready.push_back(nodes[i]);
+        while (!ready.empty()) {
+            VariableImpl<T>* node = ready.back();
+            ready.pop_back();
+            if (!node->has_backward_fn())
+                continue;
+            const Cotangent& cotangent = cotangents[node->_backward_index];
+            if constexpr (std::is_arithmetic_v<T>) {
+                const std::array<T, 2> partials = node->backward_value(T(1));
+                for (std::size_t p = 0; p < node->_num_parents; ++p) {
+                    if (!node->_parents[p]->requires_grad())
+                        continue;
+                    Cotangent& out = cotangents[node->_parents[p]->_backward_index];
+                    for (std::size_t k = 0; k < K; ++k)
+                        out[k] += partials[p] * cotangent[k];
+                }
+            } else {
+                using OperatorRegistry::sum_to;
+                for (std::size_t k = 0; k < K; ++k) {
+                    const std::array<T, 2> in_grads = node->backward_value(cotangent[k]);
+                    for (std::size_t p = 0; p < node->_num_parents; ++p)
+                        if (node->_parents[p]->requires_grad())
+                            cotangents[node->_parents[p]->_backward_index][k] += sum_to(in_grads[p], node->_parents[p]->value());
+                }
+            }
+            for (std::size_t p = 0; p < node->_num_parents; ++p) {
+                VariableImpl<T>* parent = node->_parents[p].get();
+                if (parent->requires_grad() && --parent->_num_pending_grads == 0)
+                    ready.push_back(parent);
+            }
+        }
+
+        std::vector<Cotangent> result(inputs.size(), zero);
+        for (std::size_t j = 0; j < inputs.size(); ++j)
+            if (inputs[j]->_num_pending_grads != -1)
+                result[j] = cotangents[inputs[j]->_backward_index];
+        for (VariableImpl<T>* node : nodes)
+            node->_num_pending_grads = -1;
+        return result;
+    }
+
+    // Returns all nodes of the graph of `this`, parents before children, and
+    // sets the `topological_index()` of each node to its position, which
+    // stays valid until the next traversal. Like the backward passes, the
+    // traversal counts the children of each node in the graph with
+    // `_num_pending_grads` and then emits a node once all of its children
+    // have been emitted, without any lookup tables.
+    std::vector<std::shared_ptr<VariableImpl<T>>> topological_order() {
+        std::vector<VariableImpl<T>*> nodes{this};
+        _num_pending_grads = 0;
+        for (std::size_t i = 0; i < nodes.size(); ++i) {
+            for (const auto& parent : nodes[i]->parents()) {
+                if (parent->_num_pending_grads == -1) {
+                    parent->_num_pending_grads = 0;
+                    nodes.push_back(parent.get());
                 }
+                ++parent->_num_pending_grads;
+            }
+        }
+
+        std::vector<std::shared_ptr<VariableImpl<T>>> order(nodes.size());
+        std::size_t position = nodes.size();
+        std::vector<VariableImpl<T>*> ready{this};
+        while (!ready.empty()) {
+            VariableImpl<T>* node = ready.back();
+            ready.pop_back();
+            node->_num_pending_grads = -1;
+            node->_backward_index = static_cast<std::uint32_t>(--position);
+            order[position] = node->shared_from_this();
+            for (const auto& parent : node->parents())
+                if (--parent->_num_pending_grads == 0)
+                    ready.push_back(parent.get());
+        }
+        return order;
+    }
+    std::uint32_t topological_index() const { return _backward_index; }
+
+    // Registers the operation that created this variable from its parents
+    // together with the constants of scalar operations or the values it saved
+    // for its backward function. The backward pass dispatches on it via
+    // `OperatorRegistry::visit()`.
+    void set_op(OperatorRegistry::OpCode op, const std::array<T, 2>& constants = {}) {
+        _op = op;
+        _constants = constants;
+    }
+    OperatorRegistry::OpCode op() const { return _op; }
+    const std::array<T, 2>& constants() const { return _constants; }
+    // nullptr unless the node is a fused node
+    const OperatorRegistry::FusedChain<T>* fused_chain() const { return _fused_chain.get(); }
+
+    // Operations that are not part of the OperatorRegistry, like checkpoints,
+    // store their backward function in the node, which maps the gradient
+    // w.r.t. the node to the gradients w.r.t. its parents. Custom operations
+    // only support first-order gradients.
+    using CustomBackward = std::function<std::array<T, 2>(std::span<const std::shared_ptr<VariableImpl<T>>> parents, const T& grad)>;
+
+    void set_custom_backward(CustomBackward backward) {
+        _op = OperatorRegistry::OpCode::Custom;
+        _custom_backward = std::make_unique<CustomBackward>(std::move(backward));
+    }
+
+    // Elementwise operations applied to a node that nothing else references
+    // are appended to its operation instead of creating a new node, which
+    // then computes `value` (see `unary_operation()` in Variable.hpp).
+    bool can_fuse() const {
+        using OperatorRegistry::OpCode;
+        if (!_requires_grad || _is_leaf)
+            return false;
+        return OperatorRegistry::is_elementwise(_op) || (_op == OpCode::Fused && !_fused_chain->full());
+    }
+
+    void fuse(OperatorRegistry::OpCode op, const std::array<T, 2>& stored, T value) {
+        if (_op != OperatorRegistry::OpCode::Fused) {
+            _fused_chain = std::make_unique<OperatorRegistry::FusedChain<T>>();
+            _fused_chain->append(_op, _constants, _parents[0]->value());
+            _op = OperatorRegistry::OpCode::Fused;
+        }
+        _fused_chain->append(op, stored, _value);
+        _value = std::move(value);
+    }
+
+    bool has_backward_fn() const {
+        return _op != OperatorRegistry::OpCode::Leaf;
+    }
+
+    ~VariableImpl() {
+        // Destroying a long chain of nodes would recursively destroy their
+        // parents and could overflow the stack, thus the parents whose last
+        // reference is held by this node are released iteratively.
+        std::vector<std::shared_ptr<VariableImpl<T>>> stack;
+        for (std::size_t i = 0; i < _num_parents; ++i)
+            stack.push_back(std::move(_parents[i]));
+        while (!stack.empty()) {
+            std::shared_ptr<VariableImpl<T>> node = std::move(stack.back());
+            stack.pop_back();
+            if (node.use_count() == 1) {
+                for (std::size_t i = 0; i < node->_num_parents; ++i)
+                    stack.push_back(std::move(node->_parents[i]));
+                node->clear_parents();
+            }
+        }
+    }
+
+private:
+    // Called once all incoming gradients of this node have been accumulated.
+    // Computes the gradients of the inputs using the backward function of the
+    // registered operation, passes them on to the parents and appends every parent that
+    // has thereby received all of its incoming gradients to `ready`.
+    void propagate_grad(bool retain_graph, bool create_graph, std::vector<std::shared_ptr<VariableImpl<T>>>& ready, Profiler* profiler) {
+        _num_pending_grads = -1;
+        const OperatorRegistry::OpCode op = _op;
+        const Profiler::Span span = profiler ? profiler->begin() : Profiler::Span{};
+
+        if (has_backward_fn()) {
+            // The gradients are written into fixed-size slots, one per input.
+            // If `create_graph=true`, the gradients are Variables computed by
+            // the backward function on Variables and thus create a new
+            // computational graph. Otherwise, the backward function on plain
+            // values is used, which neither creates nodes nor allocates memory.
+            // Gradients that are plain values although `create_graph=true`
+            // (e.g. within a NoGrad scope) take the latter path as well.
+            if (const Variable<T>* grad_var = create_graph ? std::get_if<Variable<T>>(&_grad) : nullptr) {
+                assert(_op != OperatorRegistry::OpCode::Custom && "custom operations only support first-order gradients");
+                const Variable<T>& grad = *grad_var;
+                std::array<Variable<T>, 2> in_grads;
+                if (_op == OperatorRegistry::OpCode::Fused)
+                    in_grads[0] = _fused_chain->backward(Variable<T>(_parents[0]), grad);
+                else
+                    in_grads = OperatorRegistry::visit(_op, _constants, [&](const auto& op) -> std::array<Variable<T>, 2> {
+                        if constexpr (std::decay_t<decltype(op)>::arity == 2)
+                            return op.backward(Variable<T>(_parents[0]), Variable<T>(_parents[1]), grad);
+                        else if constexpr (requires { op.backward_output(grad, grad); })
+                            return {op.backward_output(Variable<T>(this->shared_from_this()), grad)};
+                        else
+                            return {op.backward(Variable<T>(_parents[0]), grad)};
+                    });
+                pass_grads(in_grads, ready);
+            } else {
+                const T grad = std::get<T>(_grad);
+                pass_grads(backward_value(grad), ready);
             }
         }
 
         if (!retain_graph) {
-            _parents.clear();
+            clear_parents();
             _children.clear();
-            _backward_fn = nullptr;
         }
-        _num_bwd_calls = -1;
-        _children_in_graph = 0;
 
         // only leaf nodes keep their gradients
         if (!is_leaf()) {
-            _grad.reset();
+            reset_grad();
         }
+
+        if (profiler)
+            profiler->end(Profiler::Phase::Backward, op, this, span);
     }
 
-    void set_backward_fn(std::function<std::vector<Variable<T>>(const Variable<T>&)> backward_fn) {
-        _backward_fn = std::move(backward_fn);
+    // gradients w.r.t. the parents computed on plain values, from the value
+    // of this node and the values saved in it where possible
+    std::array<T, 2> backward_value(const T& grad) const {
+        if (_op == OperatorRegistry::OpCode::Custom)
+            return (*_custom_backward)(parents(), grad);
+        if (_op == OperatorRegistry::OpCode::Fused)
+            return {_fused_chain->backward_value(_parents[0]->value(), _value, grad)};
+        return OperatorRegistry::visit(_op, _constants, [&](const auto& op) -> std::array<T, 2> {
+            if constexpr (std::decay_t<decltype(op)>::arity == 2)
+                return op.backward_value(_parents[0]->value(), _parents[1]->value(), grad);
+            else
+                return {OperatorRegistry::unary_backward_value(op, _parents[0]->value(), _value, &_constants, grad)};
+        });
     }
 
-    bool has_backward_fn() {
-        return _backward_fn != nullptr;
+    template<typename Grad>
+    void pass_grads(const std::array<Grad, 2>& in_grads, std::vector<std::shared_ptr<VariableImpl<T>>>& ready) {
+        for (std::size_t i = 0; i < _num_parents; ++i) {
+            auto& parent = _parents[i];
+            if (!parent->requires_grad())
+                continue;
+
+            // Operands that have been broadcast receive a gradient of the
+            // shape of the output, which is reduced to their own shape.
+            if constexpr (std::is_same_v<Grad, T>) {
+                using OperatorRegistry::sum_to;
+                T grad = sum_to(in_grads[i], parent->value());
+                if (GradientBuffer<T>* buffer = GradientBuffer<T>::active(); buffer && parent->is_source())
+                    buffer->add(parent, grad);
+                else
+                    parent->add_grad(grad);
+            } else {
+                parent->add_grad(in_grads[i].sum_to(parent->value()));
+            }
+            if (!parent->is_source() && --parent->_num_pending_grads == 0)
+                ready.push_back(parent);
+        }
+    }
+
+    // leaves without parents accumulate their gradients without being counted
+    bool is_source() const { return _is_leaf && _num_parents == 0; }
+
+    // RAII lock of `_children_lock`.
+    class ChildrenLock {
+    public:
+        explicit ChildrenLock(std::atomic_flag& flag) : _flag(flag) {
+            while (_flag.test_and_set(std::memory_order_acquire))
+                std::this_thread::yield();
+        }
+        ~ChildrenLock() { _flag.clear(std::memory_order_release); }
+    private:
+        std::atomic_flag& _flag;
+    };
+
+    void clear_parents() {
+        for (std::size_t i = 0; i < _num_parents; ++i)
+            _parents[i].reset();
+        _num_parents = 0;
+        _op = OperatorRegistry::OpCode::Leaf;
+        _custom_backward.reset();
+        _fused_chain.reset();
     }
 
-private:
     T _value;
-    std::optional<Variable<T>> _grad;
+    // The gradient is stored as a plain value, unless it is part of a
+    // computational graph, i.e. backward() was called with `create_graph=true`.
+    std::variant<std::monostate, T, Variable<T>> _grad;
     bool _requires_grad;
     bool _is_leaf; // only leaf Variables will have their grad populated during a call to backward()
-    int _num_bwd_calls = -1;
-    int _children_in_graph = 0;
-    // VariableImpl stores its parents as a shared pointer, enforcing their
-    // presence for the `_backward_fn`, while keeping their children only as
-    // weak pointers, since if the children are part of the computation
+    OperatorRegistry::OpCode _op = OperatorRegistry::OpCode::Leaf; // operation that created this variable
+    std::uint8_t _num_parents = 0;
+    int _num_pending_grads = -1; // number of incoming gradients still missing during backward()
+    std::array<T, 2> _constants{}; // constants of scalar operations or saved values
+    std::unique_ptr<CustomBackward> _custom_backward; // backward function of custom operations
+    std::unique_ptr<OperatorRegistry::FusedChain<T>> _fused_chain; // operations of fused nodes
+    std::uint32_t _backward_index = 0; // index of this node during backward_parallel(), backward_vector() and topological_order()
+    // VariableImpl stores its parents as shared pointers in inline slots,
+    // enforcing their presence for the backward function of `_op`, while
+    // keeping their children only as weak pointers, since if the children are part of the computation
     // graph (i.e. an ancestor) of the final scalar variable on which `backward()` is called,
     // then they are kept alive by their children (i.e. the grandchildren of `this`),
     // and so on, which are ultimately kept alive by the VariableImpl on which 
     // the initial `backward()` was called. However, if not and they go out of scope,
     // then those children might get deleted, but this is no problem, since then
     // they are not part of the computation graph.
-    std::vector<std::shared_ptr<VariableImpl<T>>> _parents;
+    std::array<std::shared_ptr<VariableImpl<T>>, 2> _parents;
     std::vector<std::weak_ptr<VariableImpl<T>>> _children;
-    std::function<std::vector<Variable<T>>(const Variable<T>&)> _backward_fn;
+    mutable std::atomic_flag _children_lock;
 };
+
+
+template<typename T>
+void GradientBuffer<T>::reduce() {
+    for (auto& [leaf, grad] : _grads)
+        leaf->add_grad(grad);
+    clear();
+}
@@ -0,0 +1,518 @@
+#pragma once
+#include <cmath>
+#include <limits>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <algorithm>
+#include <string_view>
+#include <type_traits>
+
+#if defined(__GNUC__) && !defined(__clang__)
+// The vector types only cross function boundaries inside the kernels, which
+// are inlined into functions compiled for their instruction set. GCC warns
+// about their ABI when it emits the code at the end of the translation unit,
+// thus the warning stays disabled after this header.
+#pragma GCC diagnostic ignored "-Wpsabi"
+#endif
+
+
+
+// Vectorized exp, log, sin, cos, tan and sincos over arrays of doubles. The
+// batched paths (Tensor and BatchProgram) call them instead of one libm
+// function per element, and Dual uses the scalar sincos.
+//
+// The kernels are written once, with GCC vector extensions, and compiled for
+// AVX-512 F and DQ (8 lanes) and AVX2 with FMA (4 lanes). The widest
+// instruction set that the CPU supports is selected at runtime (see
+// `isa()`). The scalar fallback calls libm; it is used for value types other
+// than double, on other architectures, and when `AUTOGRAD_NO_SIMD` is
+// defined. The last elements of an array that do not fill a vector are
+// padded to one, thus every element of an array is computed by the same
+// kernel.
+//
+// The algorithms follow fdlibm: Cody-Waite range reduction followed by its
+// minimax polynomials. Maximum errors measured against long double, over
+// 2 * 10^6 random arguments per range plus the edges of the ranges:
+//
+//      exp      0.90 ulp    [-745, 709.7], subnormal results included
+//      log      0.83 ulp    (0, max double], subnormal arguments included
+//      sin/cos  0.79 ulp    [-10^6, 10^6]
+//      tan      2.22 ulp    [-10^6, 10^6]
+//      sincos   as sin and cos
+//
+// Special values follow libm: exp overflows to inf and underflows to 0, log
+// returns -inf at 0 and NaN for negative arguments, and NaNs propagate.
+// Lanes with |x| > 10^6 are passed to libm by sin, cos, tan and sincos, since
+// the range reduction is only exact for smaller arguments. Results may
+// differ in the last bit between instruction sets (e.g. due to FMA), but
+// never by more than the bounds above. The benchmark reports the throughput of
+// every function per instruction set.
+
+namespace VectorMath {
+
+    enum class Isa { Scalar, AVX2, AVX512 };
+
+    constexpr std::string_view name(Isa isa) {
+        switch (isa) {
+            case Isa::Scalar: return "scalar";
+            case Isa::AVX2:   return "AVX2";
+            case Isa::AVX512: return "AVX-512";
+        }
+        return "";
+    }
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) && !defined(AUTOGRAD_NO_SIMD)
+    #define AUTOGRAD_VECTOR_MATH 1
+#endif
+
+    // The widest instruction set supported by the CPU.
+    inline Isa supported_isa() {
+#ifdef AUTOGRAD_VECTOR_MATH
+        if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512dq"))
+            return Isa::AVX512;
+        if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+            return Isa::AVX2;
+#endif
+        return Isa::Scalar;
+    }
+
+    // The instruction set the kernels use. It can be lowered, e.g. to compare
+    // them, but not while other threads call the kernels.
+    inline Isa& active_isa() {
+        static Isa isa = supported_isa();
+        return isa;
+    }
+
+    inline Isa isa() { return active_isa(); }
+
+    inline void set_isa(Isa isa) {
+        active_isa() = std::min(isa, supported_isa());
+    }
+
+
+    ///////////////////////////////////////////////////////////////////////////
+    ///                               KERNELS                               ///
+    ///////////////////////////////////////////////////////////////////////////
+
+    // vectors of doubles and of integers of the same width
+    using Double4 = double __attribute__((vector_size(32)));
+    using Int4 = std::int64_t __attribute__((vector_size(32)));
+    using Double8 = double __attribute__((vector_size(64)));
+    using Int8 = std::int64_t __attribute__((vector_size(64)));
+
+    template<typename V> struct IntegerOf { using type = std::int64_t; };
+    template<> struct IntegerOf<Double4> { using type = Int4; };
+    template<> struct IntegerOf<Double8> { using type = Int8; };
+
+    template<typename V>
+    using Integer = typename IntegerOf<V>::type;
+
+    // The kernels take doubles or vectors of doubles. Their integer
+    // arithmetic is done on the bits of the doubles.
+    namespace Kernel {
+
+        // std::bit_cast is not inlined without optimization, and calls to it
+        // from code compiled for another instruction set would pass vectors
+        // in different registers.
+        template<typename To, typename From>
+        [[gnu::always_inline]] inline To bit_cast(const From& from) { return __builtin_bit_cast(To, from); }
+
+        template<typename V>
+        [[gnu::always_inline]] inline V splat(double value) { return V{} + value; }
+
+        template<typename V>
+        [[gnu::always_inline]] inline Integer<V> splat_integer(std::int64_t value) { return Integer<V>{} + value; }
+
+        // Adding 1.5 * 2^52 rounds |x| < 2^51 to the nearest integer, which then
+        // is in the low bits of the sum.
+        inline constexpr double shifter = 0x1.8p52;
+
+        // Rounds `x` to the nearest integer `n`, which is returned as a double
+        // and as an integer.
+        template<typename V>
+        [[gnu::always_inline]] inline std::pair<V, Integer<V>> round(const V& x) {
+            const V shifted = x + splat<V>(shifter);
+            return {shifted - splat<V>(shifter), bit_cast<Integer<V>>(shifted) - bit_cast<Integer<V>>(splat<V>(shifter))};
+        }
+
+        // Converts integers |n| < 2^51 to doubles.
+        template<typename V>
+        [[gnu::always_inline]] inline V to_double(const Integer<V>& n) {
+            return bit_cast<V>(n + bit_cast<Integer<V>>(splat<V>(shifter))) - splat<V>(shifter);
+        }
+
+        template<typename V>
+        [[gnu::always_inline]] inline V exp(const V& arg) {
+            constexpr double log2e = 1.44269504088896338700e+00;
+            constexpr double ln2_hi = 6.93147180369123816490e-01;
+            constexpr double ln2_lo = 1.90821492927058770002e-10;
+            constexpr double P1 = 1.66666666666666019037e-01;
+            constexpr double P2 = -2.77777777770155933842e-03;
+            constexpr double P3 = 6.61375632143793436117e-05;
+            constexpr double P4 = -1.65339022054652515390e-06;
+            constexpr double P5 = 4.13813679705723846039e-08;
+            using I = Integer<V>;
+
+            // beyond these bounds, the result overflows or underflows anyway
+            // (NaNs pass both comparisons)
+            V x = arg < splat<V>(-746) ? splat<V>(-746) : arg;
+            x = x > splat<V>(710) ? splat<V>(710) : x;
+
+            // x = k ln2 + r with |r| <= ln2 / 2
+            const auto [n, k] = round(x * log2e);
+            const V hi = x - n * ln2_hi;
+            const V lo = n * ln2_lo;
+            const V r = hi - lo;
+            const V z = r * r;
+            const V c = r - z * (P1 + z * (P2 + z * (P3 + z * (P4 + z * P5))));
+            const V y = 1.0 - ((lo - (r * c) / (2.0 - c)) - hi);
+
+            // 2^k is applied in two factors, so that subnormal results and
+            // results close to the largest double are scaled exactly
+            const I k1 = k >> 1;
+            const I k2 = k - k1;
+            const V scale1 = bit_cast<V>((k1 + 1023) << 52);
+            const V scale2 = bit_cast<V>((k2 + 1023) << 52);
+            return y * scale1 * scale2;
+        }
+
+        template<typename V>
+        [[gnu::always_inline]] inline V log(const V& x) {
+            constexpr double ln2_hi = 6.93147180369123816490e-01;
+            constexpr double ln2_lo = 1.90821492927058770002e-10;
+            constexpr double Lg1 = 6.666666666666735130e-01;
+            constexpr double Lg2 = 3.999999999940941908e-01;
+            constexpr double Lg3 = 2.857142874366239149e-01;
+            constexpr double Lg4 = 2.222219843214978396e-01;
+            constexpr double Lg5 = 1.818357216161805012e-01;
+            constexpr double Lg6 = 1.531383769920937332e-01;
+            constexpr double Lg7 = 1.479819860511658591e-01;
+            using I = Integer<V>;
+
+            // subnormal arguments are scaled into the normal range
+            const auto subnormal = x < splat<V>(std::numeric_limits<double>::min());
+            const V normal = subnormal ? x * 0x1p54 : x;
+            const I bits = bit_cast<I>(normal);
+
+            // x = 2^k m with sqrt(2) / 2 <= m < sqrt(2), f = m - 1
+            const I mantissa = bits & 0x000fffffffffffff;
+            const I carry = (mantissa + 0x00095f6400000000) & 0x0010000000000000;
+            const I k = ((bits >> 52) - 1023) + (carry >> 52) + (subnormal ? splat_integer<V>(-54) : splat_integer<V>(0));
+            const V f = bit_cast<V>(mantissa | (carry ^ 0x3ff0000000000000)) - 1.0;
+
+            // log(m) = 2 atanh(s) with s = f / (2 + f)
+            const V s = f / (2.0 + f);
+            const V z = s * s;
+            const V w = z * z;
+            const V t1 = w * (Lg2 + w * (Lg4 + w * Lg6));
+            const V t2 = z * (Lg1 + w * (Lg3 + w * (Lg5 + w * Lg7)));
+            const V R = t2 + t1;
+            const V hfsq = 0.5 * f * f;
+            const V dk = to_double<V>(k);
+            const V y = dk * ln2_hi - ((hfsq - (s * (hfsq + R) + dk * ln2_lo)) - f);
+
+            // inf and NaN, negative arguments, and 0
+            V result = x < splat<V>(std::numeric_limits<double>::infinity()) ? y : x;
+            result = x < splat<V>(0) ? splat<V>(std::numeric_limits<double>::quiet_NaN()) : result;
+            return x == splat<V>(0) ? splat<V>(-std::numeric_limits<double>::infinity()) : result;
+        }
+
+        // Arguments up to this magnitude are reduced exactly (|n| < 2^20).
+        inline constexpr double reduction_limit = 1e6;
+
+        template<typename V>
+        struct Reduced {
+            V hi;               // x - n pi/2 with |hi| <= pi/4 (roughly)
+            V lo;               // the rounding error of hi
+            Integer<V> quadrant;    // n
+        };
+
+        // x = n pi/2 + hi + lo. pi/2 is split into parts of 33, 33 and 53
+        // bits, thus n times the first two parts is exact.
+        template<typename V>
+        [[gnu::always_inline]] inline Reduced<V> reduce(const V& x) {
+            constexpr double two_over_pi = 6.36619772367581382433e-01;
+            constexpr double pio2_1 = 1.57079632673412561417e+00;
+            constexpr double pio2_2 = 6.07710050630396597660e-11;
+            constexpr double pio2_2t = 2.02226624879595063154e-21;
+            const auto [n, quadrant] = round(x * two_over_pi);
+            const V t = x - n * pio2_1;
+            const V w = n * pio2_2;
+            const V r = t - w;
+            const V tail = n * pio2_2t - ((t - r) - w);
+            const V hi = r - tail;
+            return {hi, (r - hi) - tail, quadrant};
+        }
+
+        // sin(r + rr) for |r| <= pi/4 and |rr| much smaller than r
+        template<typename V>
+        [[gnu::always_inline]] inline V sin_polynomial(const V& r, const V& rr) {
+            constexpr double S1 = -1.66666666666666324348e-01;
+            constexpr double S2 = 8.33333333332248946124e-03;
+            constexpr double S3 = -1.98412698298579493134e-04;
+            constexpr double S4 = 2.75573137070700676789e-06;
+            constexpr double S5 = -2.50507602534068634195e-08;
+            constexpr double S6 = 1.58969099521155010221e-10;
+            const V z = r * r;
+            const V v = z * r;
+            const V p = S2 + z * (S3 + z * (S4 + z * (S5 + z * S6)));
+            return r - ((z * (0.5 * rr - v * p) - rr) - v * S1);
+        }
+
+        // cos(r + rr) for |r| <= pi/4 and |rr| much smaller than r
+        template<typename V>
+        [[gnu::always_inline]] inline V cos_polynomial(const V& r, const V& rr) {
+            constexpr double C1 = 4.16666666666666019037e-02;
+            constexpr double C2 = -1.38888888888741095749e-03;
+            constexpr double C3 = 2.48015872894767294178e-05;
+            constexpr double C4 = -2.75573143513906633035e-07;
+            constexpr double C5 = 2.08757232129817482790e-09;
+            constexpr double C6 = -1.13596475577881948265e-11;
+            const V z = r * r;
+            const V p = z * (C1 + z * (C2 + z * (C3 + z * (C4 + z * (C5 + z * C6)))));
+            const V hz = 0.5 * z;
+            const V w = 1.0 - hz;
+            return w + (((1.0 - w) - hz) + (z * p - r * rr));
+        }
+
+        // Flips the sign of `x` in quadrants 2 and 3.
+        template<typename V>
+        [[gnu::always_inline]] inline V negate_in_lower_half(const V& x, const Integer<V>& quadrant) {
+            return bit_cast<V>(bit_cast<Integer<V>>(x) ^ ((quadrant & 2) << 62));
+        }
+
+        template<typename V>
+        [[gnu::always_inline]] inline std::pair<V, V> sincos(const V& x) {
+            const auto [r, rr, quadrant] = reduce(x);
+            const V s = sin_polynomial(r, rr);
+            const V c = cos_polynomial(r, rr);
+            const auto odd = (quadrant & 1) != 0;
+            // cos(x) = sin(x + pi/2)
+            return {negate_in_lower_half(odd ? c : s, quadrant), negate_in_lower_half(odd ? s : c, quadrant + 1)};
+        }
+
+        template<typename V>
+        [[gnu::always_inline]] inline V sin(const V& x) {
+            const auto [r, rr, quadrant] = reduce(x);
+            const auto odd = (quadrant & 1) != 0;
+            return negate_in_lower_half(odd ? cos_polynomial(r, rr) : sin_polynomial(r, rr), quadrant);
+        }
+
+        template<typename V>
+        [[gnu::always_inline]] inline V cos(const V& x) {
+            const auto [r, rr, quadrant] = reduce(x);
+            const auto odd = (quadrant & 1) != 0;
+            return negate_in_lower_half(odd ? sin_polynomial(r, rr) : cos_polynomial(r, rr), quadrant + 1);
+        }
+
+        template<typename V>
+        [[gnu::always_inline]] inline V tan(const V& x) {
+            const auto [r, rr, quadrant] = reduce(x);
+            const V s = sin_polynomial(r, rr);
+            const V c = cos_polynomial(r, rr);
+            // tan(x) = -cot(r) in odd quadrants
+            return (quadrant & 1) != 0 ? -c / s : s / c;
+        }
+
+    } // namespace Kernel
+
+
+    ///////////////////////////////////////////////////////////////////////////
+    ///                             ARRAY LOOPS                             ///
+    ///////////////////////////////////////////////////////////////////////////
+
+    enum class Function { Exp, Log, Sin, Cos, Tan };
+
+    template<Function F, typename V>
+    [[gnu::always_inline]] inline V apply(const V& x) {
+        if constexpr (F == Function::Exp)
+            return Kernel::exp(x);
+        else if constexpr (F == Function::Log)
+            return Kernel::log(x);
+        else if constexpr (F == Function::Sin)
+            return Kernel::sin(x);
+        else if constexpr (F == Function::Cos)
+            return Kernel::cos(x);
+        else
+            return Kernel::tan(x);
+    }
+
+    // libm, or the overloads of other value types found via argument
+    // dependent lookup
+    template<Function F, typename T>
+    T apply_libm(const T& x) {
+        using std::exp, std::log, std::sin, std::cos, std::tan;
+        if constexpr (F == Function::Exp)
+            return exp(x);
+        else if constexpr (F == Function::Log)
+            return log(x);
+        else if constexpr (F == Function::Sin)
+            return sin(x);
+        else if constexpr (F == Function::Cos)
+            return cos(x);
+        else
+            return tan(x);
+    }
+
+    template<typename V>
+    constexpr std::size_t lanes = sizeof(V) / sizeof(double);
+
+    // Whether a lane of `x` is beyond the range reduction (or NaN).
+    template<typename V>
+    [[gnu::always_inline]] inline bool exceeds_reduction(const V& x) {
+        const V magnitude = Kernel::bit_cast<V>(Kernel::bit_cast<Integer<V>>(x) & 0x7fffffffffffffff);
+        const Integer<V> inside = magnitude <= Kernel::splat<V>(Kernel::reduction_limit);
+        std::int64_t all = -1;
+        for (std::size_t j = 0; j < lanes<V>; ++j)
+            all &= inside[j];
+        return all == 0;
+    }
+
+    template<Function F, typename V>
+    [[gnu::always_inline]] inline V map_vector(const V& x) {
+        V y = apply<F>(x);
+        if constexpr (F == Function::Sin || F == Function::Cos || F == Function::Tan)
+            if (exceeds_reduction(x)) [[unlikely]]
+                for (std::size_t j = 0; j < lanes<V>; ++j)
+                    if (!(std::abs(x[j]) <= Kernel::reduction_limit))
+                        y[j] = apply_libm<F>(x[j]);
+        return y;
+    }
+
+    template<Function F, typename V>
+    [[gnu::always_inline]] inline void map_vectors(const double* in, double* out, std::size_t size) {
+        constexpr std::size_t width = lanes<V>;
+        std::size_t i = 0;
+        for (; i + width <= size; i += width) {
+            V x;
+            std::memcpy(&x, in + i, sizeof(V));
+            const V y = map_vector<F>(x);
+            std::memcpy(out + i, &y, sizeof(V));
+        }
+        if (i < size) {
+            V x{};
+            std::memcpy(&x, in + i, (size - i) * sizeof(double));
+            const V y = map_vector<F>(x);
+            std::memcpy(out + i, &y, (size - i) * sizeof(double));
+        }
+    }
+
+    template<typename V>
+    [[gnu::always_inline]] inline std::pair<V, V> sincos_vector(const V& x) {
+        auto [s, c] = Kernel::sincos(x);
+        if (exceeds_reduction(x)) [[unlikely]]
+            for (std::size_t j = 0; j < lanes<V>; ++j)
+                if (!(std::abs(x[j]) <= Kernel::reduction_limit)) {
+                    s[j] = apply_libm<Function::Sin>(x[j]);
+                    c[j] = apply_libm<Function::Cos>(x[j]);
+                }
+        return {s, c};
+    }
+
+    template<typename V>
+    [[gnu::always_inline]] inline void sincos_vectors(const double* in, double* sin_out, double* cos_out, std::size_t size) {
+        constexpr std::size_t width = lanes<V>;
+        std::size_t i = 0;
+        for (; i + width <= size; i += width) {
+            V x;
+            std::memcpy(&x, in + i, sizeof(V));
+            const auto [s, c] = sincos_vector(x);
+            std::memcpy(sin_out + i, &s, sizeof(V));
+            std::memcpy(cos_out + i, &c, sizeof(V));
+        }
+        if (i < size) {
+            V x{};
+            std::memcpy(&x, in + i, (size - i) * sizeof(double));
+            const auto [s, c] = sincos_vector(x);
+            std::memcpy(sin_out + i, &s, (size - i) * sizeof(double));
+            std::memcpy(cos_out + i, &c, (size - i) * sizeof(double));
+        }
+    }
+
+#ifdef AUTOGRAD_VECTOR_MATH
+    template<Function F>
+    [[gnu::target("avx2,fma")]] void map_avx2(const double* in, double* out, std::size_t size) {
+        map_vectors<F, Double4>(in, out, size);
+    }
+
+    template<Function F>
+    [[gnu::target("avx512f,avx512dq")]] void map_avx512(const double* in, double* out, std::size_t size) {
+        map_vectors<F, Double8>(in, out, size);
+    }
+
+    [[gnu::target("avx2,fma")]] inline void sincos_avx2(const double* in, double* sin_out, double* cos_out, std::size_t size) {
+        sincos_vectors<Double4>(in, sin_out, cos_out, size);
+    }
+
+    [[gnu::target("avx512f,avx512dq")]] inline void sincos_avx512(const double* in, double* sin_out, double* cos_out, std::size_t size) {
+        sincos_vectors<Double8>(in, sin_out, cos_out, size);
+    }
+#endif
+
+    // out[i] = F(in[i]) for i < size
+    template<Function F, typename T>
+    void map(const T* in, T* out, std::size_t size) {
+#ifdef AUTOGRAD_VECTOR_MATH
+        if constexpr (std::is_same_v<T, double>) {
+            switch (isa()) {
+                case Isa::AVX512: return map_avx512<F>(in, out, size);
+                case Isa::AVX2:   return map_avx2<F>(in, out, size);
+                case Isa::Scalar: break;
+            }
+        }
+#endif
+        for (std::size_t i = 0; i < size; ++i)
+            out[i] = apply_libm<F>(in[i]);
+    }
+
+
+    ///////////////////////////////////////////////////////////////////////////
+    ///                              INTERFACE                              ///
+    ///////////////////////////////////////////////////////////////////////////
+
+    // Arrays must not overlap unless they are the same.
+
+    template<typename T>
+    void exp(const T* in, T* out, std::size_t size) { map<Function::Exp>(in, out, size); }
+
+    template<typename T>
+    void log(const T* in, T* out, std::size_t size) { map<Function::Log>(in, out, size); }
+
+    template<typename T>
+    void sin(const T* in, T* out, std::size_t size) { map<Function::Sin>(in, out, size); }
+
+    template<typename T>
+    void cos(const T* in, T* out, std::size_t size) { map<Function::Cos>(in, out, size); }
+
+    template<typename T>
+    void tan(const T* in, T* out, std::size_t size) { map<Function::Tan>(in, out, size); }
+
+    // sin and cos with a single range reduction
+    template<typename T>
+    void sincos(const T* in, T* sin_out, T* cos_out, std::size_t size) {
+#ifdef AUTOGRAD_VECTOR_MATH
+        if constexpr (std::is_same_v<T, double>) {
+            switch (isa()) {
+                case Isa::AVX512: return sincos_avx512(in, sin_out, cos_out, size);
+                case Isa::AVX2:   return sincos_avx2(in, sin_out, cos_out, size);
+                case Isa::Scalar: break;
+            }
+        }
+#endif
+        for (std::size_t i = 0; i < size; ++i) {
+            sin_out[i] = apply_libm<Function::Sin>(in[i]);
+            cos_out[i] = apply_libm<Function::Cos>(in[i]);
+        }
+    }
+
+    // sin and cos of a single value, e.g. for the derivatives of sin, cos and
+    // tan. On single values, libm is as fast as the kernels and compilers
+    // already evaluate both with one range reduction (GCC calls sincos()).
+    template<typename T>
+    std::pair<T, T> sincos(const T& x) {
+        return {apply_libm<Function::Sin>(x), apply_libm<Function::Cos>(x)};
+    }
+
+} // namespace VectorMath
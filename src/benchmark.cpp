@@ -0,0 +1,750 @@
+#include <chrono>
+#include <vector>
+#include <thread>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <string_view>
+#include <new>
+#include <print>
+// Installs the counting operator new, including the aligned one used by the
+// Tensor storage, to measure the memory per node.
+#define AUTOGRAD_PROFILE_ALLOCATIONS
+#include "Variable.hpp"
+#include "Tape.hpp"
+#include "BatchProgram.hpp"
+#include "CompiledFunction.hpp"
+#include "DataParallel.hpp"
+#include "Checkpoint.hpp"
+#include "GraphStats.hpp"
+#include "GraphOptimization.hpp"
+#include "Hessian.hpp"
+#include "Jacobian.hpp"
+#include "SparseDerivatives.hpp"
+#include "Expression.hpp"
+#include "Dual.hpp"
+#include "Jet.hpp"
+#include "Tensor.hpp"
+#include "VectorMath.hpp"
+
+
+// Usage: benchmark [--json <file>]
+//
+// Prints all results and, with `--json`, also writes them to `<file>` in a
+// machine-readable format, so that results of different builds or releases
+// can be compared.
+
+
+// same function as `f()` in main.cpp
+template<typename T>
+T f(const T& x, const T& y) {
+    auto tmp = (x.log() + (-x) * y - y.sin());
+    if ((tmp * static_cast<T>(2)).value() < 0) {
+        tmp = tmp * tmp;
+    }
+    auto tmp2 = tmp;
+    for (int i = 1; i < 5; ++i)
+        tmp = tmp * ((y - x) / static_cast<T>(i)).exp();
+    auto tmp3 = -(tmp * static_cast<T>(5)).sin(); // unused variable
+    return tmp / ((static_cast<T>(2) * x).cos().abs() + tmp2);
+}
+
+// sum of products of neighbouring inputs passed through unary operations
+template<typename T, std::size_t N>
+T g(const std::array<T, N>& x) {
+    T out = x[0].sin() * x[N - 1].exp();
+    for (std::size_t i = 1; i < N; ++i)
+        out = out + x[i - 1].cos() * x[i] / (x[i].exp() + static_cast<T>(1));
+    return out;
+}
+
+// Runs `fn` `iterations` times and returns the average time per call in ns.
+template<typename Fn>
+double time_ns(int iterations, Fn&& fn) {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i)
+        fn(i);
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count() / iterations;
+}
+
+
+// Collects the results of all sections, which are printed as they are added.
+class Report {
+public:
+    void section(std::string_view title) {
+        _section = title;
+        std::println("\n{:~^50}", std::format(" {} ", title));
+    }
+
+    void add(std::string_view name, double value, std::string_view unit) {
+        std::string label = std::format("{}:", name);
+        if (unit == "x")
+            std::println("{:<28} {:>10.2f}x", label, value);
+        else
+            std::println("{:<28} {:>10.1f} {}", label, value, unit);
+        _results.push_back({_section, std::string(name), value, std::string(unit)});
+    }
+
+    void write_json(std::FILE* out, double checksum) const {
+        std::println(out, "{{");
+        std::println(out, "  \"hardware_concurrency\": {},", std::thread::hardware_concurrency());
+        std::println(out, "  \"checksum\": {},", checksum);
+        std::println(out, "  \"results\": [");
+        for (std::size_t i = 0; i < _results.size(); ++i) {
+            const Result& result = _results[i];
+            std::println(out, "    {{\"section\": \"{}\", \"name\": \"{}\", \"value\": {}, \"unit\": \"{}\"}}{}",
+                result.section, result.name, result.value, result.unit, i + 1 < _results.size() ? "," : "");
+        }
+        std::println(out, "  ]");
+        std::println(out, "}}");
+    }
+
+private:
+    struct Result {
+        std::string section;
+        std::string name;
+        double value;
+        std::string unit;
+    };
+
+    std::string _section;
+    std::vector<Result> _results;
+};
+
+
+int main(int argc, char const *argv[])
+{
+    using dtype = double;
+    constexpr int iterations = 200000;
+    dtype checksum = 0;
+
+    const char* json_path = nullptr;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+            json_path = argv[++i];
+        } else {
+            std::println("usage: {} [--json <file>]", argv[0]);
+            return 1;
+        }
+    }
+
+    Report report;
+    report.section("f(x, y): forward + backward");
+
+    double graph_ns = time_ns(iterations, [&](int i) {
+        Variable<dtype> x(2 + 1e-6 * i, true), y(5, true);
+        auto out = f(x, y);
+        out.backward();
+        checksum += x.grad().value().value() + y.grad().value().value();
+    });
+    report.add("Variable graph", graph_ns, "ns/iter");
+
+    Tape<dtype>& tape = Tape<dtype>::get();
+    double tape_ns = time_ns(iterations, [&](int i) {
+        tape.reset();
+        TapeVariable<dtype> x(2 + 1e-6 * i), y(5);
+        auto out = f(x, y);
+        out.backward();
+        checksum += x.grad() + y.grad();
+    });
+    report.add("Tape", tape_ns, "ns/iter");
+    report.add("Tape speedup", graph_ns / tape_ns, "x");
+
+    auto compiled = CompiledFunction<dtype>::compile([](auto x, auto y) { return f(x, y); }, 2, 5);
+    double compiled_ns = time_ns(iterations, [&](int i) {
+        compiled.forward(2 + 1e-6 * i, 5);
+        compiled.backward();
+        checksum += compiled.grad(0) + compiled.grad(1);
+    });
+    report.add("CompiledFunction", compiled_ns, "ns/iter");
+    report.add("CompiledFunction speedup", graph_ns / compiled_ns, "x");
+
+    constexpr std::size_t batch_size = 4096;
+    auto program = BatchProgram<dtype>::record([](auto x, auto y) { return f(x, y); }, 2, 5);
+    std::vector<dtype> batch_inputs(2 * batch_size), batch_values(batch_size), batch_grads(2 * batch_size);
+    double batch_ns = time_ns(iterations / batch_size, [&](int i) {
+        for (std::size_t p = 0; p < batch_size; ++p) {
+            batch_inputs[p] = 2 + 1e-6 * (i * batch_size + p);
+            batch_inputs[batch_size + p] = 5;
+        }
+        checksum += program.evaluate(batch_inputs, batch_values, batch_grads).size();
+        checksum += batch_grads[0] + batch_grads[batch_size];
+    }) / batch_size;
+    report.add("BatchProgram", batch_ns, "ns/iter");
+    report.add("BatchProgram speedup", graph_ns / batch_ns, "x");
+
+    // forward mode needs one pass per input with a single tangent
+    double dual_f_ns = time_ns(iterations, [&](int i) {
+        auto dx = f(Dual<dtype>(2 + 1e-6 * i, 1), Dual<dtype>(5, 0));
+        auto dy = f(Dual<dtype>(2 + 1e-6 * i, 0), Dual<dtype>(5, 1));
+        checksum += dx.tangent() + dy.tangent();
+    });
+    report.add("2 x Dual<T>", dual_f_ns, "ns/iter");
+    double dual2_f_ns = time_ns(iterations, [&](int i) {
+        auto out = f(Dual<dtype, 2>::variable(2 + 1e-6 * i, 0), Dual<dtype, 2>::variable(5, 1));
+        checksum += out.tangent(0) + out.tangent(1);
+    });
+    report.add("1 x Dual<T, 2>", dual2_f_ns, "ns/iter");
+    // relative to the two passes with a single tangent, not to the graph
+    report.add("Dual<T, 2> speedup", dual_f_ns / dual2_f_ns, "x");
+
+
+    report.section("f(x, y): forward only");
+    double forward_graph_ns = time_ns(iterations, [&](int i) {
+        Variable<dtype> x(2 + 1e-6 * i, true), y(5, true);
+        checksum += f(x, y).value();
+    });
+    report.add("Variable graph", forward_graph_ns, "ns/iter");
+
+    Variable<dtype> inference_x(2, true), inference_y(5, true);
+    double no_grad_ns = time_ns(iterations, [&](int i) {
+        NoGrad no_grad;
+        checksum += f(inference_x + 1e-6 * i, inference_y).value();
+    });
+    report.add("NoGrad", no_grad_ns, "ns/iter");
+    report.add("NoGrad speedup", forward_graph_ns / no_grad_ns, "x");
+
+    // `f()` on plain values, without the unused `tmp3`
+    auto f_value = [](dtype x, dtype y) {
+        dtype tmp = std::log(x) + (-x) * y - std::sin(y);
+        if (tmp * 2 < 0)
+            tmp = tmp * tmp;
+        const dtype tmp2 = tmp;
+        for (int i = 1; i < 5; ++i)
+            tmp = tmp * std::exp((y - x) / i);
+        return tmp / (std::abs(std::cos(2 * x)) + tmp2);
+    };
+    double plain_forward_ns = time_ns(iterations, [&](int i) {
+        checksum += f_value(2 + 1e-6 * i, 5);
+    });
+    report.add("plain T", plain_forward_ns, "ns/iter");
+    report.add("NoGrad relative to plain T", no_grad_ns / plain_forward_ns, "x");
+
+
+    report.section("f(x, y): second derivatives");
+    double second_order_ns = time_ns(iterations / 10, [&](int i) {
+        Variable<dtype> x(2 + 1e-6 * i, true), y(5, true);
+        auto out = f(x, y);
+        out.backward(1, true, true);
+        auto df_dx = x.grad().value();
+        x.zero_grad();
+        y.zero_grad();
+        df_dx.backward();
+        checksum += x.grad_value().value() + y.grad_value().value();
+    });
+    report.add("create_graph", second_order_ns, "ns/iter");
+    report.add("relative to first order", second_order_ns / graph_ns, "x");
+
+    // the row of the Hessian w.r.t. x as a Hessian-vector product
+    double hvp_ns = time_ns(iterations / 10, [&](int i) {
+        Variable<Dual<dtype>> x(Dual<dtype>(2 + 1e-6 * i, 1), true), y(Dual<dtype>(5, 0), true);
+        f(x, y).backward();
+        checksum += x.grad_value().value().tangent() + y.grad_value().value().tangent();
+    });
+    report.add("Variable<Dual<T>>", hvp_ns, "ns/iter");
+    report.add("HVP relative to first order", hvp_ns / graph_ns, "x");
+    report.add("HVP speedup", second_order_ns / hvp_ns, "x");
+
+
+    report.section("f(x, y): third derivative");
+    double third_order_ns = time_ns(iterations / 10, [&](int i) {
+        Variable<dtype> x(2 + 1e-6 * i, true), y(5);
+        Variable<dtype> derivative = f(x, y);
+        for (int order = 0; order < 3; ++order) {
+            x.zero_grad();
+            derivative.backward(1, true, true);
+            derivative = x.grad().value();
+        }
+        checksum += derivative.value();
+    });
+    report.add("3 x create_graph", third_order_ns, "ns/iter");
+
+    double jet_ns = time_ns(iterations, [&](int i) {
+        auto out = f(Jet<dtype, 3>::variable(2 + 1e-6 * i), Jet<dtype, 3>(5));
+        checksum += out.derivative(3);
+    });
+    report.add("Jet<T, 3>", jet_ns, "ns/iter");
+    report.add("Jet<T, 3> speedup", third_order_ns / jet_ns, "x");
+
+    // graph of the third derivative, where the graph of each derivative is
+    // optimized before it is differentiated
+    auto third_derivative = [](bool optimize) {
+        Variable<dtype> x(2, true), y(5);
+        Variable<dtype> derivative = f(x, y);
+        for (int order = 0; order < 3; ++order) {
+            if (optimize)
+                optimize_graph(derivative);
+            x.zero_grad();
+            derivative.backward(1, true, true);
+            derivative = x.grad().value();
+        }
+        if (optimize)
+            optimize_graph(derivative);
+        return std::pair{x, derivative};
+    };
+    auto [plain_x, plain_derivative] = third_derivative(false);
+    auto [optimized_x, optimized_derivative] = third_derivative(true);
+    report.add("third derivative graph", graph_stats(plain_derivative).nodes, "nodes");
+    report.add("optimize_graph()", graph_stats(optimized_derivative).nodes, "nodes");
+    double plain_backward_ns = time_ns(iterations / 10, [&](int) {
+        plain_x.zero_grad();
+        plain_derivative.backward(1, true);
+        checksum += plain_x.grad_value().value();
+    });
+    double optimized_backward_ns = time_ns(iterations / 10, [&](int) {
+        optimized_x.zero_grad();
+        optimized_derivative.backward(1, true);
+        checksum += optimized_x.grad_value().value();
+    });
+    report.add("backward()", plain_backward_ns, "ns/iter");
+    report.add("optimized backward()", optimized_backward_ns, "ns/iter");
+    report.add("optimize_graph() speedup", plain_backward_ns / optimized_backward_ns, "x");
+
+
+    report.section("(2 * x).cos().abs().exp()");
+    double separate_ns = time_ns(iterations, [&](int i) {
+        Variable<dtype> x(1e-6 * i, true);
+        // named intermediates are not fused, since they are still referenced
+        Variable<dtype> scaled = 2 * x;
+        Variable<dtype> cos = scaled.cos();
+        Variable<dtype> abs = cos.abs();
+        Variable<dtype> out = abs.exp();
+        out.backward();
+        checksum += x.grad_value().value();
+    });
+    report.add("one node per operation", separate_ns, "ns/iter");
+
+    double fused_ns = time_ns(iterations, [&](int i) {
+        Variable<dtype> x(1e-6 * i, true);
+        Variable<dtype> out = (2 * x).cos().abs().exp();
+        out.backward();
+        checksum += x.grad_value().value();
+    });
+    report.add("fused node", fused_ns, "ns/iter");
+    report.add("fusion speedup", separate_ns / fused_ns, "x");
+
+
+    report.section("x.exp() * x.tan() + x.sin() * x.cos()");
+    Variable<dtype> trig_x(0.5, true);
+    Variable<dtype> trig = trig_x.exp() * trig_x.tan() + trig_x.sin() * trig_x.cos();
+    std::vector<std::shared_ptr<VariableImpl<dtype>>> trig_nodes;
+    for (const auto& node : trig.variable()->topological_order())
+        if (node->op() >= OperatorRegistry::OpCode::Exp && node->op() <= OperatorRegistry::OpCode::Tan)
+            trig_nodes.push_back(node);
+    // the backward functions of the four nodes, recomputing the forward pass
+    // from the input as opposed to reading the output and the saved values
+    double recomputed_ns = time_ns(iterations, [&](int i) {
+        const dtype grad = 1 + 1e-6 * i;
+        for (const auto& node : trig_nodes)
+            checksum += OperatorRegistry::visit(node->op(), node->constants(), [&](const auto& op) -> dtype {
+                if constexpr (std::decay_t<decltype(op)>::arity == 1)
+                    return op.backward_value(node->parents()[0]->value(), grad);
+                else
+                    return 0;
+            });
+    });
+    report.add("recomputed backward_value()", recomputed_ns, "ns/iter");
+
+    double saved_ns = time_ns(iterations, [&](int i) {
+        const dtype grad = 1 + 1e-6 * i;
+        for (const auto& node : trig_nodes)
+            checksum += OperatorRegistry::visit(node->op(), node->constants(), [&](const auto& op) -> dtype {
+                if constexpr (std::decay_t<decltype(op)>::arity == 1)
+                    return OperatorRegistry::unary_backward_value(op, node->parents()[0]->value(), node->value(), &node->constants(), grad);
+                else
+                    return 0;
+            });
+    });
+    report.add("saved values", saved_ns, "ns/iter");
+    report.add("saved values speedup", recomputed_ns / saved_ns, "x");
+
+
+    report.section("a.log() + a * b - b.sin()");
+    auto expr = [](auto a, auto b) { return a.log() + a * b - b.sin(); };
+    double expr_graph_ns = time_ns(iterations, [&](int i) {
+        Variable<dtype> a(2 + 1e-6 * i, true), b(5, true);
+        auto out = expr(a, b);
+        out.backward();
+        checksum += out.value() + a.grad_value().value() + b.grad_value().value();
+    });
+    report.add("Variable graph", expr_graph_ns, "ns/iter");
+
+    double expr_template_ns = time_ns(iterations, [&](int i) {
+        auto [value, grad] = value_and_grad(expr, 2 + 1e-6 * i, dtype(5));
+        checksum += value + grad[0] + grad[1];
+    });
+    report.add("Expression template", expr_template_ns, "ns/iter");
+    report.add("Expression speedup", expr_graph_ns / expr_template_ns, "x");
+
+
+    report.section("Gradient of g(x) with 16 inputs");
+    constexpr std::size_t n_inputs = 16;
+    double dual_ns = time_ns(iterations / 10, [&](int i) {
+        for (std::size_t j = 0; j < n_inputs; ++j) {
+            std::array<Dual<dtype>, n_inputs> x;
+            for (std::size_t k = 0; k < n_inputs; ++k)
+                x[k] = Dual<dtype>(1e-6 * i + 0.1 * k, j == k);
+            checksum += g(x).tangent();
+        }
+    });
+    report.add("16 x Dual<T>", dual_ns, "ns/iter");
+
+    double dual_n_ns = time_ns(iterations / 10, [&](int i) {
+        std::array<Dual<dtype, n_inputs>, n_inputs> x;
+        for (std::size_t k = 0; k < n_inputs; ++k)
+            x[k] = Dual<dtype, n_inputs>::variable(1e-6 * i + 0.1 * k, k);
+        auto out = g(x);
+        for (std::size_t j = 0; j < n_inputs; ++j)
+            checksum += out.tangent(j);
+    });
+    report.add("1 x Dual<T, 16>", dual_n_ns, "ns/iter");
+    report.add("Dual<T, 16> speedup", dual_ns / dual_n_ns, "x");
+
+
+    report.section("Jacobian of 16 outputs w.r.t. 16 inputs");
+    // the outputs share the graph of g(x)
+    auto jacobian_graph = [&](int i, std::array<Variable<dtype>, n_inputs>& x) {
+        for (std::size_t k = 0; k < n_inputs; ++k)
+            x[k] = Variable<dtype>(1e-6 * i + 0.1 * k, true);
+        Variable<dtype> shared = g(x);
+        std::vector<Variable<dtype>> outputs;
+        for (std::size_t k = 0; k < n_inputs; ++k)
+            outputs.push_back(shared * x[k] + x[k].sin());
+        return outputs;
+    };
+    double rows_ns = time_ns(iterations / 10, [&](int i) {
+        std::array<Variable<dtype>, n_inputs> x;
+        auto outputs = jacobian_graph(i, x);
+        for (std::size_t k = 0; k < n_inputs; ++k) {
+            for (auto& input : x)
+                input.zero_grad();
+            outputs[k].backward(1, true);
+            checksum += x[n_inputs - 1 - k].grad_value().value();
+        }
+    });
+    report.add("16 x backward()", rows_ns, "ns/iter");
+
+    double jacobian_ns = time_ns(iterations / 10, [&](int i) {
+        std::array<Variable<dtype>, n_inputs> x;
+        auto outputs = jacobian_graph(i, x);
+        auto J = jacobian<n_inputs>(std::span<const Variable<dtype>>(outputs), std::span<const Variable<dtype>>(x));
+        for (std::size_t k = 0; k < n_inputs; ++k)
+            checksum += J[k][n_inputs - 1 - k];
+    });
+    report.add("jacobian()", jacobian_ns, "ns/iter");
+    report.add("jacobian() speedup", rows_ns / jacobian_ns, "x");
+
+
+    report.section("Sparse Hessian with 1000 variables");
+    // chained objective with a banded Hessian
+    auto banded = [](auto x) {
+        auto out = (x[0] * x[1]).sin();
+        for (std::size_t i = 1; i + 1 < x.size(); ++i)
+            out = out + (x[i] * x[i + 1]).sin() + x[i - 1].exp() / (x[i + 1] * x[i + 1] + 1);
+        return out;
+    };
+    constexpr std::size_t n_sparse = 1000;
+    std::vector<dtype> x_sparse(n_sparse);
+    for (std::size_t i = 0; i < n_sparse; ++i)
+        x_sparse[i] = 1e-3 * i;
+    double dense_ns = time_ns(1, [&](int) {
+        std::vector<dtype> v(n_sparse, 0);
+        for (std::size_t j = 0; j < n_sparse; ++j) {
+            v[j] = 1;
+            checksum += hvp(banded, x_sparse, v)[j];
+            v[j] = 0;
+        }
+    });
+    report.add("1000 x hvp()", dense_ns / 1000, "us/iter");
+    double sparse_ns = time_ns(10, [&](int) {
+        CsrMatrix<dtype> H = sparse_hessian(banded, x_sparse);
+        checksum += H(n_sparse / 2, n_sparse / 2);
+    });
+    report.add("sparse_hessian()", sparse_ns / 1000, "us/iter");
+    report.add("sparse_hessian() speedup", dense_ns / sparse_ns, "x");
+    {
+        std::vector<Variable<dtype>> x;
+        for (dtype value : x_sparse)
+            x.emplace_back(value, true);
+        const auto pattern = SparseDerivatives::hessian_sparsity<dtype>(banded(std::span<const Variable<dtype>>(x)), x);
+        report.add("colors", static_cast<double>(SparseDerivatives::num_colors(SparseDerivatives::color_distance2(pattern))), "");
+    }
+
+
+    // Builds a graph of `size` levels with `build(x, size)` several times and
+    // reports the construction and backward time per node. Returns the bytes
+    // allocated per node during construction.
+    auto measure_graph = [&](std::string_view name, std::size_t size, auto&& build) {
+        const int repetitions = std::max(1, static_cast<int>(iterations / size / 2));
+        double construct_ns = 0, backward_ns = 0, bytes_per_node = 0;
+        for (int i = 0; i < repetitions; ++i) {
+            Variable<dtype> x(1 + 1e-6 * i, true);
+            const std::size_t allocated_before = Profiler::thread_allocated_bytes();
+            auto start = std::chrono::steady_clock::now();
+            auto [out, num_nodes] = build(x, size);
+            auto middle = std::chrono::steady_clock::now();
+            bytes_per_node = static_cast<double>(Profiler::thread_allocated_bytes() - allocated_before) / num_nodes;
+            out.backward();
+            auto end = std::chrono::steady_clock::now();
+            construct_ns += std::chrono::duration<double, std::nano>(middle - start).count() / num_nodes;
+            backward_ns += std::chrono::duration<double, std::nano>(end - middle).count() / num_nodes;
+            checksum += x.grad_value().value();
+        }
+        report.add(std::format("{} construction", name), construct_ns / repetitions, "ns/node");
+        report.add(std::format("{} backward", name), backward_ns / repetitions, "ns/node");
+        return bytes_per_node;
+    };
+    auto chain = [](const Variable<dtype>& x, std::size_t size) {
+        Variable<dtype> out = x;
+        for (std::size_t j = 0; j < size; ++j)
+            out = (out * x).sin();
+        return std::pair{out, 2 * size};
+    };
+    // every level is used by two operations
+    auto diamond = [](const Variable<dtype>& x, std::size_t size) {
+        Variable<dtype> out = x;
+        for (std::size_t j = 0; j < size; ++j)
+            out = out.sin() * out.cos() + x;
+        return std::pair{out, 4 * size};
+    };
+    // independent terms that are summed up
+    auto wide = [](const Variable<dtype>& x, std::size_t size) {
+        Variable<dtype> out = (x * x).sin();
+        for (std::size_t j = 1; j < size; ++j)
+            out = out + (x * static_cast<dtype>(j)).sin();
+        return std::pair{out, 3 * size};
+    };
+
+    report.section("Node graph: 1000 levels");
+    report.add("sizeof(VariableImpl)", sizeof(VariableImpl<dtype>), "bytes");
+    report.add("chain allocated", measure_graph("chain", 1000, chain), "bytes/node");
+    report.add("diamond allocated", measure_graph("diamond", 1000, diamond), "bytes/node");
+    report.add("wide allocated", measure_graph("wide", 1000, wide), "bytes/node");
+
+
+    report.section("Chain: scaling with graph size");
+    for (std::size_t size = 10; size <= 100000; size *= 10)
+        measure_graph(std::format("{} levels", size), size, chain);
+
+
+    report.section("4096 parameters: forward + backward");
+    constexpr std::size_t n_params = 4096;
+    double scalar_ns = time_ns(iterations / 1000, [&](int i) {
+        std::vector<Variable<dtype>> w;
+        w.reserve(n_params);
+        for (std::size_t k = 0; k < n_params; ++k)
+            w.emplace_back(1e-6 * i + 1e-3 * k, true);
+        Variable<dtype> loss = (w[0] * w[0]).sin();
+        for (std::size_t k = 1; k < n_params; ++k)
+            loss = loss + (w[k] * w[k]).sin();
+        loss.backward();
+        checksum += w[n_params - 1].grad_value().value();
+    });
+    report.add("Variable<T>", scalar_ns, "ns/iter");
+
+    double tensor_ns = time_ns(iterations / 1000, [&](int i) {
+        Tensor<dtype> values = Tensor<dtype>::empty({n_params});
+        for (std::size_t k = 0; k < n_params; ++k)
+            values[k] = 1e-6 * i + 1e-3 * k;
+        Variable<Tensor<dtype>> w(values, true);
+        auto loss = (w * w).sin().sum();
+        loss.backward();
+        checksum += w.grad_value().value()[n_params - 1];
+    });
+    report.add("Variable<Tensor<T>>", tensor_ns, "ns/iter");
+    report.add("Tensor speedup", scalar_ns / tensor_ns, "x");
+
+    constexpr std::size_t n_matmul = 256;
+    Tensor<dtype> lhs = Tensor<dtype>::ones({n_matmul, n_matmul});
+    Tensor<dtype> rhs = Tensor<dtype>::ones({n_matmul, n_matmul});
+    double matmul_ns = time_ns(20, [&](int i) {
+        checksum += matmul(lhs, rhs)[i];
+    });
+    report.add("matmul 256x256", 2.0 * n_matmul * n_matmul * n_matmul / matmul_ns, "GFLOP/s");
+
+
+    report.section("64 loss terms: backward only");
+    constexpr std::size_t n_terms = 64;
+    auto wide_graph = [&](std::vector<Variable<Tensor<dtype>>>& w) {
+        w.clear();
+        for (std::size_t k = 0; k < n_terms; ++k)
+            w.emplace_back(Tensor<dtype>({4096}, 1e-3 * k), true);
+        Variable<Tensor<dtype>> loss = ((w[0] * w[0]).sin().exp() * w[0]).mean();
+        for (std::size_t k = 1; k < n_terms; ++k)
+            loss = loss + ((w[k] * w[k]).sin().exp() * w[k]).mean();
+        return loss;
+    };
+    auto time_backward = [&](auto&& backward) {
+        double ns = 0;
+        std::vector<Variable<Tensor<dtype>>> w;
+        for (int i = 0; i < 20; ++i) {
+            auto loss = wide_graph(w);
+            auto start = std::chrono::steady_clock::now();
+            backward(loss);
+            auto end = std::chrono::steady_clock::now();
+            ns += std::chrono::duration<double, std::nano>(end - start).count();
+            checksum += w[n_terms - 1].grad_value().value()[0];
+        }
+        return ns / 20;
+    };
+    const double sequential_ns = time_backward([](auto& loss) { loss.backward(); });
+    report.add("backward()", sequential_ns / 1000, "us/iter");
+    const std::size_t max_threads = std::max(1u, std::thread::hardware_concurrency());
+    for (std::size_t threads = 1; threads <= std::min<std::size_t>(max_threads, 32); threads *= 2) {
+        ThreadPool pool(threads);
+        const double parallel_ns = time_backward([&](auto& loss) { loss.backward_parallel(pool); });
+        report.add(std::format("parallel, {} threads", threads), parallel_ns / 1000, "us/iter");
+        report.add(std::format("speedup, {} threads", threads), sequential_ns / parallel_ns, "x");
+    }
+
+
+    report.section("32 shards of 64 samples: data-parallel");
+    constexpr std::size_t n_shards = 32, shard_size = 64, n_weights = 16;
+    std::vector<Variable<dtype>> weights;
+    for (std::size_t k = 0; k < n_weights; ++k)
+        weights.emplace_back(1e-2 * k, true);
+    // squared error of a linear model on the samples of one shard
+    auto shard_loss = [&](std::size_t shard) {
+        Variable<dtype> loss(0);
+        for (std::size_t s = 0; s < shard_size; ++s) {
+            Variable<dtype> prediction = weights[0] * 1;
+            for (std::size_t k = 1; k < n_weights; ++k)
+                prediction = prediction + weights[k] * std::sin(1e-3 * (shard * shard_size + s) + k);
+            loss = loss + (prediction - 1) * (prediction - 1);
+        }
+        return loss;
+    };
+    const double serial_ns = time_ns(10, [&](int) {
+        for (std::size_t shard = 0; shard < n_shards; ++shard)
+            shard_loss(shard).backward();
+        checksum += weights[n_weights - 1].grad_value().value();
+    });
+    report.add("serial", serial_ns / 1000, "us/iter");
+    for (std::size_t threads = 1; threads <= std::min<std::size_t>(max_threads, 32); threads *= 2) {
+        ThreadPool pool(threads);
+        const double data_parallel_ns = time_ns(10, [&](int) {
+            data_parallel<dtype>(pool, n_shards, [&](std::size_t shard) { shard_loss(shard).backward(); });
+            checksum += weights[n_weights - 1].grad_value().value();
+        });
+        report.add(std::format("parallel, {} threads", threads), data_parallel_ns / 1000, "us/iter");
+        report.add(std::format("speedup, {} threads", threads), serial_ns / data_parallel_ns, "x");
+    }
+
+    report.section("Chain of 10000 steps: checkpointing");
+    constexpr std::size_t n_steps = 10000;
+    Variable<dtype> theta(0.5, true);
+    auto chain_step = [&](Variable<dtype> state, std::size_t) { return (state * theta).sin() + state; };
+    auto time_chain = [&](auto&& build, double& graph_bytes) {
+        return time_ns(10, [&](int) {
+            Variable<dtype> out = build();
+            graph_bytes = static_cast<double>(graph_stats(out).bytes());
+            out.backward();
+            checksum += theta.grad_value().value();
+        });
+    };
+    double plain_bytes = 0, checkpointed_bytes = 0;
+    const double plain_ns = time_chain([&] {
+        Variable<dtype> state = theta;
+        for (std::size_t i = 0; i < n_steps; ++i)
+            state = chain_step(state, i);
+        return state;
+    }, plain_bytes);
+    const double checkpointed_ns = time_chain([&] {
+        return checkpoint_sequential(chain_step, theta, n_steps);
+    }, checkpointed_bytes);
+    report.add("graph", plain_ns / 1000, "us/iter");
+    report.add("graph, retained", plain_bytes / 1024, "KiB");
+    report.add("checkpointed", checkpointed_ns / 1000, "us/iter");
+    report.add("checkpointed, retained", checkpointed_bytes / 1024, "KiB");
+    report.add("checkpointed speedup", plain_ns / checkpointed_ns, "x");
+
+
+    report.section("4096 doubles: transcendental functions");
+    constexpr std::size_t n_math = 4096;
+    constexpr int math_iterations = 500;
+    std::vector<dtype> math_in(n_math), math_out(n_math), math_out2(n_math);
+    for (std::size_t i = 0; i < n_math; ++i)
+        math_in[i] = 0.1 + 10.0 * static_cast<dtype>(i) / n_math;
+    // the available instruction sets, from libm to the widest
+    std::vector<VectorMath::Isa> isas{VectorMath::Isa::Scalar};
+    for (VectorMath::Isa isa : {VectorMath::Isa::AVX2, VectorMath::Isa::AVX512})
+        if (isa <= VectorMath::supported_isa())
+            isas.push_back(isa);
+    auto time_math = [&](std::string_view name, auto&& fn) {
+        double libm_ns = 0;
+        for (VectorMath::Isa isa : isas) {
+            VectorMath::set_isa(isa);
+            const double ns = time_ns(math_iterations, [&](int) {
+                fn(math_in.data(), math_out.data(), n_math);
+                checksum += math_out[n_math - 1];
+            });
+            report.add(std::format("{} {}", name, isa == VectorMath::Isa::Scalar ? "libm" : VectorMath::name(isa)), n_math / ns * 1e3, "Melem/s");
+            if (isa == VectorMath::Isa::Scalar)
+                libm_ns = ns;
+            else
+                report.add(std::format("{} {} speedup", name, VectorMath::name(isa)), libm_ns / ns, "x");
+        }
+        VectorMath::set_isa(VectorMath::supported_isa());
+    };
+    time_math("exp", [](const dtype* in, dtype* out, std::size_t size) { VectorMath::exp(in, out, size); });
+    time_math("log", [](const dtype* in, dtype* out, std::size_t size) { VectorMath::log(in, out, size); });
+    time_math("sin", [](const dtype* in, dtype* out, std::size_t size) { VectorMath::sin(in, out, size); });
+    time_math("cos", [](const dtype* in, dtype* out, std::size_t size) { VectorMath::cos(in, out, size); });
+    time_math("tan", [](const dtype* in, dtype* out, std::size_t size) { VectorMath::tan(in, out, size); });
+    time_math("sincos", [&](const dtype* in, dtype* out, std::size_t size) { VectorMath::sincos(in, out, math_out2.data(), size); });
+
+
+    report.section("4096 points: batched transcendentals");
+    auto trig_fn = [](auto x, auto y) { return x.exp() * x.tan() + x.sin() * y.cos() - y.log(); };
+    auto trig_program = BatchProgram<dtype>::record(trig_fn, 0.5, 2.0);
+    std::vector<dtype> trig_inputs(2 * n_math), trig_values(n_math), trig_grads(2 * n_math);
+    for (std::size_t p = 0; p < n_math; ++p) {
+        trig_inputs[p] = 1.5 * static_cast<dtype>(p) / n_math - 0.75;
+        trig_inputs[n_math + p] = 0.1 + 10.0 * static_cast<dtype>(p) / n_math;
+    }
+    Variable<Tensor<dtype>> trig_tx(Tensor<dtype>({n_math}, std::span<const dtype>(trig_inputs.data(), n_math)), true);
+    Variable<Tensor<dtype>> trig_ty(Tensor<dtype>({n_math}, std::span<const dtype>(trig_inputs.data() + n_math, n_math)), true);
+    double program_libm_ns = 0, tensor_libm_ns = 0;
+    for (VectorMath::Isa isa : isas) {
+        VectorMath::set_isa(isa);
+        const std::string_view isa_name = isa == VectorMath::Isa::Scalar ? "libm" : VectorMath::name(isa);
+        const double program_ns = time_ns(math_iterations, [&](int) {
+            checksum += trig_program.evaluate(trig_inputs, trig_values, trig_grads).size();
+            checksum += trig_grads[0] + trig_grads[n_math];
+        });
+        report.add(std::format("BatchProgram {}", isa_name), program_ns / n_math, "ns/point");
+        const double tensor_ns = time_ns(math_iterations / 10, [&](int) {
+            trig_tx.zero_grad();
+            trig_ty.zero_grad();
+            Variable<Tensor<dtype>> out = trig_fn(trig_tx, trig_ty).sum();
+            out.backward();
+            checksum += trig_tx.grad_value().value()[0];
+        });
+        report.add(std::format("Tensor graph {}", isa_name), tensor_ns / n_math, "ns/point");
+        if (isa == VectorMath::Isa::Scalar) {
+            program_libm_ns = program_ns;
+            tensor_libm_ns = tensor_ns;
+        } else {
+            report.add(std::format("BatchProgram {} speedup", isa_name), program_libm_ns / program_ns, "x");
+            report.add(std::format("Tensor graph {} speedup", isa_name), tensor_libm_ns / tensor_ns, "x");
+        }
+    }
+    VectorMath::set_isa(VectorMath::supported_isa());
+
+    std::println("\n(checksum: {})", checksum);
+
+    if (json_path) {
+        std::FILE* file = std::fopen(json_path, "w");
+        if (!file) {
+            std::println("cannot open {}", json_path);
+            return 1;
+        }
+        report.write_json(file, checksum);
+        std::fclose(file);
+    }
+    return 0;
+}
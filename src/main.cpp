@@ -1,8 +1,22 @@
+// count heap allocations for the Profiler (see Profiler.hpp)
+#define AUTOGRAD_PROFILE_ALLOCATIONS
 #include <iostream>
 #include <iomanip>
+#include <fstream>
+#include <vector>
+#include <algorithm>
 #include <print>
 #include "Variable.hpp"
 #include "Dual.hpp"
+#include "Tape.hpp"
+#include "BatchProgram.hpp"
+#include "CompiledFunction.hpp"
+#include "Expression.hpp"
+#include "Tensor.hpp"
+#include "GraphStats.hpp"
+#include "Hessian.hpp"
+#include "Jet.hpp"
+#include "GraphOptimization.hpp"
 
 
 template<typename T>
@@ -85,6 +99,11 @@ int main(int argc, char const *argv[])
     dual_out = f(dual_x, dual_y);
     std::println("{}", dual_out);
 
+    // a Dual with two tangents computes df/dx and df/dy in a single call
+    using Dual2 = Dual<dtype, 2>;
+    auto dual2_out = f(Dual2::variable(2, 0), Dual2::variable(5, 1));
+    std::println("{}", dual2_out);
+
 
     std::println("\n\n{:~^50}", " Backward mode differentiation: ");
     // backwards mode differentiation needs a forward and then backward call to
@@ -99,6 +118,52 @@ int main(int argc, char const *argv[])
     std::println("df/dx = {:d.8}", df_dx);
     std::println("df/dy = {:d.8}", df_dy);
 
+    std::println("\n\n{:~^50}", " Tape mode differentiation: ");
+    // the tape records every operation in a contiguous buffer instead of
+    // creating graph nodes; a single reverse sweep computes df/dx and df/dy
+    Tape<dtype>::get().reset();
+    TapeVariable<dtype> tape_x(2), tape_y(5);
+    auto tape_out = f(tape_x, tape_y);
+    tape_out.backward();
+    std::println("f(x, y) = {:.8} ({} records)", tape_out.value(), Tape<dtype>::get().size());
+    std::println("df/dx = {:.8}", tape_x.grad());
+    std::println("df/dy = {:.8}", tape_y.grad());
+
+    std::println("\n\n{:~^50}", " Compiled differentiation: ");
+    // the graph that f builds is captured once and then replayed with new
+    // inputs over preallocated buffers, without creating any nodes
+    auto compiled = CompiledFunction<dtype>::compile([](auto x, auto y) { return f(x, y); }, 2, 5);
+    for (dtype compiled_x : {2, 1}) {
+        dtype compiled_out = compiled.forward(compiled_x, 5);
+        compiled.backward();
+        std::println("f({}, 5) = {:.8} ({} steps), df/dx = {:.8}, df/dy = {:.8}", compiled_x, compiled_out, compiled.size(), compiled.grad(0), compiled.grad(1));
+    }
+
+    std::println("\n\n{:~^50}", " Batched differentiation: ");
+    // f is recorded once at (2, 5) and then replayed over a batch of points,
+    // stored as all x followed by all y; the branch in f() is guarded, and
+    // points that take the other branch are reported
+    auto program = BatchProgram<dtype>::record([](auto x, auto y) { return f(x, y); }, 2, 5);
+    std::vector<dtype> batch_inputs{2, 1, 2, 5, 5, -1};
+    std::vector<dtype> batch_values(3), batch_grads(6);
+    auto diverged = program.evaluate(batch_inputs, batch_values, batch_grads);
+    for (std::size_t p = 0; p < batch_values.size(); ++p)
+        std::println("f({}, {}) = {:.8}, df/dx = {:.8}, df/dy = {:.8}{}", batch_inputs[p], batch_inputs[3 + p],
+            batch_values[p], batch_grads[p], batch_grads[3 + p],
+            std::ranges::find(diverged, p) != diverged.end() ? " (diverged from the recording)" : "");
+
+    std::println("\n\n{:~^50}", " Tensor differentiation: ");
+    // every node holds a whole tensor, e.g. a linear layer with a bias that
+    // is broadcast over the rows of the inputs only needs a handful of nodes
+    Variable<Tensor<dtype>> W(Tensor<dtype>({2, 3}, {0.1f, -0.2f, 0.3f, 0.4f, 0.5f, -0.6f}), true);
+    Variable<Tensor<dtype>> bias(Tensor<dtype>({3}, {0.1f, 0.2f, 0.3f}), true);
+    Variable<Tensor<dtype>> inputs(Tensor<dtype>({4, 2}, {1, 2, 3, 4, 5, 6, 7, 8}));
+    auto loss = (matmul(inputs, W) + bias).sin().mean();
+    loss.backward();
+    std::println("{}", loss);
+    std::println("dloss/dW = {:.4}", W.grad_value().value());
+    std::println("dloss/dbias = {:.4}", bias.grad_value().value());
+
     std::println("\n\n{:~^50}", " Second order derivatives: ");
     x.zero_grad();
     y.zero_grad();
@@ -174,5 +239,90 @@ int main(int argc, char const *argv[])
     std::println("{:d.8}", a);
     std::println("{:d.8}", b);
 
+    std::println("\n\n{:~^50}", " Expression template differentiation: ");
+    // the same expression as a generic lambda, which is differentiated at
+    // compile time without building a graph, or inserted into a graph as a
+    // single linearized node per argument
+    auto expr = [](auto a, auto b) { return a.log() + a * b - b.sin(); };
+    auto [expr_value, expr_grad] = value_and_grad(expr, dtype(2), dtype(5));
+    std::println("value = {:.8}, d/da = {:.8}, d/db = {:.8}", expr_value, expr_grad[0], expr_grad[1]);
+
+    Variable<dtype> expr_a(2, true), expr_b(5, true);
+    auto expr_out = as_variable(expr, expr_a, expr_b);
+    expr_out.backward();
+    std::println("{:.8}", expr_out);
+    std::println("{:.8}", expr_a);
+    std::println("{:.8}", expr_b);
+
+    std::println("\n\n{:~^50}", " Hessian-vector products: ");
+    // a graph of Duals carries the derivatives along a direction v, thus one
+    // backward pass yields the gradient and the Hessian-vector product H v
+    Variable<Dual<dtype>> hvp_x(Dual<dtype>(2, 1), true), hvp_y(Dual<dtype>(5, 0), true);
+    f(hvp_x, hvp_y).backward();
+    std::println("(df/dx, d²f/dx²)  = {}", hvp_x.grad_value().value());
+    std::println("(df/dy, d²f/dydx) = {}", hvp_y.grad_value().value());
+    auto [hvp_grad, hv] = grad_and_hvp([](auto v) { return f(v[0], v[1]); }, std::vector<dtype>{2, 5}, std::vector<dtype>{0, 1});
+    std::println("grad = [{}, {}], H [0, 1] = [{}, {}]", hvp_grad[0], hvp_grad[1], hv[0], hv[1]);
+
+    std::println("\n\n{:~^50}", " Taylor mode differentiation: ");
+    // a Jet propagates the Taylor coefficients up to order 3, thus a single
+    // forward pass yields the derivatives of D computed above
+    auto jet_X = Jet<dtype, 3>::variable(2);
+    auto jet_A = jet_X.log();
+    auto jet_D = jet_A.cos() + jet_A.exp();
+    std::println("D = {}", jet_D);
+    std::println("d³D/dX³ = {:.8}", jet_D.derivative(3));
+    std::println("(f, df/dx, d²f/dx², d³f/dx³) = {}", f(Jet<dtype, 3>::variable(2), Jet<dtype, 3>(5)));
+
+    std::println("\n\n{:~^50}", " Graph optimization: ");
+    // the graph of a gradient contains products with the seed 1, double
+    // negations and repeated subexpressions, which are removed before it is
+    // differentiated again
+    Variable<dtype> opt_x(2, true), opt_y(5, true);
+    f(opt_x, opt_y).backward(1, true, true);
+    auto opt_df_dx = opt_x.grad().value();
+    const std::size_t opt_nodes = graph_stats(opt_df_dx).nodes;
+    GraphOptimizationStats opt_stats = optimize_graph(opt_df_dx);
+    std::println("df/dx: {} -> {} nodes ({} folded, {} simplified, {} merged)",
+        opt_nodes, graph_stats(opt_df_dx).nodes, opt_stats.folded, opt_stats.simplified, opt_stats.merged);
+    opt_x.zero_grad();
+    opt_y.zero_grad();
+    opt_df_dx.backward();
+    std::println("d²f/dx² = {}, d²f/dxdy = {}", opt_x.grad_value().value(), opt_y.grad_value().value());
+
+    std::println("\n\n{:~^50}", " Inference: ");
+    // no graph is built within a NoGrad scope, even though the inputs
+    // require a gradient
+    {
+        NoGrad no_grad;
+        Variable<dtype> inference_x(2, true), inference_y(5, true);
+        Variable<dtype> prediction = f(inference_x, inference_y);
+        std::println("f(2, 5) = {}, requires_grad = {}, {} nodes", prediction.value(), prediction.requires_grad(), graph_stats(prediction).nodes);
+    }
+
+    std::println("\n\n{:~^50}", " Profiling: ");
+    // the operations and backward nodes of the current thread are recorded
+    // while the profiler is active, the trace can be opened in Perfetto
+    Profiler profiler;
+    {
+        Profiler::Scope scope(profiler);
+        Variable<dtype> prof_x(2, true), prof_y(5, true);
+        f(prof_x, prof_y).backward();
+    }
+    profiler.print_summary(std::cout);
+    std::ofstream trace("autograd_trace.json");
+    profiler.write_chrome_trace(trace);
+    std::println("{} events written to autograd_trace.json", profiler.events().size());
+
+    std::println("\n\n{:~^50}", " Graph inspection: ");
+    // a retained graph pins all of its nodes until its root goes out of scope
+    Variable<dtype> graph_x(2, true), graph_y(5, true);
+    auto graph_out = f(graph_x, graph_y);
+    graph_out.backward(1, true);
+    std::println("{}", graph_stats(graph_out));
+    std::ofstream dot("autograd_graph.dot");
+    write_dot(dot, graph_out);
+    std::println("graph written to autograd_graph.dot");
+
     return 0;
 }